@@ -0,0 +1,249 @@
+/* Microbenchmarks for the core against the mock server (src/mock.c).
+ *
+ * Maps CLIENTS windows, each with one of RULES WM_CLASSes that have a
+ * rule, through the normal MapRequest path, then times window lookups,
+ * rule matching, focus changes, a dispatch of ConfigureNotify and
+ * PropertyNotify batches and the detach of everything on DestroyNotify. No X server
+ * is involved; every number is the window manager's own work. */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "base.h"
+#include "cc/simple.h"
+
+#define CLIENTS 10000
+#define ROUNDS  1000000
+#define BATCH   64
+#define RULES   1000
+
+static xcb_window_t  clients[CLIENTS];
+static client_rule_s rules[RULES];
+static char          rule_names[RULES][16];
+
+static uint64_t rnd_state = 88172645463325252ull;
+
+static inline uint64_t
+rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+report(const char *name, double t, long ops)
+{
+    printf("%-12s %10ld ops %8.3f s %8.1f ns/op  live %u\n",
+           name, ops, t, t * 1e9 / ops, wnd_dict_count());
+}
+
+static void
+timer_nop(void *data)
+{ }
+
+/* a far timer sharing the current slot of level 1 must not hide a
+ * nearer one further on; all phases within the slot are tried */
+static int
+timer_check(void)
+{
+    timeout_s far, near;
+    uint64_t start, next;
+    int k;
+
+    timeout_init(&far, timer_nop, NULL);
+    timeout_init(&near, timer_nop, NULL);
+    for (k = 0; k < 64; ++ k)
+    {
+        timeout_add(&far, (4032 + k) * 1000000ull);
+        start = time_now_ns();
+        timeout_add(&near, 200000000ull);
+        next = timeout_next();
+        timeout_cancel(&far);
+        timeout_cancel(&near);
+        if (next > start + 200000000ull + 2 * TIMEOUT_TICK_NS)
+        {
+            fprintf(stderr, "timeout_next %.1f ms ahead, wanted 200\n", (next - start) / 1e6);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static client_t
+client_of(xcb_window_t window)
+{
+    wnd_dict_node_t node = wnd_dict_find(window, WND_DICT_FIND_OP_NONE);
+    return node && node->role == WND_ROLE_CLIENT ? (client_t)node->link : NULL;
+}
+
+int
+main(void)
+{
+    int i, j;
+    double t;
+    long found = 0;
+    pool_t pool;
+
+    mock_use();
+    if (wm_init() != 0)
+    {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    cc_simple->init(cc_simple);
+    if (wm_setup() != 0)
+    {
+        fprintf(stderr, "setup failed\n");
+        return 1;
+    }
+    if (timer_check() != 0)
+        return 1;
+
+    for (i = 0; i < RULES; ++ i)
+    {
+        snprintf(rule_names[i], sizeof(rule_names[i]), "app%d", i);
+        rules[i].wm_class    = rule_names[i];
+        rules[i].window_type = i & 1 ? WINDOW_TYPE_NORMAL : WINDOW_TYPE_ANY;
+        rules[i].class       = cc_simple;
+        client_rule_add(&rules[i]);
+    }
+
+    for (i = 0; i < CLIENTS; ++ i)
+    {
+        rect_s r = { (rnd() % 1600), (rnd() % 800), 100 + rnd() % 200, 80 + rnd() % 200 };
+        clients[i] = 0x00600001 + i * 4;
+        mock_window_add(clients[i], MOCK_ROOT, &r, 0, 0);
+        mock_window_class(clients[i], "bench", rule_names[rnd() % RULES]);
+    }
+
+    t = now();
+    for (i = 0; i < CLIENTS; ++ i)
+    {
+        xcb_map_request_event_t e;
+        memset(&e, 0, sizeof(e));
+        e.response_type = XCB_MAP_REQUEST;
+        e.parent        = MOCK_ROOT;
+        e.window        = clients[i];
+        mock_event_push(&e);
+    }
+    wm_dispatch();
+    report("attach", now() - t, CLIENTS);
+
+    for (i = 0; i < CLIENTS; ++ i)
+    {
+        if (client_of(clients[i]) == NULL)
+        {
+            fprintf(stderr, "window %08x not attached\n", clients[i]);
+            return 1;
+        }
+    }
+
+    t = now();
+    for (i = 0; i < ROUNDS; ++ i)
+    {
+        uint64_t r = rnd();
+        if (r & 3)
+            found += wnd_dict_find(clients[(r >> 8) % CLIENTS], WND_DICT_FIND_OP_NONE) != NULL;
+        else
+            found += wnd_dict_find((xcb_window_t)(r >> 32), WND_DICT_FIND_OP_NONE) != NULL;
+    }
+    report("find", now() - t, ROUNDS);
+
+    t = now();
+    for (i = 0; i < ROUNDS; ++ i)
+        found += client_rule_match(client_of(clients[rnd() % CLIENTS])) != NULL;
+    report("rule-match", now() - t, ROUNDS);
+
+    t = now();
+    for (i = 0; i < ROUNDS / 10; ++ i)
+        focus_set(client_of(clients[rnd() % CLIENTS]));
+    report("focus", now() - t, ROUNDS / 10);
+
+    t = now();
+    for (i = 0; i < ROUNDS / BATCH / 10; ++ i)
+    {
+        for (j = 0; j < BATCH; ++ j)
+        {
+            client_t c = client_of(clients[rnd() % CLIENTS]);
+            xcb_configure_notify_event_t e;
+            memset(&e, 0, sizeof(e));
+            e.response_type = XCB_CONFIGURE_NOTIFY;
+            e.event         = c->xcb_container;
+            e.window        = c->xcb_container;
+            e.x             = rnd() % 1600;
+            e.y             = rnd() % 800;
+            e.width         = c->geom[CLIENT_GEOM_CONTAINER].w;
+            e.height        = c->geom[CLIENT_GEOM_CONTAINER].h;
+            mock_event_push(&e);
+        }
+        wm_dispatch();
+    }
+    report("configure", now() - t, ROUNDS / 10);
+
+    /* every title is wanted, so each change is a refetch */
+    for (i = 0; i < CLIENTS; ++ i)
+        client_title(client_of(clients[i]));
+    wm_dispatch();
+
+    t = now();
+    for (i = 0; i < ROUNDS / BATCH / 10; ++ i)
+    {
+        for (j = 0; j < BATCH; ++ j)
+        {
+            xcb_property_notify_event_t e;
+            memset(&e, 0, sizeof(e));
+            e.response_type = XCB_PROPERTY_NOTIFY;
+            e.window        = clients[rnd() % CLIENTS];
+            e.atom          = XCB_ATOM_WM_NAME;
+            e.state         = XCB_PROPERTY_NEW_VALUE;
+            mock_event_push(&e);
+        }
+        wm_dispatch();
+    }
+    report("property", now() - t, ROUNDS / 10);
+
+    t = now();
+    for (i = 0; i < CLIENTS; ++ i)
+    {
+        xcb_destroy_notify_event_t e;
+        memset(&e, 0, sizeof(e));
+        e.response_type = XCB_DESTROY_NOTIFY;
+        e.event         = clients[i];
+        e.window        = clients[i];
+        x_destroy_window(clients[i]);
+        mock_event_push(&e);
+    }
+    wm_dispatch();
+    report("detach", now() - t, CLIENTS);
+
+    printf("requests     %10lu\n", mock_requests());
+    for (pool = pools; pool; pool = pool->next)
+        printf("pool %-7s %10lu high %4lu chunks %8lu allocs\n",
+               pool->name, pool->high, pool->nchunks, pool->allocs);
+
+    for (i = 0; i < CLIENTS; ++ i)
+    {
+        if (client_of(clients[i]) != NULL)
+        {
+            fprintf(stderr, "window %08x still attached\n", clients[i]);
+            return 1;
+        }
+    }
+
+    wm_cleanup();
+    return found == 0;
+}
@@ -0,0 +1,138 @@
+/* Desktop switching benchmark against the mock server (src/mock.c).
+ *
+ * Maps CLIENTS windows, spreads them over DESKTOPS desktops and times
+ * switches between random desktops. Every switch is checked: exactly
+ * the clients of the new desktop must have their frames mapped. */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "base.h"
+#include "cc/simple.h"
+
+#define CLIENTS  1000
+#define DESKTOPS 10
+#define SWITCHES 10000
+
+static xcb_window_t clients[CLIENTS];
+
+static uint64_t rnd_state = 88172645463325252ull;
+
+static inline uint64_t
+rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static client_t
+client_of(xcb_window_t window)
+{
+    wnd_dict_node_t node = wnd_dict_find(window, WND_DICT_FIND_OP_NONE);
+    return node && node->role == WND_ROLE_CLIENT ? (client_t)node->link : NULL;
+}
+
+static int
+check(unsigned int desktop)
+{
+    int i;
+
+    for (i = 0; i < CLIENTS; ++ i)
+    {
+        client_t c = client_of(clients[i]);
+        int mapped = mock_window_mapped(c->xcb_container);
+        if (mapped != (c->desktop == desktop))
+        {
+            fprintf(stderr, "client %08x on desktop %u is %s on desktop %u\n",
+                    clients[i], c->desktop, mapped ? "shown" : "hidden", desktop);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int
+main(void)
+{
+    int i;
+    double t;
+    unsigned long requests;
+    screen_t screen;
+
+    desktop_count = DESKTOPS;
+    mock_use();
+    if (wm_init() != 0)
+    {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    cc_simple->init(cc_simple);
+    if (wm_setup() != 0)
+    {
+        fprintf(stderr, "setup failed\n");
+        return 1;
+    }
+    screen = &screens[0];
+
+    for (i = 0; i < CLIENTS; ++ i)
+    {
+        rect_s r = { (rnd() % 1600), (rnd() % 800), 100 + rnd() % 200, 80 + rnd() % 200 };
+        xcb_map_request_event_t e;
+
+        clients[i] = 0x00600001 + i * 4;
+        mock_window_add(clients[i], MOCK_ROOT, &r, 0, 0);
+
+        memset(&e, 0, sizeof(e));
+        e.response_type = XCB_MAP_REQUEST;
+        e.parent        = MOCK_ROOT;
+        e.window        = clients[i];
+        mock_event_push(&e);
+    }
+    wm_dispatch();
+
+    t = now();
+    for (i = 0; i < CLIENTS; ++ i)
+        client_desktop_set(client_of(clients[i]), i % DESKTOPS);
+    t = now() - t;
+    printf("%-12s %10d ops %8.3f s %8.1f ns/op\n", "move", CLIENTS, t, t * 1e9 / CLIENTS);
+
+    if (check(0)) return 1;
+
+    requests = mock_requests();
+    t = now();
+    for (i = 0; i < SWITCHES; ++ i)
+        desktop_switch(screen, rnd() % DESKTOPS);
+    t = now() - t;
+    printf("%-12s %10d ops %8.3f s %8.1f ns/op  %.1f requests/switch\n", "switch",
+           SWITCHES, t, t * 1e9 / SWITCHES, (double)(mock_requests() - requests) / SWITCHES);
+
+    if (check(screen->desktop_current)) return 1;
+
+    /* and back and forth between two, the common case */
+    requests = mock_requests();
+    t = now();
+    for (i = 0; i < SWITCHES; ++ i)
+        desktop_switch(screen, i & 1);
+    t = now() - t;
+    printf("%-12s %10d ops %8.3f s %8.1f ns/op  %.1f requests/switch\n", "toggle",
+           SWITCHES, t, t * 1e9 / SWITCHES, (double)(mock_requests() - requests) / SWITCHES);
+
+    if (check(screen->desktop_current)) return 1;
+
+    wm_cleanup();
+    return 0;
+}
@@ -0,0 +1,849 @@
+/* Load generator for a running cwm.
+ *
+ * Connects to $DISPLAY (normally a private Xvfb started by load.sh),
+ * waits for the window manager to take SubstructureRedirect on the
+ * root and then drives synthetic workloads against it:
+ *
+ *   drag       XTest drag of one client with Mod1+Button1, one pixel
+ *              per step, until the container arrives there
+ *   create_map create and map WINDOWS windows in one burst, until
+ *              each client window is mapped inside its container
+ *   unmap_map  ROUNDS bursts unmapping and remapping all windows
+ *   destroy    destroy all windows in one burst, until cwm destroyed
+ *              each container
+ *   sync_resize XTest resize, one pixel per SYNC_STEP_MS, of a client
+ *              in another process that takes SYNC_REDRAW_MS to draw
+ *              each configure it gets and answers _NET_WM_SYNC_REQUEST;
+ *              latency runs from a motion to the client having drawn
+ *              that size, so a backlog of configures shows up as ever
+ *              growing samples
+ *
+ * Latency is measured per operation from the flush of the request to
+ * the arrival of the event that shows cwm handled it. Results go to
+ * stdout as a single JSON object. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#include <xcb/xcb.h>
+#include <xcb/xtest.h>
+#include <xcb/sync.h>
+
+#define WINDOWS      500
+#define ROUNDS       20
+#define DRAG_STEPS   500
+#define WAIT_TIMEOUT 5000       /* ms without progress before giving up */
+#define WM_TIMEOUT   10000      /* ms to wait for the window manager */
+
+#define SYNC_STEPS     300
+#define SYNC_STEP_MS   2
+#define SYNC_REDRAW_MS 50
+
+#define KEYSYM_ALT_L 0xffe9
+
+typedef struct load_window_s
+{
+    xcb_window_t window;
+    xcb_window_t container;
+    double       sent;
+    int          done;
+} load_window_s;
+
+typedef struct load_result_s
+{
+    const char *name;
+    long        ops;
+    double      seconds;
+    double     *samples;
+    long        count;
+} load_result_s;
+
+static xcb_connection_t *conn;
+static xcb_screen_t     *screen;
+
+static load_window_s *windows;
+static int            window_count;
+static int            pending;
+
+/* id -> index of windows[], for both client windows and containers */
+static xcb_window_t *index_key;
+static int          *index_val;
+static unsigned int  index_mask;
+
+static double *samples;
+static long    sample_count;
+
+static load_result_s results[5];
+static int           result_count;
+
+/* the drag target, set while the drag workload is running */
+static xcb_window_t drag_container = XCB_NONE;
+static int          drag_want_x;
+static int          drag_arrived;
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void
+index_put(xcb_window_t key, int val)
+{
+    unsigned int i = (key * 2654435761u) & index_mask;
+    while (index_key[i] != XCB_NONE && index_key[i] != key)
+        i = (i + 1) & index_mask;
+    index_key[i] = key;
+    index_val[i] = val;
+}
+
+static int
+index_get(xcb_window_t key)
+{
+    unsigned int i = (key * 2654435761u) & index_mask;
+    while (index_key[i] != XCB_NONE)
+    {
+        if (index_key[i] == key) return index_val[i];
+        i = (i + 1) & index_mask;
+    }
+    return -1;
+}
+
+static void
+sample(double sent)
+{
+    samples[sample_count ++] = (now() - sent) * 1e6;
+}
+
+static void
+complete(int i)
+{
+    if (i < 0 || windows[i].done) return;
+
+    windows[i].done = 1;
+    -- pending;
+    sample(windows[i].sent);
+}
+
+static void
+handle(xcb_generic_event_t *e)
+{
+    switch (e->response_type & ~0x80)
+    {
+    case 0:
+    {
+        xcb_generic_error_t *error = (xcb_generic_error_t *)e;
+        fprintf(stderr, "X error %d, major %d, resource %08x\n",
+                error->error_code, error->major_code, error->resource_id);
+        break;
+    }
+
+    case XCB_REPARENT_NOTIFY:
+    {
+        xcb_reparent_notify_event_t *r = (xcb_reparent_notify_event_t *)e;
+        int i = index_get(r->window);
+
+        if (r->event != r->window || i < 0) break;
+        if (r->parent != screen->root)
+        {
+            windows[i].container = r->parent;
+            index_put(r->parent, i);
+        }
+        break;
+    }
+
+    case XCB_MAP_NOTIFY:
+    {
+        xcb_map_notify_event_t *m = (xcb_map_notify_event_t *)e;
+        int i = index_get(m->window);
+
+        /* only a client window mapped inside its container counts */
+        if (m->event == m->window && i >= 0 && windows[i].window == m->window &&
+            windows[i].container != XCB_NONE)
+            complete(i);
+        break;
+    }
+
+    case XCB_DESTROY_NOTIFY:
+    {
+        xcb_destroy_notify_event_t *d = (xcb_destroy_notify_event_t *)e;
+        int i;
+
+        if (d->event != screen->root) break;
+        if ((i = index_get(d->window)) >= 0 && windows[i].container == d->window)
+            complete(i);
+        break;
+    }
+
+    case XCB_CONFIGURE_NOTIFY:
+    {
+        xcb_configure_notify_event_t *c = (xcb_configure_notify_event_t *)e;
+
+        if (c->event == screen->root && c->window == drag_container &&
+            c->x == drag_want_x)
+            drag_arrived = 1;
+        break;
+    }
+    }
+}
+
+/* handle events until cond() holds; fails after WAIT_TIMEOUT ms
+ * without any event */
+static int
+pump(int (*cond)(void))
+{
+    struct pollfd pfd;
+    xcb_generic_event_t *e;
+
+    pfd.fd     = xcb_get_file_descriptor(conn);
+    pfd.events = POLLIN;
+
+    while (!cond())
+    {
+        if ((e = xcb_poll_for_event(conn)) != NULL)
+        {
+            handle(e);
+            free(e);
+            continue;
+        }
+
+        if (xcb_connection_has_error(conn))
+            return -1;
+        if (poll(&pfd, 1, WAIT_TIMEOUT) == 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+cond_all_done(void)
+{
+    return pending == 0;
+}
+
+static int
+cond_drag_arrived(void)
+{
+    return drag_arrived;
+}
+
+static void
+result_begin(void)
+{
+    sample_count = 0;
+}
+
+static void
+result_end(const char *name, long ops, double seconds)
+{
+    load_result_s *r = &results[result_count ++];
+
+    r->name    = name;
+    r->ops     = ops;
+    r->seconds = seconds;
+    r->count   = sample_count;
+    r->samples = (double *)malloc(sizeof(double) * (sample_count ? sample_count : 1));
+    memcpy(r->samples, samples, sizeof(double) * sample_count);
+}
+
+static int
+wait_for_wm(void)
+{
+    double deadline = now() + WM_TIMEOUT / 1000.0;
+    uint32_t mask = XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT;
+    struct timespec backoff = { 0, 20000000 };
+    xcb_generic_error_t *error;
+
+    while (now() < deadline)
+    {
+        error = xcb_request_check(
+            conn, xcb_change_window_attributes_checked(conn, screen->root, XCB_CW_EVENT_MASK, &mask));
+        if (error)
+        {
+            free(error);
+            return 0;
+        }
+
+        /* nobody there yet, give it back */
+        mask = XCB_EVENT_MASK_NO_EVENT;
+        xcb_change_window_attributes(conn, screen->root, XCB_CW_EVENT_MASK, &mask);
+        mask = XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT;
+        xcb_flush(conn);
+        nanosleep(&backoff, NULL);
+    }
+
+    return -1;
+}
+
+static xcb_window_t
+create(int x, int y, int w, int h)
+{
+    xcb_window_t window = xcb_generate_id(conn);
+    uint32_t values[] = { screen->white_pixel, XCB_EVENT_MASK_STRUCTURE_NOTIFY };
+
+    xcb_create_window(conn, XCB_COPY_FROM_PARENT, window, screen->root,
+                      x, y, w, h, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
+                      screen->root_visual, XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK, values);
+    return window;
+}
+
+static void
+windows_reset(void)
+{
+    int i;
+
+    pending = 0;
+    for (i = 0; i < window_count; ++ i)
+        windows[i].done = 0;
+}
+
+static int
+run_create_map(void)
+{
+    double start;
+    int i;
+
+    result_begin();
+
+    for (i = 0; i < window_count; ++ i)
+    {
+        windows[i].window    = create((i * 7) % (screen->width_in_pixels - 200),
+                                      (i * 5) % (screen->height_in_pixels - 150),
+                                      200, 150);
+        windows[i].container = XCB_NONE;
+        index_put(windows[i].window, i);
+    }
+    xcb_flush(conn);
+
+    windows_reset();
+    start = now();
+    for (i = 0; i < window_count; ++ i)
+    {
+        xcb_map_window(conn, windows[i].window);
+        windows[i].sent = start;
+    }
+    pending = window_count;
+    xcb_flush(conn);
+
+    if (pump(cond_all_done)) return -1;
+
+    result_end("create_map", window_count, now() - start);
+    return 0;
+}
+
+static int
+run_unmap_map(void)
+{
+    double start, sent;
+    int r, i;
+
+    result_begin();
+    start = now();
+
+    for (r = 0; r < ROUNDS; ++ r)
+    {
+        for (i = 0; i < window_count; ++ i)
+            xcb_unmap_window(conn, windows[i].window);
+
+        windows_reset();
+        sent = now();
+        for (i = 0; i < window_count; ++ i)
+        {
+            xcb_map_window(conn, windows[i].window);
+            windows[i].sent = sent;
+        }
+        pending = window_count;
+        xcb_flush(conn);
+
+        if (pump(cond_all_done)) return -1;
+    }
+
+    result_end("unmap_map", (long)ROUNDS * window_count, now() - start);
+    return 0;
+}
+
+static int
+run_destroy(void)
+{
+    double start;
+    int i;
+
+    result_begin();
+
+    windows_reset();
+    start = now();
+    for (i = 0; i < window_count; ++ i)
+    {
+        xcb_destroy_window(conn, windows[i].window);
+        windows[i].sent = start;
+    }
+    pending = window_count;
+    xcb_flush(conn);
+
+    if (pump(cond_all_done)) return -1;
+
+    result_end("destroy", window_count, now() - start);
+    return 0;
+}
+
+static xcb_keycode_t
+find_keycode(xcb_keysym_t keysym)
+{
+    const xcb_setup_t *setup = xcb_get_setup(conn);
+    int count = setup->max_keycode - setup->min_keycode + 1;
+    xcb_get_keyboard_mapping_reply_t *reply;
+    xcb_keycode_t found = 0;
+    xcb_keysym_t *syms;
+    int i;
+
+    reply = xcb_get_keyboard_mapping_reply(
+        conn, xcb_get_keyboard_mapping(conn, setup->min_keycode, count), NULL);
+    if (reply == NULL) return 0;
+
+    syms = xcb_get_keyboard_mapping_keysyms(reply);
+    for (i = 0; i < count * reply->keysyms_per_keycode; ++ i)
+    {
+        if (syms[i] == keysym)
+        {
+            found = setup->min_keycode + i / reply->keysyms_per_keycode;
+            break;
+        }
+    }
+
+    free(reply);
+    return found;
+}
+
+static void
+fake(uint8_t type, uint8_t detail, int x, int y)
+{
+    xcb_test_fake_input(conn, type, detail, XCB_CURRENT_TIME, screen->root, x, y, 0);
+}
+
+static int
+run_drag(void)
+{
+    const xcb_query_extension_reply_t *ext = xcb_get_extension_data(conn, &xcb_test_id);
+    xcb_keycode_t alt;
+    xcb_get_geometry_reply_t *geom;
+    double start, sent;
+    int i, x, y, cx;
+
+    if (ext == NULL || !ext->present)
+    {
+        fprintf(stderr, "no XTEST, skipping drag\n");
+        return 0;
+    }
+    if ((alt = find_keycode(KEYSYM_ALT_L)) == 0)
+    {
+        fprintf(stderr, "no Alt_L keycode, skipping drag\n");
+        return 0;
+    }
+
+    /* a lone client, so the pointer cannot land on anything else */
+    windows[0].window    = create(100, 100, 300, 200);
+    windows[0].container = XCB_NONE;
+    index_put(windows[0].window, 0);
+
+    windows_reset();
+    windows[0].sent = now();
+    pending = 1;
+    xcb_map_window(conn, windows[0].window);
+    xcb_flush(conn);
+    if (pump(cond_all_done)) return -1;
+
+    geom = xcb_get_geometry_reply(conn, xcb_get_geometry(conn, windows[0].container), NULL);
+    if (geom == NULL) return -1;
+    cx = geom->x;
+    x  = geom->x + geom->width / 2;
+    y  = geom->y + geom->height / 2;
+    free(geom);
+
+    fake(XCB_MOTION_NOTIFY, 0, x, y);
+    fake(XCB_KEY_PRESS, alt, 0, 0);
+    fake(XCB_BUTTON_PRESS, XCB_BUTTON_INDEX_1, 0, 0);
+    xcb_flush(conn);
+
+    result_begin();
+    drag_container = windows[0].container;
+    start = now();
+
+    for (i = 1; i <= DRAG_STEPS; ++ i)
+    {
+        /* back and forth so it stays on screen */
+        int d = (i / 100) % 2 ? 100 - i % 100 : i % 100;
+
+        drag_want_x  = cx + d;
+        drag_arrived = 0;
+        sent = now();
+        fake(XCB_MOTION_NOTIFY, 0, x + d, y);
+        xcb_flush(conn);
+
+        if (pump(cond_drag_arrived)) return -1;
+        sample(sent);
+    }
+
+    result_end("drag", DRAG_STEPS, now() - start);
+
+    fake(XCB_BUTTON_RELEASE, XCB_BUTTON_INDEX_1, 0, 0);
+    fake(XCB_KEY_RELEASE, alt, 0, 0);
+    drag_container = XCB_NONE;
+
+    windows_reset();
+    windows[0].sent = now();
+    pending = 1;
+    xcb_destroy_window(conn, windows[0].window);
+    xcb_flush(conn);
+    return pump(cond_all_done);
+}
+
+static void
+sleep_ms(int ms)
+{
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+static xcb_atom_t
+intern(xcb_connection_t *c, const char *name)
+{
+    xcb_intern_atom_reply_t *r = xcb_intern_atom_reply(
+        c, xcb_intern_atom(c, 0, strlen(name), name), NULL);
+    xcb_atom_t atom = r ? r->atom : XCB_NONE;
+
+    free(r);
+    return atom;
+}
+
+typedef struct sync_drawn_s
+{
+    int    width;
+    double t;
+} sync_drawn_s;
+
+/* The slow client of sync_resize, in its own process and connection.
+ * It draws every configure it gets, one at a time, and then sets its
+ * counter to the value of the sync request that came before it. It
+ * tells the window id, and in the end what it drew when, through out;
+ * a width on in asks it to finish once that width is drawn. */
+static void
+sync_client(int in, int out)
+{
+    xcb_connection_t *c = xcb_connect(NULL, NULL);
+    xcb_screen_t *s = xcb_setup_roots_iterator(xcb_get_setup(c)).data;
+    xcb_atom_t protocols = intern(c, "WM_PROTOCOLS");
+    xcb_atom_t request   = intern(c, "_NET_WM_SYNC_REQUEST");
+    xcb_atom_t counter_p = intern(c, "_NET_WM_SYNC_REQUEST_COUNTER");
+    xcb_sync_counter_t counter = xcb_generate_id(c);
+    xcb_sync_int64_t zero = { 0, 0 }, value = { 0, 0 }, next = { 0, 0 };
+    xcb_window_t window = xcb_generate_id(c);
+    uint32_t values[] = { s->white_pixel, XCB_EVENT_MASK_STRUCTURE_NOTIFY };
+    sync_drawn_s *drawn = (sync_drawn_s *)malloc(sizeof(sync_drawn_s) * SYNC_STEPS * 4);
+    int n = 0, width = 300, want = -1;
+    struct pollfd pfd[2];
+    xcb_generic_event_t *e;
+
+    free(xcb_sync_initialize_reply(c, xcb_sync_initialize(c, 3, 1), NULL));
+    xcb_sync_create_counter(c, counter, zero);
+
+    xcb_create_window(c, XCB_COPY_FROM_PARENT, window, s->root, 100, 100, width, 200, 0,
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT, s->root_visual,
+                      XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK, values);
+    xcb_change_property(c, XCB_PROP_MODE_REPLACE, window, protocols, XCB_ATOM_ATOM, 32, 1, &request);
+    xcb_change_property(c, XCB_PROP_MODE_REPLACE, window, counter_p, XCB_ATOM_CARDINAL, 32, 1, &counter);
+    xcb_map_window(c, window);
+    xcb_flush(c);
+    if (write(out, &window, sizeof(window)) != sizeof(window)) _exit(1);
+
+    pfd[0].fd = xcb_get_file_descriptor(c);
+    pfd[0].events = POLLIN;
+    pfd[1].fd = in;
+    pfd[1].events = POLLIN;
+
+    while (want < 0 || width != want)
+    {
+        if ((e = xcb_poll_for_event(c)) == NULL)
+        {
+            if (xcb_connection_has_error(c)) break;
+            if (poll(pfd, want < 0 ? 2 : 1, WAIT_TIMEOUT) == 0) break;
+            if (want < 0 && (pfd[1].revents & POLLIN) &&
+                read(in, &want, sizeof(want)) != sizeof(want))
+                break;
+            continue;
+        }
+
+        switch (e->response_type & ~0x80)
+        {
+        case XCB_CLIENT_MESSAGE:
+        {
+            xcb_client_message_event_t *m = (xcb_client_message_event_t *)e;
+            if (m->type == protocols && m->data.data32[0] == request)
+            {
+                next.lo = m->data.data32[2];
+                next.hi = (int32_t)m->data.data32[3];
+            }
+            break;
+        }
+
+        case XCB_CONFIGURE_NOTIFY:
+        {
+            xcb_configure_notify_event_t *cn = (xcb_configure_notify_event_t *)e;
+            if (cn->window != window || cn->width == width) break;
+
+            /* one configure, one slow redraw, one answer */
+            width = cn->width;
+            sleep_ms(SYNC_REDRAW_MS);
+            if (n < SYNC_STEPS * 4)
+            {
+                drawn[n].width = width;
+                drawn[n ++].t  = now();
+            }
+            if (next.lo != value.lo || next.hi != value.hi)
+            {
+                value = next;
+                xcb_sync_set_counter(c, counter, value);
+                xcb_flush(c);
+            }
+            break;
+        }
+        }
+        free(e);
+    }
+
+    if (write(out, &n, sizeof(n)) != sizeof(n) ||
+        write(out, drawn, sizeof(sync_drawn_s) * n) != (ssize_t)(sizeof(sync_drawn_s) * n))
+        _exit(1);
+    xcb_disconnect(c);
+    _exit(0);
+}
+
+static int
+read_all(int fd, void *buf, size_t len)
+{
+    char *p = (char *)buf;
+    ssize_t r;
+
+    while (len > 0)
+    {
+        if ((r = read(fd, p, len)) <= 0) return -1;
+        p   += r;
+        len -= r;
+    }
+    return 0;
+}
+
+static int
+run_sync_resize(void)
+{
+    const xcb_query_extension_reply_t *ext = xcb_get_extension_data(conn, &xcb_test_id);
+    const xcb_query_extension_reply_t *sync = xcb_get_extension_data(conn, &xcb_sync_id);
+    double sent[SYNC_STEPS + 1], start;
+    xcb_window_t window, container = XCB_NONE;
+    xcb_get_geometry_reply_t *geom;
+    xcb_keycode_t alt;
+    sync_drawn_s *drawn;
+    int to_client[2], from_client[2];
+    int i, n, x, y, w0, status;
+    pid_t pid;
+
+    if (ext == NULL || !ext->present || sync == NULL || !sync->present)
+    {
+        fprintf(stderr, "no XTEST or SYNC, skipping sync_resize\n");
+        return 0;
+    }
+    if ((alt = find_keycode(KEYSYM_ALT_L)) == 0)
+    {
+        fprintf(stderr, "no Alt_L keycode, skipping sync_resize\n");
+        return 0;
+    }
+
+    if (pipe(to_client) || pipe(from_client)) return -1;
+    if ((pid = fork()) < 0) return -1;
+    if (pid == 0)
+    {
+        close(to_client[1]);
+        close(from_client[0]);
+        sync_client(to_client[0], from_client[1]);
+    }
+    close(to_client[0]);
+    close(from_client[1]);
+
+    if (read_all(from_client[0], &window, sizeof(window))) return -1;
+
+    /* wait for the container to show */
+    for (i = 0; i < WAIT_TIMEOUT / 10 && container == XCB_NONE; ++ i)
+    {
+        xcb_query_tree_reply_t *tree = xcb_query_tree_reply(conn, xcb_query_tree(conn, window), NULL);
+        xcb_get_window_attributes_reply_t *attr =
+            xcb_get_window_attributes_reply(conn, xcb_get_window_attributes(conn, window), NULL);
+
+        if (tree && attr && tree->parent != screen->root &&
+            attr->map_state == XCB_MAP_STATE_VIEWABLE)
+            container = tree->parent;
+        free(tree);
+        free(attr);
+        if (container == XCB_NONE) sleep_ms(10);
+    }
+    if (container == XCB_NONE) return -1;
+
+    geom = xcb_get_geometry_reply(conn, xcb_get_geometry(conn, container), NULL);
+    if (geom == NULL) return -1;
+    w0 = geom->width;
+    x  = geom->x + geom->width - 10;
+    y  = geom->y + geom->height - 10;
+    free(geom);
+
+    fake(XCB_MOTION_NOTIFY, 0, x, y);
+    fake(XCB_KEY_PRESS, alt, 0, 0);
+    fake(XCB_BUTTON_PRESS, XCB_BUTTON_INDEX_3, 0, 0);
+    xcb_flush(conn);
+
+    start = now();
+    for (i = 1; i <= SYNC_STEPS; ++ i)
+    {
+        sent[i] = now();
+        fake(XCB_MOTION_NOTIFY, 0, x + i, y);
+        xcb_flush(conn);
+        sleep_ms(SYNC_STEP_MS);
+    }
+
+    fake(XCB_BUTTON_RELEASE, XCB_BUTTON_INDEX_3, 0, 0);
+    fake(XCB_KEY_RELEASE, alt, 0, 0);
+    xcb_flush(conn);
+
+    /* done once the client drew the last size */
+    n = w0 + SYNC_STEPS;
+    if (write(to_client[1], &n, sizeof(n)) != sizeof(n) ||
+        read_all(from_client[0], &n, sizeof(n)))
+        return -1;
+    drawn = (sync_drawn_s *)malloc(sizeof(sync_drawn_s) * (n ? n : 1));
+    if (read_all(from_client[0], drawn, sizeof(sync_drawn_s) * n)) return -1;
+    waitpid(pid, &status, 0);
+    close(to_client[1]);
+    close(from_client[0]);
+
+    result_begin();
+    for (i = 0; i < n; ++ i)
+    {
+        int step = drawn[i].width - w0;
+        if (step >= 1 && step <= SYNC_STEPS)
+            samples[sample_count ++] = (drawn[i].t - sent[step]) * 1e6;
+    }
+    result_end("sync_resize", n, (n ? drawn[n - 1].t : now()) - start);
+    free(drawn);
+
+    return 0;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double
+percentile(load_result_s *r, double q)
+{
+    long k;
+
+    if (r->count == 0) return 0;
+
+    /* nearest rank */
+    k = (long)(q * r->count + 0.999999) - 1;
+    if (k < 0) k = 0;
+    if (k >= r->count) k = r->count - 1;
+    return r->samples[k];
+}
+
+static void
+report(const char *label)
+{
+    int i;
+
+    printf("{\n  \"label\": \"%s\",\n  \"windows\": %d,\n  \"workloads\": [", label, window_count);
+    for (i = 0; i < result_count; ++ i)
+    {
+        load_result_s *r = &results[i];
+
+        qsort(r->samples, r->count, sizeof(double), cmp_double);
+        printf("%s\n    { \"name\": \"%s\", \"ops\": %ld, \"seconds\": %.6f, \"ops_per_sec\": %.1f,"
+               " \"p50_us\": %.1f, \"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f }",
+               i ? "," : "", r->name, r->ops, r->seconds,
+               r->seconds > 0 ? r->ops / r->seconds : 0,
+               percentile(r, 0.50), percentile(r, 0.99), percentile(r, 0.999),
+               r->count ? r->samples[r->count - 1] : 0);
+    }
+    printf("\n  ]\n}\n");
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *label = "";
+    int sample_max, size;
+    int opt;
+
+    window_count = WINDOWS;
+    while ((opt = getopt(argc, argv, "n:l:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n': window_count = atoi(optarg); break;
+        case 'l': label = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-n windows] [-l label]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (window_count < 1) window_count = 1;
+
+    conn = xcb_connect(NULL, NULL);
+    if (xcb_connection_has_error(conn))
+    {
+        fprintf(stderr, "cannot connect to display\n");
+        return 1;
+    }
+    screen = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+
+    if (wait_for_wm())
+    {
+        fprintf(stderr, "no window manager showed up\n");
+        return 1;
+    }
+
+    uint32_t mask = XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY;
+    xcb_change_window_attributes(conn, screen->root, XCB_CW_EVENT_MASK, &mask);
+
+    /* clients and containers of every workload, at most half full */
+    for (size = 64; size < window_count * 4 + 4; size <<= 1) ;
+    index_key  = (xcb_window_t *)calloc(size, sizeof(xcb_window_t));
+    index_val  = (int *)calloc(size, sizeof(int));
+    index_mask = size - 1;
+
+    sample_max = window_count * ROUNDS > DRAG_STEPS ? window_count * ROUNDS : DRAG_STEPS;
+    if (sample_max < SYNC_STEPS * 4) sample_max = SYNC_STEPS * 4;
+    windows = (load_window_s *)calloc(window_count, sizeof(load_window_s));
+    samples = (double *)malloc(sizeof(double) * sample_max);
+
+    if (run_drag() || run_sync_resize() ||
+        run_create_map() || run_unmap_map() || run_destroy())
+    {
+        fprintf(stderr, "timed out in workload %d\n", result_count + 1);
+        return 1;
+    }
+
+    report(label);
+    xcb_disconnect(conn);
+    return 0;
+}
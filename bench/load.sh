@@ -0,0 +1,55 @@
+#!/bin/sh
+# Run cwm on a private Xvfb and drive it with bench-load.
+#
+#   load.sh CWM BENCH_LOAD [bench-load options]
+#
+# The JSON report goes to stdout, everything else to stderr. The label
+# defaults to the current commit so reports can be compared over time.
+# CWM_FLAGS are passed to cwm, whose statistics (JSON, SIGUSR2) follow
+# on stderr once the load is done.
+
+set -e
+
+CWM=$1
+LOAD=$2
+shift 2
+
+LABEL=$(git describe --always --dirty 2>/dev/null || echo unknown)
+
+# first free display number
+N=90
+while [ -e /tmp/.X11-unix/X$N ] || [ -e /tmp/.X$N-lock ]; do
+    N=$((N + 1))
+done
+DISPLAY=:$N
+export DISPLAY
+
+Xvfb $DISPLAY -screen 0 1920x1080x24 -nolisten tcp >/dev/null 2>&1 &
+XVFB=$!
+
+cleanup() {
+    [ -n "$WM" ] && kill $WM 2>/dev/null
+    kill $XVFB 2>/dev/null
+    wait 2>/dev/null || true
+}
+trap cleanup EXIT INT TERM
+
+i=0
+while [ ! -e /tmp/.X11-unix/X$N ]; do
+    i=$((i + 1))
+    if [ $i -gt 100 ]; then
+        echo "Xvfb did not come up" >&2
+        exit 1
+    fi
+    sleep 0.1
+done
+
+"$CWM" $CWM_FLAGS >&2 &
+WM=$!
+
+"$LOAD" -l "$LABEL" "$@"
+
+# a last frame may still be due
+sleep 0.1
+kill -USR2 $WM
+sleep 0.1
@@ -0,0 +1,143 @@
+/* Smart placement benchmark against the mock server (src/mock.c).
+ *
+ * Maps windows one MapRequest at a time with PLACE_MODE_SMART and
+ * reports, at every checkpoint of the window count, the time of a
+ * placement alone, of a whole attach, and how many of the windows
+ * mapped since the last checkpoint found a spot free of overlap. */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "base.h"
+#include "cc/simple.h"
+
+#define CLIENTS 5000
+#define PROBES  10000
+
+static const int checkpoints[] = { 10, 100, 1000, 2000, 5000 };
+
+static uint64_t rnd_state = 88172645463325252ull;
+
+static inline uint64_t
+rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static client_t
+client_of(xcb_window_t window)
+{
+    wnd_dict_node_t node = wnd_dict_find(window, WND_DICT_FIND_OP_NONE);
+    return node && node->role == WND_ROLE_CLIENT ? (client_t)node->link : NULL;
+}
+
+/* overlap of the client with all others, the slow way */
+static uint64_t
+overlap(client_t client)
+{
+    rect_s a, b;
+    list_entry_t cur;
+    uint64_t sum = 0;
+
+    client_geom_get(client, CLIENT_GEOM_CONTAINER, &a);
+    for (cur = list_next(&client->screen->client_list); cur != &client->screen->client_list; cur = list_next(cur))
+    {
+        client_t other = CONTAINER_OF(cur, client_s, client_node);
+        int w, h;
+
+        if (other == client) continue;
+        client_geom_get(other, CLIENT_GEOM_CONTAINER, &b);
+        w = (a.x + (int)a.w < b.x + (int)b.w ? a.x + (int)a.w : b.x + (int)b.w) - (a.x > b.x ? a.x : b.x);
+        h = (a.y + (int)a.h < b.y + (int)b.h ? a.y + (int)a.h : b.y + (int)b.h) - (a.y > b.y ? a.y : b.y);
+        if (w > 0 && h > 0) sum += (uint64_t)w * h;
+    }
+    return sum;
+}
+
+int
+main(void)
+{
+    int i, j, c = 0, free_spots = 0, since = 0;
+    double attach = 0, t;
+
+    place_mode = PLACE_MODE_SMART;
+    mock_use();
+    if (wm_init() != 0)
+    {
+        fprintf(stderr, "init failed\n");
+        return 1;
+    }
+    cc_simple->init(cc_simple);
+    if (wm_setup() != 0)
+    {
+        fprintf(stderr, "setup failed\n");
+        return 1;
+    }
+
+    printf("%8s %12s %12s %10s\n", "windows", "place ns", "attach ns", "no overlap");
+    for (i = 0; i < CLIENTS; ++ i)
+    {
+        rect_s r = { 0, 0, 100 + rnd() % 300, 80 + rnd() % 200 };
+        xcb_window_t window = 0x00600001 + i * 4;
+        xcb_map_request_event_t e;
+
+        mock_window_add(window, MOCK_ROOT, &r, 0, 0);
+        memset(&e, 0, sizeof(e));
+        e.response_type = XCB_MAP_REQUEST;
+        e.parent        = MOCK_ROOT;
+        e.window        = window;
+        mock_event_push(&e);
+
+        t = now();
+        wm_dispatch();
+        attach += now() - t;
+
+        client_t client = client_of(window);
+        if (client == NULL)
+        {
+            fprintf(stderr, "window %08x not attached\n", window);
+            return 1;
+        }
+        free_spots += overlap(client) == 0;
+        ++ since;
+
+        if (i + 1 == checkpoints[c])
+        {
+            /* placing a window of the same size, without mapping it */
+            rect_s probe;
+            client_geom_get(client, CLIENT_GEOM_CONTAINER, &probe);
+
+            t = now();
+            for (j = 0; j < PROBES; ++ j)
+            {
+                rect_s p = probe;
+                place_find(client, &p);
+            }
+            t = now() - t;
+
+            printf("%8d %12.1f %12.1f %9.1f%%\n", i + 1, t * 1e9 / PROBES,
+                   attach * 1e9 / since, 100.0 * free_spots / since);
+            attach = 0;
+            free_spots = since = 0;
+            ++ c;
+        }
+    }
+
+    wm_cleanup();
+    return 0;
+}
@@ -0,0 +1,134 @@
+/* Microbenchmark for the window dictionary.
+ *
+ * Keeps WINDOWS live windows with X-like ids and runs two mixes over
+ * them: random churn (erase one, touch a fresh one) and find-heavy
+ * (mostly lookups of live and absent ids, some churn). */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "base.h"
+
+#define WINDOWS 100000
+#define ROUNDS  2000000
+
+static xcb_window_t live[WINDOWS];
+static xcb_window_t next_id = 0x00400001;
+
+static uint64_t rnd_state = 88172645463325252ull;
+
+static inline uint64_t
+rnd(void)
+{
+    rnd_state ^= rnd_state << 13;
+    rnd_state ^= rnd_state >> 7;
+    rnd_state ^= rnd_state << 17;
+    return rnd_state;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static xcb_window_t
+fresh_id(void)
+{
+    /* clients allocate ids in blocks, mimic a few resource bases */
+    next_id += 1 + (rnd() & 3);
+    if ((rnd() & 1023) == 0)
+        next_id = (next_id & ~0x1fffff) + 0x200000 + 1;
+    return next_id;
+}
+
+static void
+report(const char *name, double t, long ops)
+{
+    printf("%-12s %10ld ops %8.3f s %8.1f ns/op  live %u\n",
+           name, ops, t, t * 1e9 / ops, wnd_dict_count());
+}
+
+int
+main(void)
+{
+    int i;
+    double t;
+    long found = 0;
+
+    t = now();
+    for (i = 0; i < WINDOWS; ++ i)
+    {
+        live[i] = fresh_id();
+        wnd_dict_find(live[i], WND_DICT_FIND_OP_TOUCH)->role = WND_ROLE_CLIENT;
+    }
+    report("fill", now() - t, WINDOWS);
+
+    t = now();
+    for (i = 0; i < ROUNDS; ++ i)
+    {
+        int k = rnd() % WINDOWS;
+        wnd_dict_find(live[k], WND_DICT_FIND_OP_ERASE);
+        live[k] = fresh_id();
+        wnd_dict_find(live[k], WND_DICT_FIND_OP_TOUCH)->role = WND_ROLE_CLIENT;
+    }
+    report("churn", now() - t, 2L * ROUNDS);
+
+    t = now();
+    for (i = 0; i < ROUNDS; ++ i)
+    {
+        uint64_t r = rnd();
+        switch (r & 15)
+        {
+        case 0:
+        {
+            int k = (r >> 8) % WINDOWS;
+            wnd_dict_find(live[k], WND_DICT_FIND_OP_ERASE);
+            live[k] = fresh_id();
+            wnd_dict_find(live[k], WND_DICT_FIND_OP_TOUCH);
+            break;
+        }
+
+        case 1: case 2:
+            /* ids of windows we never managed */
+            found += wnd_dict_find((xcb_window_t)(r >> 32), WND_DICT_FIND_OP_NONE) != NULL;
+            break;
+
+        default:
+            found += wnd_dict_find(live[(r >> 8) % WINDOWS], WND_DICT_FIND_OP_NONE) != NULL;
+            break;
+        }
+    }
+    report("find-heavy", now() - t, ROUNDS);
+
+    t = now();
+    for (i = 0; i < ROUNDS; ++ i)
+    {
+        /* touching a known window must not grow the table */
+        wnd_dict_find(live[rnd() % WINDOWS], WND_DICT_FIND_OP_TOUCH);
+    }
+    report("re-touch", now() - t, ROUNDS);
+
+    if (wnd_dict_count() != WINDOWS)
+    {
+        fprintf(stderr, "live count mismatch: %u != %d\n", wnd_dict_count(), WINDOWS);
+        return 1;
+    }
+
+    for (i = 0; i < WINDOWS; ++ i)
+    {
+        wnd_dict_node_t node = wnd_dict_find(live[i], WND_DICT_FIND_OP_NONE);
+        if (node == NULL || node->wnd != live[i])
+        {
+            fprintf(stderr, "lost window %08x\n", live[i]);
+            return 1;
+        }
+    }
+
+    return found == 0;
+}
@@ -1,65 +1,15 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <signal.h>
-#include <sys/select.h>
+#include <time.h>
+#include <sys/epoll.h>
 
 #include "base.h"
 #include "cc/simple.h"
 
-#define HASH_MOD 19997
-#define HASH_MUL 10007
-
-static wnd_dict_node_t wnd_hash_list[HASH_MOD];
-
-wnd_dict_node_t
-wnd_dict_find(xcb_window_t wnd, int op)
-{
-    int h = (unsigned int)wnd * HASH_MUL % HASH_MOD;
-    wnd_dict_node_t last = NULL, node = wnd_hash_list[h];
-
-    while (node != NULL)
-    {
-        if (node->wnd == wnd) break;
-        
-        last = node;
-        node = node->next;
-    }
-
-    switch (op)
-    {
-    case WND_DICT_FIND_OP_TOUCH:
-        node = (wnd_dict_node_t)malloc(sizeof(wnd_dict_node_s));
-        node->wnd = wnd;
-        node->role = WND_ROLE_INIT;
-        node->link = NULL;
-
-        node->next = wnd_hash_list[h];
-        wnd_hash_list[h] = node;
-        
-        return node;
-
-    case WND_DICT_FIND_OP_ERASE:
-        if (node == NULL)
-            return NULL;
-        
-        if (last == NULL)
-        {
-            wnd_hash_list[h] = node->next;
-            free(node);
-        }
-        else
-        {
-            last->next = node->next;
-            free(node);
-        }
-        return node;
-        
-    default:
-        return node;
-    }
-}
-
 #ifndef LASTEvent
 #define LASTEvent 35
 #endif
@@ -74,17 +24,27 @@ static void xcb_event_destroy_notify(xcb_generic_event_t *e);
 static void xcb_event_button_press(xcb_generic_event_t *e);
 static void xcb_event_motion_notify(xcb_generic_event_t *e);
 static void xcb_event_button_release(xcb_generic_event_t *e);
+static void xcb_event_configure_notify(xcb_generic_event_t *e);
+static void xcb_event_client_message(xcb_generic_event_t *e);
+static void xcb_event_property_notify(xcb_generic_event_t *e);
+static void xcb_event_key_press(xcb_generic_event_t *e);
+static void xcb_event_mapping_notify(xcb_generic_event_t *e);
 
 event_handler_t event_handlers[LASTEvent] =
 {
-    [XCB_MAP_REQUEST]     = xcb_event_map_request,
-    [XCB_MAP_NOTIFY]      = xcb_event_map_notify,
-    [XCB_UNMAP_NOTIFY]    = xcb_event_unmap_notify,
-    [XCB_REPARENT_NOTIFY] = xcb_event_reparent_notify,
-    [XCB_DESTROY_NOTIFY]  = xcb_event_destroy_notify,
-    [XCB_BUTTON_PRESS]    = xcb_event_button_press,
-    [XCB_MOTION_NOTIFY]   = xcb_event_motion_notify,
-    [XCB_BUTTON_RELEASE]  = xcb_event_button_release,
+    [XCB_MAP_REQUEST]      = xcb_event_map_request,
+    [XCB_MAP_NOTIFY]       = xcb_event_map_notify,
+    [XCB_UNMAP_NOTIFY]     = xcb_event_unmap_notify,
+    [XCB_REPARENT_NOTIFY]  = xcb_event_reparent_notify,
+    [XCB_DESTROY_NOTIFY]   = xcb_event_destroy_notify,
+    [XCB_BUTTON_PRESS]     = xcb_event_button_press,
+    [XCB_MOTION_NOTIFY]    = xcb_event_motion_notify,
+    [XCB_BUTTON_RELEASE]   = xcb_event_button_release,
+    [XCB_CONFIGURE_NOTIFY] = xcb_event_configure_notify,
+    [XCB_CLIENT_MESSAGE]   = xcb_event_client_message,
+    [XCB_PROPERTY_NOTIFY]  = xcb_event_property_notify,
+    [XCB_KEY_PRESS]        = xcb_event_key_press,
+    [XCB_MAPPING_NOTIFY]   = xcb_event_mapping_notify,
 };
 
 xcb_connection_t *x_conn = NULL;
@@ -93,6 +53,10 @@ static int processing_flag = 1;
 int      screen_count = 0;
 screen_t screens = NULL;
 
+uint64_t mouse_motion_interval = MOUSE_MOTION_INTERVAL_DEFAULT;
+
+unsigned int desktop_count = DESKTOP_COUNT_DEFAULT;
+
 static void __dcc_init(client_class_t self) { }
 static const char *__dcc_class_name_get(client_class_t self) { return "DUMMY"; }
 static int  __dcc_client_try_attach(client_class_t self, client_t client) { return CLIENT_TRY_ATTACH_FAILED; }
@@ -104,92 +68,173 @@ static client_class_s __dummy_client_class =
     .client_try_attach     = __dcc_client_try_attach,
 };
 
-static client_t __client_attach(xcb_window_t window);
+typedef struct client_attach_req_s *client_attach_req_t;
+typedef struct client_attach_req_s
+{
+    xcb_window_t window;
+    xcb_window_t parent;
+    rect_s       geom;
+    int          pending;
+    int          failed;
+    int          map;
+    int          adopted;
+    char         wm_instance[CLIENT_WM_CLASS_MAX];
+    char         wm_class[CLIENT_WM_CLASS_MAX];
+    int          window_type;
+    xcb_window_t transient_for;
+    unsigned int desktop;       /* DESKTOP_NONE if not set */
+} client_attach_req_s;
+
+#define DESKTOP_NONE 0xfffffffe
+
+/* Clients and attach requests come from pools. A client slot has room
+ * after client_s for the largest priv_size of the registered classes. */
+#define CLIENT_POOL_CHUNK 64
+#define CLIENT_PRIV_OFFSET ((sizeof(client_s) + 15) & ~(size_t)15)
+
+static pool_s client_pool;
+static pool_s attach_pool;
+static size_t client_priv_room = 0;
+
+static void     __client_attach(xcb_window_t window, int map);
+static void     __client_attach_props(client_attach_req_t req);
+static client_attach_req_t __client_attach_begin(xcb_window_t window, int map);
+static void     __client_attach_finish(client_attach_req_t req);
+#ifdef GEOM_CHECK
+/* Debug aid: every GEOM_CHECK_INTERVAL ns compare the cache of all
+ * clients against the server and complain about any difference. */
+#define GEOM_CHECK_INTERVAL 1000000000ull
+static timeout_s geom_check_timer;
+static void     __geom_check(void *data);
+#endif
 static void     __client_detach(client_t client, int forget);
 static void     __client_map(client_t client);
+static void     __mouse_motion_timeout(void *data);
+static void     __desktop_announce(screen_t screen);
+static void     __desktop_hide(client_t client);
+static void     __desktop_show(client_t client);
+static int      __setup_resume(void);
+static void     __client_geom_changed(client_t client);
+
+xcb_atom_t atoms[ATOM_COUNT];
+
+#define __ATOM_NAME(name) #name,
+static const char *atom_names[ATOM_COUNT] = {
+    ATOM_LIST(__ATOM_NAME) ATOM_LIST_EXTRA(__ATOM_NAME)
+};
+#undef __ATOM_NAME
 
-#define DEFINE_ATOM(name) [name] = { XCB_NONE, #name, sizeof(#name) - 1 }
-#define ATOM(name) atoms[name].atom
+static loop_watch_s x_watch;
+
+static void
+__quit(int signo)
+{
+    processing_flag = 0;
+}
 
-#define LENGTH(v) (sizeof(v) / sizeof((v)[0]))
+static void
+__restart(int signo)
+{
+    wm_restart();
+}
 
-#define _NET_WM_DESKTOP  0
-#define WM_DELETE_WINDOW 1
-#define WM_PROTOCOLS     2
+/* Leave the loop and exec in place, see restart.c */
+void
+wm_restart(void)
+{
+    if (trace_mode == TRACE_MODE_RECORD)
+    {
+        DEBUGP("restart: not while recording\n");
+        return;
+    }
+    /* before any client is let go */
+    if (restart_prepare())
+    {
+        fprintf(stderr, "restart: nothing to exec, not restarting\n");
+        return;
+    }
+    restart_requested = 1;
+    processing_flag = 0;
+}
 
-static struct
+static void
+__x_ready(loop_watch_t watch, uint32_t events)
 {
-    xcb_atom_t  atom;
-    const char *name;
-    const int   name_length;
-} atoms[] = {
-    DEFINE_ATOM(_NET_WM_DESKTOP),
-    DEFINE_ATOM(WM_DELETE_WINDOW),
-    DEFINE_ATOM(WM_PROTOCOLS),
-};
+    /* nothing to do here, wm_loop drains xcb after every wait */
+}
+
+static int atoms_failed = 0;
 
 static void
-sigcatch(int signal)
+__atom_cb(void *data, void *reply, xcb_generic_error_t *error)
 {
-    processing_flag = 0;
+    xcb_intern_atom_reply_t *r = (xcb_intern_atom_reply_t *)reply;
+
+    if (r) atoms[(intptr_t)data] = r->atom;
+    else atoms_failed = 1;
 }
 
-static int
-__init(void)
+int
+wm_init(void)
 {
-    int ret = 0;
     int i;
 
     if (signal(SIGCHLD, SIG_IGN) == SIG_ERR)
         return -1;
 
-    if (signal(SIGINT, sigcatch) == SIG_ERR)
+    if (loop_init())
         return -1;
 
-    if (signal(SIGTERM, sigcatch) == SIG_ERR)
-        return -1;
+    pool_init(&client_pool, "client", CLIENT_PRIV_OFFSET, CLIENT_POOL_CHUNK);
+    pool_init(&attach_pool, "attach", sizeof(client_attach_req_s), CLIENT_POOL_CHUNK);
 
-    for (i = 0; i < HASH_MOD; ++ i) wnd_hash_list[i] = NULL;
-        
-    x_conn = xcb_connect(NULL, &screen_count);
+    if (loop_signal(SIGINT, __quit) || loop_signal(SIGTERM, __quit) ||
+        loop_signal(SIGHUP, __restart))
+        return -1;
 
-    xcb_intern_atom_cookie_t atom_cookies[LENGTH(atoms)];
+    /* an offline run must not take over the socket of a live session */
+    if (!x_backend->offline && stats_init())
+        return -1;
 
-    for (i = 0; i < LENGTH(atoms); ++ i)
+    x_conn = x_connect(&screen_count);
+    if (x_connection_error())
     {
-        if (atoms[i].name == NULL) continue;
-        atom_cookies[i] = xcb_intern_atom(x_conn, 0, atoms[i].name_length, atoms[i].name);
+        fprintf(stderr, "Can't open display\n");
+        return -1;
     }
 
-    for (i = 0; i < LENGTH(atoms); ++ i)
+    if (!x_backend->offline)
     {
-        if (atoms[i].name == NULL) continue;
-        
-        xcb_intern_atom_reply_t *r;
-        r = xcb_intern_atom_reply(x_conn, atom_cookies[i], 0);
-        if (r)
-        {
-            atoms[i].atom = r->atom;
-            free(r);
-        }
-        else ret = -1;
+        x_watch.fd       = xcb_get_file_descriptor(x_conn);
+        x_watch.callback = __x_ready;
+        x_watch.data     = NULL;
+        if (loop_watch_add(&x_watch, EPOLLIN))
+            return -1;
     }
 
-    if (ret)
+    for (i = 0; i < ATOM_COUNT; ++ i)
+        reply_wait(x_intern_atom(atom_names[i], strlen(atom_names[i])),
+                   __atom_cb, (void *)(intptr_t)i);
+    reply_drain();
+
+    if (atoms_failed)
     {
         printf("error while get atoms\n");
-        return ret;
+        return -1;
     }
+    prop_init();
 
     xcb_screen_iterator_t iter;
     int id;
     
-    iter = xcb_setup_roots_iterator(xcb_get_setup(x_conn));
+    iter = xcb_setup_roots_iterator(x_get_setup());
     for (id = 0; iter.rem; ++ id, xcb_screen_next (&iter)) ; screen_count = id;
 
     screens = (screen_t)malloc(screen_count * sizeof(screen_s));
 
-    iter = xcb_setup_roots_iterator(xcb_get_setup(x_conn));
+    ewmh_init();
+
+    iter = xcb_setup_roots_iterator(x_get_setup());
     for (id = 0; iter.rem; ++ id, xcb_screen_next (&iter))
     {
         screens[id].xcb_screen = iter.data;
@@ -197,10 +242,20 @@ __init(void)
         screens[id].mouse_motion_callback = NULL;
         screens[id].mouse_release_callback = NULL;
         screens[id].mouse_cb_data = NULL;
+        screens[id].mouse_motion_pending = 0;
+        screens[id].mouse_motion_last = 0;
+        timeout_init(&screens[id].mouse_motion_timer, __mouse_motion_timeout, &screens[id]);
         screens[id].focus = NULL;
         list_init(&screens[id].auto_scan_list);
         list_init(&screens[id].client_list);
 
+        if (desktop_count == 0) desktop_count = 1;
+        screens[id].desktop_current = 0;
+        screens[id].desktop_clients = (list_entry_s *)malloc((desktop_count + 1) * sizeof(list_entry_s));
+        for (i = 0; i <= desktop_count; ++ i)
+            list_init(&screens[id].desktop_clients[i]);
+        __desktop_announce(&screens[id]);
+
         wnd_dict_node_t node = wnd_dict_find(screens[id].xcb_screen->root, WND_DICT_FIND_OP_TOUCH);
         node->role = WND_ROLE_ROOT;
         node->link = &screens[id];
@@ -213,6 +268,7 @@ __init(void)
         xcb_void_cookie_t cookie =
             xcb_change_window_attributes_checked(x_conn, screens[id].xcb_screen->root, mask, values);
         xcb_generic_error_t *error = xcb_request_check(x_conn, cookie);
+        ++ stats.round_trips;
         xcb_flush(x_conn);
     
         if (error != NULL)
@@ -226,57 +282,184 @@ __init(void)
         }
     }
 
+    if (monitor_init() || place_init() || sync_init() || keys_init() || comp_init() ||
+        ipc_init())
+        return -1;
+
     return 0;
 }
 
-static int
-__setup(void)
+/* Startup adoption. The children of every root are fetched first,
+ * then attributes and geometry for all of them are requested in one
+ * go; only after every reply is in are the windows attached, inside
+ * a single server grab. The parent of each is its root, so no
+ * per-window query_tree is needed. */
+
+#define SETUP_CHILD_IGNORE 0
+#define SETUP_CHILD_MANAGE 1
+
+typedef struct setup_child_s
 {
-    int i;
-    for (i = 0; i < screen_count; ++ i)
+    xcb_window_t window;
+    xcb_window_t root;
+    int          state;
+    int          viewable;
+    int          geom_ok;
+    rect_s       geom;
+} setup_child_s;
+
+static setup_child_s *setup_children   = NULL;
+static int            setup_child_count = 0;
+static int            setup_child_size  = 0;
+static int            setup_failed      = 0;
+
+static void
+__setup_tree_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    screen_t screen = (screen_t)data;
+    xcb_query_tree_reply_t *tree = (xcb_query_tree_reply_t *)reply;
+
+    if (tree == NULL)
     {
-        
-        /* scan all existing window */
-        xcb_get_window_attributes_reply_t *attr;
-        xcb_query_tree_reply_t *reply;
-        
-        reply = xcb_query_tree_reply(x_conn, xcb_query_tree(x_conn, screens[i].xcb_screen->root), 0);
-        if (reply == NULL)
+        setup_failed = 1;
+        return;
+    }
+
+    int i, len = xcb_query_tree_children_length(tree);
+    xcb_window_t *children = xcb_query_tree_children(tree);
+
+    if (setup_child_count + len > setup_child_size)
+    {
+        int size = setup_child_size ? setup_child_size : 64;
+        while (size < setup_child_count + len) size *= 2;
+
+        setup_child_s *c = (setup_child_s *)realloc(setup_children, size * sizeof(setup_child_s));
+        if (c == NULL)
         {
-            return -1;
+            setup_failed = 1;
+            return;
         }
+        setup_children   = c;
+        setup_child_size = size;
+    }
 
-        int i, len = xcb_query_tree_children_length(reply);    
-        xcb_window_t *children = xcb_query_tree_children(reply);
-    
-        for (i = 0; i < len; i ++)
-        {
-            attr = xcb_get_window_attributes_reply(
-                x_conn, xcb_get_window_attributes(x_conn, children[i]), NULL);
+    for (i = 0; i < len; ++ i)
+    {
+        setup_child_s *c = &setup_children[setup_child_count ++];
+        c->window   = children[i];
+        c->root     = screen->xcb_screen->root;
+        c->state    = SETUP_CHILD_IGNORE;
+        c->viewable = 0;
+        c->geom_ok  = 0;
+    }
+}
 
-            if (attr == NULL)
-            {
-                fprintf(stderr, "Couldn't get attributes for window %d.",
-                        children[i]);
-                continue;
-            }
+static void
+__setup_attr_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    setup_child_s *c = (setup_child_s *)data;
+    xcb_get_window_attributes_reply_t *attr = (xcb_get_window_attributes_reply_t *)reply;
 
-            /* Ignore windows with override_redirect, or windows that are
-             * not viewable (we would manage then after the expose
-             * event) */
-            if (!attr->override_redirect)
-            {
-                client_t client = __client_attach(children[i]);
-                if (attr->map_state == XCB_MAP_STATE_VIEWABLE)
-                    __client_map(client);
-            }
-        
-            free(attr);
-        }
+    if (attr == NULL)
+    {
+        fprintf(stderr, "Couldn't get attributes for window %d.\n", c->window);
+        return;
+    }
 
-        xcb_flush(x_conn);
-        free(reply);
+    /* Ignore windows with override_redirect, or windows that are
+     * not viewable (we would manage then after the expose
+     * event) */
+    if (!attr->override_redirect)
+    {
+        c->state    = SETUP_CHILD_MANAGE;
+        c->viewable = attr->map_state == XCB_MAP_STATE_VIEWABLE;
+    }
+}
+
+static void
+__setup_geom_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    setup_child_s *c = (setup_child_s *)data;
+    xcb_get_geometry_reply_t *geom = (xcb_get_geometry_reply_t *)reply;
+
+    if (geom == NULL)
+        return;
+
+    c->geom.x  = geom->x;
+    c->geom.y  = geom->y;
+    c->geom.w  = geom->width;
+    c->geom.h  = geom->height;
+    c->geom_ok = 1;
+}
+
+int
+wm_setup(void)
+{
+    uint64_t start = time_now_ns();
+    int i, adopted = 0;
+
+    if (__setup_resume())
+        return -1;
+
+    /* scan all existing window */
+    for (i = 0; i < screen_count; ++ i)
+        reply_wait(x_query_tree(screens[i].xcb_screen->root),
+                   __setup_tree_cb, &screens[i]);
+    reply_drain();
+
+    if (setup_failed)
+    {
+        free(setup_children);
+        return -1;
+    }
+
+    for (i = 0; i < setup_child_count; ++ i)
+    {
+        setup_child_s *c = &setup_children[i];
+
+        /* resumed, with their containers */
+        if (wnd_dict_find(c->window, WND_DICT_FIND_OP_NONE))
+            continue;
+        reply_wait(x_get_window_attributes(c->window), __setup_attr_cb, c);
+        reply_wait(x_get_geometry(c->window), __setup_geom_cb, c);
+    }
+    reply_drain();
+
+    xcb_grab_server(x_conn);
+    for (i = 0; i < setup_child_count; ++ i)
+    {
+        setup_child_s *c = &setup_children[i];
+        if (c->state != SETUP_CHILD_MANAGE || !c->geom_ok)
+            continue;
+
+        client_attach_req_t req = __client_attach_begin(c->window, c->viewable);
+        if (req == NULL)
+            continue;
+
+        req->parent  = c->root;
+        req->geom    = c->geom;
+        req->adopted = c->viewable;
+        __client_attach_props(req);
+        ++ adopted;
     }
+    /* the properties of all of them in one round trip */
+    reply_drain();
+    ewmh_flush();
+    xcb_ungrab_server(x_conn);
+    xcb_flush(x_conn);
+
+#ifdef GEOM_CHECK
+    timeout_init(&geom_check_timer, __geom_check, NULL);
+    timeout_add(&geom_check_timer, GEOM_CHECK_INTERVAL);
+#endif
+
+    DEBUGP("setup: adopted %d of %d windows in %.3f ms\n",
+           adopted, setup_child_count, (time_now_ns() - start) / 1e6);
+
+    free(setup_children);
+    setup_children    = NULL;
+    setup_child_count = 0;
+    setup_child_size  = 0;
 
     return 0;
 }
@@ -290,11 +473,9 @@ xcb_event_map_request(xcb_generic_event_t *e)
     switch (node->role)
     {
     case WND_ROLE_INIT:
-    {
-        client_t client = __client_attach(map_request->window);
-        __client_map(client);
+    case WND_ROLE_CLIENT_PENDING:
+        __client_attach(map_request->window, 1);
         break;
-    }
 
     case WND_ROLE_CLIENT:
     {
@@ -322,6 +503,18 @@ xcb_event_map_notify(xcb_generic_event_t *e)
     }
 }
 
+/* Whether an UnmapNotify of the client window is the one of our last
+ * unmap of it, or older; past that the mark is cleared */
+static int
+__unmap_ours(client_t client, uint16_t event_seq)
+{
+    if (client->unmap_seq == 0) return 0;
+    if ((int16_t)(event_seq - (uint16_t)client->unmap_seq) <= 0) return 1;
+
+    client->unmap_seq = 0;
+    return 0;
+}
+
 static void
 xcb_event_unmap_notify(xcb_generic_event_t *e)
 {
@@ -331,11 +524,34 @@ xcb_event_unmap_notify(xcb_generic_event_t *e)
     if (node && node->role == WND_ROLE_CLIENT)
     {
         client_t client = (client_t)node->link;
+
+        /* the client withdrew, unless it is us hiding a frameless one;
+         * that notify may come after the client was shown again */
+        if (unmap_notify->window == client->xcb_window &&
+            !__unmap_ours(client, unmap_notify->sequence))
+        {
+            client->mapped = 0;
+            client->desktop_hidden = 0;
+            client_place_update(client);
+        }
+
         if (client->class && client->class->client_event_unmap_notify)
             client->class->client_event_unmap_notify(client->class, client, unmap_notify);
     }
 }
 
+/* Whether a notify predates the last configure we sent for that
+ * rect; once the server has caught up the mark is cleared. */
+static int
+__geom_seq_stale(unsigned int *seq, uint16_t event_seq)
+{
+    if (*seq == 0) return 0;
+    if ((int16_t)(event_seq - (uint16_t)*seq) < 0) return 1;
+
+    *seq = 0;
+    return 0;
+}
+
 static void
 xcb_event_reparent_notify(xcb_generic_event_t *e)
 {
@@ -355,6 +571,13 @@ xcb_event_reparent_notify(xcb_generic_event_t *e)
     switch (node->role)
     {
     case WND_ROLE_CLIENT:
+        if (reparent_notify->window == client->xcb_window &&
+            !__geom_seq_stale(&client->geom_seq[CLIENT_GEOM_WINDOW], reparent_notify->sequence))
+        {
+            client->geom[CLIENT_GEOM_WINDOW].x = reparent_notify->x;
+            client->geom[CLIENT_GEOM_WINDOW].y = reparent_notify->y;
+        }
+
         if (client->class && client->class->client_event_reparent_notify)
             client->class->client_event_reparent_notify(client->class, client, reparent_notify);
         break;
@@ -365,6 +588,47 @@ xcb_event_reparent_notify(xcb_generic_event_t *e)
     }
 }
 
+static void
+xcb_event_configure_notify(xcb_generic_event_t *e)
+{
+    xcb_configure_notify_event_t *configure_notify = (xcb_configure_notify_event_t *)e;
+    wnd_dict_node_t node = wnd_dict_find(configure_notify->window, WND_DICT_FIND_OP_NONE);
+    int which;
+
+    if (node == NULL || node->role != WND_ROLE_CLIENT)
+        return;
+
+    client_t client = (client_t)node->link;
+
+    if (configure_notify->window == client->xcb_window)
+        which = CLIENT_GEOM_WINDOW;
+    else if (configure_notify->window == client->xcb_container)
+        which = CLIENT_GEOM_CONTAINER;
+    else return;
+
+    if (__geom_seq_stale(&client->geom_seq[which], configure_notify->sequence))
+        return;
+
+    client->geom[which].x = configure_notify->x;
+    client->geom[which].y = configure_notify->y;
+    client->geom[which].w = configure_notify->width;
+    client->geom[which].h = configure_notify->height;
+    __client_geom_changed(client);
+}
+
+static void
+xcb_event_property_notify(xcb_generic_event_t *e)
+{
+    xcb_property_notify_event_t *property_notify = (xcb_property_notify_event_t *)e;
+    wnd_dict_node_t node = wnd_dict_find(property_notify->window, WND_DICT_FIND_OP_NONE);
+
+    if (node == NULL || node->role != WND_ROLE_CLIENT)
+        return;
+
+    client_prop_changed((client_t)node->link, property_notify->atom,
+                        property_notify->state == XCB_PROPERTY_DELETE);
+}
+
 static void
 xcb_event_destroy_notify(xcb_generic_event_t *e)
 {
@@ -373,7 +637,8 @@ xcb_event_destroy_notify(xcb_generic_event_t *e)
 
     if (node == NULL ||
         (node->role != WND_ROLE_CLIENT &&
-         node->role != WND_ROLE_CLIENT_IGNORE))
+         node->role != WND_ROLE_CLIENT_IGNORE &&
+         node->role != WND_ROLE_CLIENT_PENDING))
         return;
     
     client_t client = (client_t)node->link;
@@ -385,6 +650,8 @@ xcb_event_destroy_notify(xcb_generic_event_t *e)
         break;
 
     case WND_ROLE_CLIENT_IGNORE:
+    case WND_ROLE_CLIENT_PENDING:
+        /* a pending attach notices the missing entry when it lands */
         wnd_dict_find(destroy_notify->window, WND_DICT_FIND_OP_ERASE);
         break;
     }
@@ -408,6 +675,26 @@ xcb_event_button_press(xcb_generic_event_t *e)
         xcb_allow_events(x_conn, XCB_ALLOW_REPLAY_POINTER, button_press->time);
 }
 
+static void
+__mouse_motion_deliver(screen_t screen, uint64_t now)
+{
+    screen->mouse_motion_pending = 0;
+    screen->mouse_motion_last = now;
+    timeout_cancel(&screen->mouse_motion_timer);
+
+    if (screen->mouse_attached && screen->mouse_motion_callback != NULL)
+        screen->mouse_motion_callback(screen->mouse_cb_data, screen->mouse_motion_x, screen->mouse_motion_y);
+}
+
+static void
+__mouse_motion_timeout(void *data)
+{
+    screen_t screen = (screen_t)data;
+
+    if (screen->mouse_motion_pending)
+        __mouse_motion_deliver(screen, time_now_ns());
+}
+
 static void
 xcb_event_motion_notify(xcb_generic_event_t *e)
 {
@@ -418,13 +705,20 @@ xcb_event_motion_notify(xcb_generic_event_t *e)
         return;
 
     screen_t screen = (screen_t)node->link;
-    xcb_query_pointer_reply_t *pointer;
-    pointer = xcb_query_pointer_reply(x_conn, xcb_query_pointer(x_conn, screen->xcb_screen->root), 0);
-
-    if (screen->mouse_attached && screen->mouse_motion_callback != NULL)
-        screen->mouse_motion_callback(screen->mouse_cb_data, pointer->root_x, pointer->root_y);
+    if (!screen->mouse_attached)
+        return;
 
-    free(pointer);
+    /* keep only the latest position, at most one delivery a frame */
+    screen->mouse_motion_pending = 1;
+    screen->mouse_motion_x = motion_notify->root_x;
+    screen->mouse_motion_y = motion_notify->root_y;
+
+    uint64_t now = time_now_ns();
+    uint64_t due = screen->mouse_motion_last + mouse_motion_interval;
+    if (now >= due)
+        __mouse_motion_deliver(screen, now);
+    else if (!screen->mouse_motion_timer.active)
+        timeout_add(&screen->mouse_motion_timer, due - now);
 }
 
 static void
@@ -438,122 +732,939 @@ xcb_event_button_release(xcb_generic_event_t *e)
 
     screen_t screen = (screen_t)node->link;
 
+    /* land exactly where the button went up */
+    if (screen->mouse_motion_pending)
+    {
+        screen->mouse_motion_x = button_release->root_x;
+        screen->mouse_motion_y = button_release->root_y;
+        __mouse_motion_deliver(screen, time_now_ns());
+    }
+
     if (screen->mouse_attached && screen->mouse_release_callback != NULL)
         screen->mouse_release_callback(screen->mouse_cb_data);
 }
 
-static void
-__event_loop(void)
+/* Event batches: everything already queued is pulled in at once,
+ * events made redundant by later ones in the same batch are dropped,
+ * and the requests issued while handling the batch go out in a
+ * single flush. */
+
+#define EVENT_BATCH_MAX   1024
+#define COALESCE_BITS     11        /* 2 * EVENT_BATCH_MAX slots */
+#define COALESCE_SIZE     (1 << COALESCE_BITS)
+#define COALESCE_MOTION   8
+
+#define COALESCE_KEY_CONFIGURE (1ull << 61)
+#define COALESCE_KEY_WINDOW    (2ull << 61)
+
+event_batch_stats_s event_batch_stats;
+
+static xcb_generic_event_t *batch[EVENT_BATCH_MAX];
+
+static struct
 {
-    xcb_generic_event_t *e;
-    /* Use select to get signal, learnt from MCWM */    
-    int fd;
-    fd_set in;
+    uint64_t     key;
+    unsigned int stamp;
+    int          index;
+} coalesce_slots[COALESCE_SIZE];
+static unsigned int coalesce_stamp = 0;
+
+static int *
+__coalesce_slot(uint64_t key)
+{
+    unsigned int i = (unsigned int)((key * 0x9e3779b97f4a7c15ull) >> (64 - COALESCE_BITS));
 
-    fd = xcb_get_file_descriptor(x_conn);
-    FD_ZERO(&in);
-    FD_SET(fd, &in);
-    
-    while (processing_flag && !xcb_connection_has_error(x_conn))
+    while (coalesce_slots[i].stamp == coalesce_stamp && coalesce_slots[i].key != key)
+        i = (i + 1) & (COALESCE_SIZE - 1);
+
+    if (coalesce_slots[i].stamp != coalesce_stamp)
     {
-        e = xcb_poll_for_event(x_conn);
-        if (e == NULL)
-        {
-            select(fd + 1, &in, NULL, NULL, NULL);
-            continue;
-        }
+        coalesce_slots[i].stamp = coalesce_stamp;
+        coalesce_slots[i].key   = key;
+        coalesce_slots[i].index = -1;
+    }
 
-        event_handler_t h = event_handlers[e->response_type & ~0x80];
-        if (h) h(e);
+    return &coalesce_slots[i].index;
+}
 
-        free(e);
-        xcb_flush(x_conn);
+static xcb_window_t
+__event_window(xcb_generic_event_t *e)
+{
+    switch (e->response_type & ~0x80)
+    {
+    case XCB_CREATE_NOTIFY:     return ((xcb_create_notify_event_t *)e)->window;
+    case XCB_DESTROY_NOTIFY:    return ((xcb_destroy_notify_event_t *)e)->window;
+    case XCB_UNMAP_NOTIFY:      return ((xcb_unmap_notify_event_t *)e)->window;
+    case XCB_MAP_NOTIFY:        return ((xcb_map_notify_event_t *)e)->window;
+    case XCB_MAP_REQUEST:       return ((xcb_map_request_event_t *)e)->window;
+    case XCB_REPARENT_NOTIFY:   return ((xcb_reparent_notify_event_t *)e)->window;
+    case XCB_CONFIGURE_NOTIFY:  return ((xcb_configure_notify_event_t *)e)->window;
+    case XCB_CONFIGURE_REQUEST: return ((xcb_configure_request_event_t *)e)->window;
+    case XCB_GRAVITY_NOTIFY:    return ((xcb_gravity_notify_event_t *)e)->window;
+    case XCB_CIRCULATE_NOTIFY:
+    case XCB_CIRCULATE_REQUEST: return ((xcb_circulate_notify_event_t *)e)->window;
+    default:                    return XCB_NONE;
     }
 }
 
-static int
-__cleanup(void)
+static void
+__batch_drop(int i)
 {
-    if (screens && !xcb_connection_has_error(x_conn))
+    free(batch[i]);
+    batch[i] = NULL;
+}
+
+static void
+__batch_coalesce(int n)
+{
+    xcb_window_t motion_seen[COALESCE_MOTION];
+    int motion_count = 0;
+    int i, j;
+
+    /* backwards: keep only the newest motion and configure */
+    ++ coalesce_stamp;
+    for (i = n - 1; i >= 0; -- i)
     {
-        /* Detach all clients */
-        int i;
-        list_entry_t cur;
-        for (i = 0; i < screen_count; ++ i)
+        switch (batch[i]->response_type & ~0x80)
         {
-            cur = list_next(&screens[i].client_list);
-            while (cur != &screens[i].client_list)
+        case XCB_MOTION_NOTIFY:
+        {
+            xcb_window_t w = ((xcb_motion_notify_event_t *)batch[i])->event;
+            for (j = 0; j < motion_count; ++ j)
+                if (motion_seen[j] == w) break;
+
+            if (j < motion_count)
             {
-                client_t client = CONTAINER_OF(cur, client_s, client_node);
-                __client_detach(client, 1);
+                __batch_drop(i);
+                ++ event_batch_stats.coalesced_motion;
+            }
+            else if (motion_count < COALESCE_MOTION)
+                motion_seen[motion_count ++] = w;
+            break;
+        }
 
-                cur = list_next(cur);
+        case XCB_BUTTON_PRESS:
+        case XCB_BUTTON_RELEASE:
+            /* motion on the other side of a button stays */
+            motion_count = 0;
+            break;
+
+        case XCB_CONFIGURE_NOTIFY:
+        {
+            xcb_configure_notify_event_t *c = (xcb_configure_notify_event_t *)batch[i];
+            int *slot = __coalesce_slot(COALESCE_KEY_CONFIGURE | (uint64_t)c->event << 32 | c->window);
+
+            if (*slot >= 0)
+            {
+                __batch_drop(i);
+                ++ event_batch_stats.coalesced_configure;
             }
-            xcb_flush(x_conn);
+            else *slot = i;
+            break;
+        }
         }
     }
 
-    if (x_conn)
-        xcb_disconnect(x_conn);
-    
-    return 0;    
-}
-
-static client_t
-__client_attach(xcb_window_t window)
-{
-    wnd_dict_node_t node = wnd_dict_find(window, WND_DICT_FIND_OP_NONE);
-    if (node && node->role == WND_ROLE_CLIENT_IGNORE)
+    /* forwards: an unmap directly followed by a map of the same window
+     * leaves it as it was, though not its pixmap if we composite */
+    ++ coalesce_stamp;
+    for (i = 0; i < n && !comp_enabled; ++ i)
     {
-        /* Skip attached window */
-        return NULL;
+        if (batch[i] == NULL) continue;
+
+        xcb_window_t w = __event_window(batch[i]);
+        if (w == XCB_NONE) continue;
+
+        int *slot = __coalesce_slot(COALESCE_KEY_WINDOW | w);
+        j = *slot;
+
+        if ((batch[i]->response_type & ~0x80) == XCB_MAP_NOTIFY && j >= 0 &&
+            (batch[j]->response_type & ~0x80) == XCB_UNMAP_NOTIFY)
+        {
+            xcb_unmap_notify_event_t *u = (xcb_unmap_notify_event_t *)batch[j];
+            xcb_map_notify_event_t   *m = (xcb_map_notify_event_t *)batch[i];
+
+            if (u->event == m->event && !u->from_configure)
+            {
+                __batch_drop(j);
+                __batch_drop(i);
+                *slot = -1;
+                event_batch_stats.coalesced_map_pairs += 2;
+                continue;
+            }
+        }
+
+        *slot = i;
     }
-    
-    xcb_window_t parent;
-    xh_window_geom_get(window, &parent, NULL);
+}
 
-    node = wnd_dict_find(parent, WND_DICT_FIND_OP_NONE);
-    if (node == NULL || node->role != WND_ROLE_ROOT)
-        return NULL;
+static int
+__batch_collect(int read)
+{
+    int n = 0;
+    xcb_generic_event_t *e;
 
-    screen_t screen = (screen_t)node->link;
+    e = x_event_next(read);
+    while (e != NULL)
+    {
+        batch[n ++] = e;
+        if (n == EVENT_BATCH_MAX) break;
+        e = x_event_next(0);
+    }
+
+    if (n) x_batch_end();
+    return n;
+}
+
+static void
+__batch_account(int n)
+{
+    int b = 0;
+    while ((2 << b) <= n && b < EVENT_BATCH_HIST - 1) ++ b;
+
+    ++ event_batch_stats.batches;
+    ++ event_batch_stats.batch_hist[b];
+    event_batch_stats.events += n;
+    if (n > event_batch_stats.batch_max)
+        event_batch_stats.batch_max = n;
+}
 
-    client_t client = (client_t)malloc(sizeof(client_s));
+/* Handle everything xcb has for us: events, in batches, and the
+ * replies that came along with them */
+void
+wm_dispatch(void)
+{
+    int i, n;
+
+    while (1)
+    {
+        n = __batch_collect(1);
+        if (n == 0)
+        {
+            /* replies may have come in with the last read, and
+             * polling for them may in turn have queued events */
+            if (reply_process())
+                continue;
+
+            if ((n = __batch_collect(0)) == 0)
+                break;
+        }
+
+        __batch_account(n);
+        if (n > 1) __batch_coalesce(n);
+
+        /* one clock read per event, each handler is timed from the
+         * end of the previous one */
+        uint64_t t = time_real_ns();
+        for (i = 0; i < n; ++ i)
+        {
+            if (batch[i] == NULL) continue;
+
+            int type = batch[i]->response_type & ~0x80;
+            event_handler_t h = type < LASTEvent ? event_handlers[type] : NULL;
+            if (comp_event(batch[i])) ;
+            else if (h) h(batch[i]);
+            else if (type >= LASTEvent && !sync_event(batch[i])) monitor_event(batch[i]);
+
+            free(batch[i]);
+
+            uint64_t e = time_real_ns();
+            stats_event(type, e - t);
+            t = e;
+        }
+
+        reply_process();
+        prop_flush();
+        ewmh_flush();
+        xcb_flush(x_conn);
+        ++ event_batch_stats.flushes;
+    }
+}
+
+void
+wm_loop(void)
+{
+    while (processing_flag && !x_connection_error())
+    {
+        wm_dispatch();
+
+        /* requests from reply callbacks and timeouts */
+        prop_flush();
+        ewmh_flush();
+        xcb_flush(x_conn);
+        ++ event_batch_stats.flushes;
+        ipc_flush();
+
+        loop_wait();
+    }
+}
+
+int
+wm_cleanup(void)
+{
+    if (screens && !x_connection_error())
+    {
+        /* Detach all clients, including the ones still attaching; a
+         * restart leaves those it saved as they are, and the others
+         * mapped for the next process to adopt */
+        int i, saved = 0;
+        list_entry_t cur;
+
+        reply_drain();
+        if (restart_requested)
+            saved = restart_save() >= 0;
+        for (i = 0; i < screen_count; ++ i)
+        {
+            cur = list_next(&screens[i].client_list);
+            while (cur != &screens[i].client_list)
+            {
+                client_t client = CONTAINER_OF(cur, client_s, client_node);
+                cur = list_next(cur);
+
+                if (saved && restart_resumable(client)) continue;
+                __client_detach(client, !restart_requested);
+            }
+        }
+
+        /* let detaching classes finish their work before we go */
+        reply_drain();
+        ewmh_flush();
+        xcb_flush(x_conn);
+    }
+
+    ipc_cleanup();
+    /* gives the overlay back, so before the connection goes */
+    comp_cleanup();
+    if (x_conn)
+        xcb_disconnect(x_conn);
+    pool_destroy(&client_pool);
+    pool_destroy(&attach_pool);
+    client_rule_cleanup();
+    ewmh_cleanup();
+    place_cleanup();
+    sync_cleanup();
+    keys_cleanup();
+    monitor_cleanup();
+    stats_cleanup();
+    loop_cleanup();
+    trace_close();
+
+    DEBUGP("events: %lu in %lu batches (max %lu), %lu flushes, "
+           "coalesced %lu motion %lu configure %lu map/unmap\n",
+           event_batch_stats.events, event_batch_stats.batches, event_batch_stats.batch_max,
+           event_batch_stats.flushes, event_batch_stats.coalesced_motion,
+           event_batch_stats.coalesced_configure, event_batch_stats.coalesced_map_pairs);
     
+    return 0;    
+}
+
+static inline list_entry_t
+__desktop_list(screen_t screen, unsigned int desktop)
+{
+    return &screen->desktop_clients[desktop == DESKTOP_ALL ? desktop_count : desktop];
+}
+
+static inline int
+__desktop_visible(client_t client)
+{
+    return client->desktop == DESKTOP_ALL || client->desktop == client->screen->desktop_current;
+}
+
+static void
+__desktop_property(client_t client)
+{
+    xcb_change_property(x_conn, XCB_PROP_MODE_REPLACE, client->xcb_window,
+                        ATOM(_NET_WM_DESKTOP), XCB_ATOM_CARDINAL, 32, 1, &client->desktop);
+}
+
+static int
+__client_try_class(client_t client, client_class_t class)
+{
+    client->priv = NULL;
+    if (class->priv_size)
+    {
+        if (class->priv_size > client_priv_room)
+            return CLIENT_TRY_ATTACH_FAILED;
+        client->priv = (char *)client + CLIENT_PRIV_OFFSET;
+        memset(client->priv, 0, class->priv_size);
+    }
+    return class->client_try_attach(class, client);
+}
+
+/* Resume after a restart, see restart.c. Each client is taken over as
+ * it was, by the class of the same name, which keeps its container.
+ * Every container left on a root's _CWM_RESTART_FRAMES that no class
+ * took, whether its window withdrew meanwhile, its class is gone or
+ * the state was thrown away, is emptied onto the root and destroyed,
+ * and the scan of wm_setup adopts its window like the rest. */
+
+#define RESUME_SKIP  0
+#define RESUME_GONE  1
+#define RESUME_ADOPT 2
+#define RESUME_OK    3
+
+typedef struct resume_frame_s
+{
+    xcb_window_t window, container;
+    screen_t     screen;
+    int          x, y, geom_ok;
+} resume_frame_s;
+
+static resume_frame_s *resume_frames      = NULL;
+static int             resume_frame_count = 0;
+
+typedef struct resume_s
+{
+    const restart_client_s *rec;
+    int                     state;
+} resume_s;
+
+static void
+__resume_check_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    resume_s *r = (resume_s *)data;
+    xcb_get_window_attributes_reply_t *attr = (xcb_get_window_attributes_reply_t *)reply;
+
+    if (attr == NULL)
+        r->state = RESUME_GONE;
+    else if (r->rec->mapped && attr->map_state == XCB_MAP_STATE_UNMAPPED)
+        r->state = RESUME_ADOPT;
+    else r->state = RESUME_OK;
+}
+
+static void
+__resume_frames_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    xcb_get_property_reply_t *r = (xcb_get_property_reply_t *)reply;
+    const xcb_window_t *v;
+    resume_frame_s *f;
+    int i, n;
+
+    if (r == NULL || r->format != 32 || r->type != XCB_ATOM_WINDOW) return;
+    n = xcb_get_property_value_length(r) / 8;
+    if (n == 0) return;
+
+    f = (resume_frame_s *)realloc(resume_frames, (resume_frame_count + n) * sizeof(resume_frame_s));
+    if (f == NULL) return;
+    resume_frames = f;
+
+    v = (const xcb_window_t *)xcb_get_property_value(r);
+    for (i = 0; i < n; ++ i)
+    {
+        f = &resume_frames[resume_frame_count ++];
+        f->window    = v[i * 2];
+        f->container = v[i * 2 + 1];
+        f->screen    = (screen_t)data;
+        f->geom_ok   = 0;
+    }
+}
+
+static void
+__resume_frame_geom_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    resume_frame_s *f = (resume_frame_s *)data;
+    xcb_get_geometry_reply_t *geom = (xcb_get_geometry_reply_t *)reply;
+
+    if (geom == NULL) return;
+    f->x = geom->x;
+    f->y = geom->y;
+    f->geom_ok = 1;
+}
+
+static int
+__client_resume(const restart_client_s *r)
+{
+    screen_t screen = &screens[r->screen];
+    client_t client = (client_t)pool_alloc(&client_pool);
+    client_class_t class = NULL, ruled;
+    list_entry_t cur;
+    int hidden;
+
+    if (client == NULL) return -1;
+
+    client->screen = screen;
+    client->xcb_window = r->window;
+    client->xcb_container = XCB_NONE;
+    client->geom[CLIENT_GEOM_WINDOW] = r->geom[CLIENT_GEOM_WINDOW];
+    client->geom[CLIENT_GEOM_CONTAINER] = r->geom[CLIENT_GEOM_CONTAINER];
+    client->geom_seq[CLIENT_GEOM_WINDOW] = 0;
+    client->geom_seq[CLIENT_GEOM_CONTAINER] = 0;
+    client->unmap_seq = 0;
+    memcpy(client->wm_instance, r->wm_instance, CLIENT_WM_CLASS_MAX);
+    memcpy(client->wm_class, r->wm_class, CLIENT_WM_CLASS_MAX);
+    client->wm_instance[CLIENT_WM_CLASS_MAX - 1] = 0;
+    client->wm_class[CLIENT_WM_CLASS_MAX - 1] = 0;
+    client->transient_for = r->transient_for;
+    client->window_type   = r->window_type;
+
+    /* the class it had, if this process has it too */
+    ruled = client_rule_match(client);
+    if (ruled && strncmp(ruled->class_name_get(ruled), r->class_name, RESTART_CLASS_NAME_MAX) == 0)
+        class = ruled;
+    for (cur = list_next(&screen->auto_scan_list); class == NULL && cur != &screen->auto_scan_list; cur = list_next(cur))
+    {
+        client_class_t c = CONTAINER_OF(cur, client_class_s, auto_scan_node);
+        if (strncmp(c->class_name_get(c), r->class_name, RESTART_CLASS_NAME_MAX) == 0)
+            class = c;
+    }
+    if (class == NULL || class->client_resume == NULL || class->priv_size > client_priv_room)
+    {
+        pool_free(&client_pool, client);
+        return -1;
+    }
+
+    list_add(&screen->client_list, &client->client_node);
+    client->desktop = r->desktop;
+    if (client->desktop != DESKTOP_ALL && client->desktop >= desktop_count)
+        client->desktop = screen->desktop_current;
+    client->mapped = r->mapped;
+    client->desktop_hidden = r->desktop_hidden;
+    list_add(__desktop_list(screen, client->desktop), &client->desktop_node);
+    if (client->desktop != r->desktop)
+        __desktop_property(client);
+
+    wnd_dict_node_t node = wnd_dict_find(r->window, WND_DICT_FIND_OP_TOUCH);
+    node->role = WND_ROLE_CLIENT;
+    node->link = client;
+    ewmh_client_add(client);
+    client_prop_attach(client);
+    client->monitor = NULL;
+    client->place_grid = -1;
+    client_sync_attach(client);
+    client->adopted = 1;
+
+    client->class = class;
+    client->priv = NULL;
+    if (class->priv_size)
+    {
+        client->priv = (char *)client + CLIENT_PRIV_OFFSET;
+        memset(client->priv, 0, class->priv_size);
+    }
+    class->client_resume(class, client, r->container);
+    client_monitor_update(client);
+    ipc_client_attach(client);
+
+    /* its desktop may be gone, with fewer of them now */
+    hidden = client->mapped && !__desktop_visible(client);
+    if (hidden && !client->desktop_hidden) __desktop_hide(client);
+    else if (!hidden && client->desktop_hidden) __desktop_show(client);
+    return 0;
+}
+
+static int
+__setup_resume(void)
+{
+    const restart_screen_s *rs = NULL;
+    const restart_client_s *rc = NULL;
+    resume_s *resume = NULL;
+    int i, n, resumed = 0;
+    uint64_t start = time_now_ns();
+
+    /* like the keyboard, not there for a replay to answer */
+    if (!x_backend->offline && trace_mode != TRACE_MODE_RECORD)
+    {
+        for (i = 0; i < screen_count; ++ i)
+        {
+            reply_wait(x_get_property(screens[i].xcb_screen->root, ATOM(_CWM_RESTART_FRAMES),
+                                      XCB_ATOM_WINDOW, 0x10000),
+                       __resume_frames_cb, &screens[i]);
+            xcb_delete_property(x_conn, screens[i].xcb_screen->root, ATOM(_CWM_RESTART_FRAMES));
+        }
+        reply_drain();
+    }
+
+    n = restart_load(&rs, &rc);
+    if (n < 0 && resume_frame_count == 0)
+        return 0;
+
+    if (n > 0 && (resume = (resume_s *)calloc(n, sizeof(resume_s))) == NULL)
+    {
+        restart_done();
+        free(resume_frames);
+        resume_frames = NULL;
+        resume_frame_count = 0;
+        return -1;
+    }
+
+    for (i = 0; n >= 0 && i < screen_count; ++ i)
+        if (rs[i].desktop_current < desktop_count)
+        {
+            screens[i].desktop_current = rs[i].desktop_current;
+            __desktop_announce(&screens[i]);
+        }
+
+    /* all of them still there, and where each container is, in one
+     * round trip */
+    for (i = 0; i < n; ++ i)
+    {
+        const restart_client_s *r = &rc[i];
+
+        resume[i].rec = r;
+        if (r->screen < 0 || r->screen >= screen_count ||
+            wnd_dict_find(r->window, WND_DICT_FIND_OP_NONE) ||
+            wnd_dict_find(r->container, WND_DICT_FIND_OP_NONE))
+            continue;
+
+        /* before the check, so no change goes unnoticed */
+        uint32_t values[1] = { XCB_EVENT_MASK_PROPERTY_CHANGE };
+        xcb_change_window_attributes(x_conn, r->window, XCB_CW_EVENT_MASK, values);
+        reply_wait(x_get_window_attributes(r->window), __resume_check_cb, &resume[i]);
+    }
+    for (i = 0; i < resume_frame_count; ++ i)
+        reply_wait(x_get_geometry(resume_frames[i].container), __resume_frame_geom_cb, &resume_frames[i]);
+    reply_drain();
+
+    xcb_grab_server(x_conn);
+    /* backwards, so the client lists come out in the old order */
+    for (i = n - 1; i >= 0; -- i)
+        if (resume[i].state == RESUME_OK && __client_resume(resume[i].rec) == 0)
+            ++ resumed;
+
+    /* what is left goes back on the root for the scan; the window
+     * may be gone, which costs an error */
+    for (i = 0; i < resume_frame_count; ++ i)
+    {
+        resume_frame_s *f = &resume_frames[i];
+        wnd_dict_node_t node = wnd_dict_find(f->container, WND_DICT_FIND_OP_NONE);
+
+        if (node || !f->geom_ok) continue;
+        x_reparent_window(f->window, f->screen->xcb_screen->root, f->x, f->y);
+        x_destroy_window(f->container);
+    }
+
+    for (i = 0; n >= 0 && i < screen_count; ++ i)
+    {
+        wnd_dict_node_t node = wnd_dict_find(rs[i].focus, WND_DICT_FIND_OP_NONE);
+        client_t client = node && node->role == WND_ROLE_CLIENT ? (client_t)node->link : NULL;
+
+        if (client && client->mapped && !client->desktop_hidden)
+            focus_set(client);
+    }
+    reply_drain();
+    ewmh_flush();
+    xcb_ungrab_server(x_conn);
+
+    DEBUGP("restart: resumed %d of %d clients, %d containers in %.3f ms\n",
+           resumed, n, resume_frame_count, (time_now_ns() - start) / 1e6);
+
+    free(resume);
+    free(resume_frames);
+    resume_frames = NULL;
+    resume_frame_count = 0;
+    restart_done();
+    return 0;
+}
+
+static void
+__client_attach_finish(client_attach_req_t req)
+{
+    wnd_dict_node_t node = wnd_dict_find(req->window, WND_DICT_FIND_OP_NONE);
+    screen_t screen = NULL;
+
+    if (node == NULL || node->role != WND_ROLE_CLIENT_PENDING || node->link != req)
+    {
+        /* destroyed while the replies were in flight */
+        pool_free(&attach_pool, req);
+        return;
+    }
+
+    if (!req->failed)
+    {
+        wnd_dict_node_t parent = wnd_dict_find(req->parent, WND_DICT_FIND_OP_NONE);
+        if (parent && parent->role == WND_ROLE_ROOT)
+            screen = (screen_t)parent->link;
+    }
+
+    if (screen == NULL)
+    {
+        /* not a top level window, not ours to manage */
+        wnd_dict_find(req->window, WND_DICT_FIND_OP_ERASE);
+        if (!req->failed)
+        {
+            uint32_t values[1] = { 0 };
+            xcb_change_window_attributes(x_conn, req->window, XCB_CW_EVENT_MASK, values);
+        }
+        if (req->map && !req->failed)
+            x_map_window(req->window);
+        pool_free(&attach_pool, req);
+        return;
+    }
+
+    xcb_window_t window = req->window;
+    client_t client = (client_t)pool_alloc(&client_pool);
+    if (client == NULL)
+    {
+        wnd_dict_find(req->window, WND_DICT_FIND_OP_ERASE);
+        pool_free(&attach_pool, req);
+        return;
+    }
+
     client->screen = screen;
     client->xcb_window = window;
+    client->xcb_container = XCB_NONE;
+    client->geom[CLIENT_GEOM_WINDOW] = req->geom;
+    client->geom_seq[CLIENT_GEOM_WINDOW] = 0;
+    client->geom_seq[CLIENT_GEOM_CONTAINER] = 0;
+    client->unmap_seq = 0;
+    memcpy(client->wm_instance, req->wm_instance, CLIENT_WM_CLASS_MAX);
+    memcpy(client->wm_class, req->wm_class, CLIENT_WM_CLASS_MAX);
+    client->transient_for = req->transient_for;
+    client->window_type   = req->window_type;
+    if (client->window_type == WINDOW_TYPE_ANY)
+        client->window_type = client->transient_for != XCB_NONE ? WINDOW_TYPE_DIALOG : WINDOW_TYPE_NORMAL;
     list_add(&screen->client_list, &client->client_node);
 
-    node = wnd_dict_find(window, WND_DICT_FIND_OP_TOUCH);
+    client->desktop = req->desktop;
+    if (client->desktop != DESKTOP_ALL && client->desktop >= desktop_count)
+        client->desktop = screen->desktop_current;
+    client->mapped = 0;
+    client->desktop_hidden = 0;
+    list_add(__desktop_list(screen, client->desktop), &client->desktop_node);
+    if (client->desktop != req->desktop)
+        __desktop_property(client);
+
     node->role = WND_ROLE_CLIENT;
     node->link = client;
+    ewmh_client_add(client);
+    client_prop_attach(client);
+    client->monitor = NULL;
+    client->place_grid = -1;
+    client_sync_attach(client);
+    client->adopted = req->adopted;
 
     client->class = &__dummy_client_class;
 
-    list_entry_t cur = list_next(&screen->auto_scan_list);
-    while (cur != &screen->auto_scan_list)
+    /* the class a rule picks first, then whoever takes it */
+    client_class_t ruled = client_rule_match(client);
+    if (ruled == NULL || __client_try_class(client, ruled) != CLIENT_TRY_ATTACH_ATTACHED)
     {
-        client_class_t class = CONTAINER_OF(cur, client_class_s, auto_scan_node);
-        if (class->client_try_attach(class, client) == CLIENT_TRY_ATTACH_ATTACHED)
-            break;
-        cur = list_next(cur);
+        list_entry_t cur = list_next(&screen->auto_scan_list);
+        while (cur != &screen->auto_scan_list)
+        {
+            client_class_t class = CONTAINER_OF(cur, client_class_s, auto_scan_node);
+            if (class != ruled &&
+                __client_try_class(client, class) == CLIENT_TRY_ATTACH_ATTACHED)
+                break;
+            cur = list_next(cur);
+        }
     }
 
     DEBUGP("client: %08x attached to class: %s\n", window, client->class->class_name_get(client->class));
-    
-    return client;
+    client_monitor_update(client);
+    ipc_client_attach(client);
+
+    if (req->map)
+        __client_map(client);
+    pool_free(&attach_pool, req);
+}
+
+static void
+__client_attach_tree_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    client_attach_req_t req = (client_attach_req_t)data;
+    xcb_query_tree_reply_t *tree = (xcb_query_tree_reply_t *)reply;
+
+    if (tree)
+        req->parent = tree->parent;
+    else req->failed = 1;
+
+    if (-- req->pending == 0)
+        __client_attach_finish(req);
+}
+
+static void
+__client_attach_geom_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    client_attach_req_t req = (client_attach_req_t)data;
+    xcb_get_geometry_reply_t *geom = (xcb_get_geometry_reply_t *)reply;
+
+    if (geom)
+    {
+        req->geom.x = geom->x;
+        req->geom.y = geom->y;
+        req->geom.w = geom->width;
+        req->geom.h = geom->height;
+    }
+    else req->failed = 1;
+
+    if (-- req->pending == 0)
+        __client_attach_finish(req);
+}
+
+static void
+__client_attach_class_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    client_attach_req_t req = (client_attach_req_t)data;
+    xcb_get_property_reply_t *prop = (xcb_get_property_reply_t *)reply;
+
+    /* "instance\0class\0", either may be missing */
+    if (prop && prop->format == 8)
+    {
+        const char *v = (const char *)xcb_get_property_value(prop);
+        int len = xcb_get_property_value_length(prop);
+        int i = 0, n;
+
+        for (n = 0; i < len && v[i]; ++ i)
+            if (n < CLIENT_WM_CLASS_MAX - 1) req->wm_instance[n ++] = v[i];
+        req->wm_instance[n] = 0;
+
+        for (++ i, n = 0; i < len && v[i]; ++ i)
+            if (n < CLIENT_WM_CLASS_MAX - 1) req->wm_class[n ++] = v[i];
+        req->wm_class[n] = 0;
+    }
+
+    if (-- req->pending == 0)
+        __client_attach_finish(req);
+}
+
+static void
+__client_attach_type_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    client_attach_req_t req = (client_attach_req_t)data;
+    xcb_get_property_reply_t *prop = (xcb_get_property_reply_t *)reply;
+
+    if (prop && prop->format == 32)
+    {
+        xcb_atom_t *types = (xcb_atom_t *)xcb_get_property_value(prop);
+        int i, t, n = xcb_get_property_value_length(prop) / 4;
+
+        for (i = 0; i < n && req->window_type == WINDOW_TYPE_ANY; ++ i)
+            for (t = 0; t < WINDOW_TYPE_COUNT; ++ t)
+                if (types[i] == atoms[ATOM_ID(_NET_WM_WINDOW_TYPE_NORMAL) + t])
+                {
+                    req->window_type = t;
+                    break;
+                }
+    }
+
+    if (-- req->pending == 0)
+        __client_attach_finish(req);
+}
+
+static void
+__client_attach_desktop_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    client_attach_req_t req = (client_attach_req_t)data;
+    xcb_get_property_reply_t *prop = (xcb_get_property_reply_t *)reply;
+
+    /* set by us before a restart, or by the client */
+    if (prop && prop->format == 32 && xcb_get_property_value_length(prop) >= 4)
+        req->desktop = *(uint32_t *)xcb_get_property_value(prop);
+
+    if (-- req->pending == 0)
+        __client_attach_finish(req);
+}
+
+static void
+__client_attach_transient_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    client_attach_req_t req = (client_attach_req_t)data;
+    xcb_get_property_reply_t *prop = (xcb_get_property_reply_t *)reply;
+
+    if (prop && prop->format == 32 && xcb_get_property_value_length(prop) >= 4)
+        req->transient_for = *(xcb_window_t *)xcb_get_property_value(prop);
+
+    if (-- req->pending == 0)
+        __client_attach_finish(req);
+}
+
+/* Everything class selection looks at, requested along with whatever
+ * else the attach is waiting for; none of it is needed to manage the
+ * window, so errors just leave the defaults */
+static void
+__client_attach_props(client_attach_req_t req)
+{
+    req->pending += 4;
+    reply_wait(x_get_property(req->window, XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, CLIENT_WM_CLASS_MAX / 2),
+               __client_attach_class_cb, req);
+    reply_wait(x_get_property(req->window, ATOM(_NET_WM_WINDOW_TYPE), XCB_ATOM_ATOM, 16),
+               __client_attach_type_cb, req);
+    reply_wait(x_get_property(req->window, XCB_ATOM_WM_TRANSIENT_FOR, XCB_ATOM_WINDOW, 1),
+               __client_attach_transient_cb, req);
+    reply_wait(x_get_property(req->window, ATOM(_NET_WM_DESKTOP), XCB_ATOM_CARDINAL, 1),
+               __client_attach_desktop_cb, req);
+}
+
+/* Mark a window as being attached, returns NULL if it is attached,
+ * ignored or already on its way */
+static client_attach_req_t
+__client_attach_begin(xcb_window_t window, int map)
+{
+    wnd_dict_node_t node = wnd_dict_find(window, WND_DICT_FIND_OP_TOUCH);
+    if (node == NULL)
+        return NULL;
+
+    switch (node->role)
+    {
+    case WND_ROLE_INIT:
+        break;
+
+    case WND_ROLE_CLIENT_PENDING:
+        if (map) ((client_attach_req_t)node->link)->map = 1;
+        return NULL;
+
+    default:
+        /* Skip attached window */
+        return NULL;
+    }
+
+    client_attach_req_t req = (client_attach_req_t)pool_alloc(&attach_pool);
+    if (req == NULL)
+    {
+        wnd_dict_find(window, WND_DICT_FIND_OP_ERASE);
+        return NULL;
+    }
+
+    req->window  = window;
+    req->parent  = XCB_NONE;
+    req->pending = 0;
+    req->failed  = 0;
+    req->map     = map;
+    req->adopted = 0;
+    req->wm_instance[0] = 0;
+    req->wm_class[0]    = 0;
+    req->window_type    = WINDOW_TYPE_ANY;
+    req->transient_for  = XCB_NONE;
+    req->desktop        = DESKTOP_NONE;
+
+    node->role = WND_ROLE_CLIENT_PENDING;
+    node->link = req;
+
+    /* before any property is read, so no change goes unnoticed */
+    uint32_t values[1] = { XCB_EVENT_MASK_PROPERTY_CHANGE };
+    xcb_change_window_attributes(x_conn, window, XCB_CW_EVENT_MASK, values);
+
+    return req;
+}
+
+/* Start managing a window. The parent, geometry and the properties
+ * for class selection are requested here and the client is only
+ * created once all replies are in; the window sits in the dictionary
+ * as CLIENT_PENDING meanwhile. */
+static void
+__client_attach(xcb_window_t window, int map)
+{
+    client_attach_req_t req = __client_attach_begin(window, map);
+    if (req == NULL)
+        return;
+
+    req->pending = 2;
+    reply_wait(x_query_tree(window), __client_attach_tree_cb, req);
+    reply_wait(x_get_geometry(window), __client_attach_geom_cb, req);
+    __client_attach_props(req);
 }
 
 static void
 __client_detach(client_t client, int forget)
 {
+    ipc_client_detach(client);
     if (client->class && client->class->client_detach)
         client->class->client_detach(client->class, client, !forget);
 
     if (forget)
     {
         wnd_dict_find(client->xcb_window, WND_DICT_FIND_OP_ERASE);
-        xcb_unmap_window(x_conn, client->xcb_window);
+        x_unmap_window(client->xcb_window);
     }
     else
     {
@@ -566,20 +1677,60 @@ __client_detach(client_t client, int forget)
     if (client->screen->focus == client)
         client->screen->focus = NULL;
 
+    ewmh_client_remove(client);
+    client_prop_detach(client);
+    client_monitor_detach(client);
+    client_place_detach(client);
+    client_sync_detach(client);
     list_del(&client->client_node);
-    free(client);
+    list_del(&client->desktop_node);
+    pool_free(&client_pool, client);
 }
 
 static void
 __client_map(client_t client)
 {
+    client->mapped = 1;
+    client_place_update(client);
+
+    /* shown when its desktop is */
+    if (!__desktop_visible(client))
+    {
+        client->desktop_hidden = 1;
+        return;
+    }
+
+    client->desktop_hidden = 0;
     if (client->class && client->class->client_map)
         client->class->client_map(client->class, client);
 }
 
+/* Make client slots hold size bytes of class private data */
+int
+client_priv_reserve(size_t size)
+{
+    if (size <= client_priv_room)
+        return 0;
+
+    /* slots can only grow while none is handed out */
+    if (client_pool.live)
+    {
+        DEBUGP("no room for %zu bytes of client private data\n", size);
+        return -1;
+    }
+
+    pool_destroy(&client_pool);
+    client_priv_room = size;
+    pool_init(&client_pool, "client", CLIENT_PRIV_OFFSET + client_priv_room, CLIENT_POOL_CHUNK);
+    return 0;
+}
+
 void
 client_class_auto_scan_attach(screen_t screen, client_class_t cc)
 {
+    if (client_priv_reserve(cc->priv_size))
+        return;
+
     list_add(&screen->auto_scan_list, &cc->auto_scan_node);
 }
 
@@ -600,10 +1751,10 @@ screen_mouse_attach(screen_t screen, mouse_motion_callback_f motion_callback, mo
     screen->mouse_cb_data = data;
     screen->mouse_attached = 1;
 
+    /* no motion hints, events carry the position themselves */
     xcb_grab_pointer(x_conn, 0, screen->xcb_screen->root,
                      XCB_EVENT_MASK_BUTTON_RELEASE
-                     | XCB_EVENT_MASK_BUTTON_MOTION
-                     | XCB_EVENT_MASK_POINTER_MOTION_HINT,
+                     | XCB_EVENT_MASK_BUTTON_MOTION,
                      XCB_GRAB_MODE_ASYNC,
                      XCB_GRAB_MODE_ASYNC,
                      screen->xcb_screen->root,
@@ -620,46 +1771,139 @@ screen_mouse_detach(screen_t screen)
         return;
 
     screen->mouse_attached = 0;
+    screen->mouse_motion_pending = 0;
+    timeout_cancel(&screen->mouse_motion_timer);
     xcb_ungrab_pointer(x_conn, XCB_CURRENT_TIME);    
 }
 
+/* the indexes that go by where a client is */
+static void
+__client_geom_changed(client_t client)
+{
+    client_monitor_update(client);
+    client_place_update(client);
+}
+
 int
-xh_window_geom_get(xcb_window_t window, xcb_window_t *parent, rect_t rect)
+client_geom_get(client_t client, int which, rect_t rect)
 {
-    xcb_query_tree_cookie_t   tree_cookie;
-    xcb_query_tree_reply_t   *tree;
+    if (which == CLIENT_GEOM_CONTAINER && client->xcb_container == XCB_NONE)
+        return -1;
 
-    xcb_get_geometry_cookie_t  geom_cookie;
-    xcb_get_geometry_reply_t  *geom;
+    *rect = client->geom[which];
+    return 0;
+}
 
-    if (parent) tree_cookie = xcb_query_tree(x_conn, window);
-    if (rect)   geom_cookie = xcb_get_geometry(x_conn, window);
-    
-    if (parent)
+void
+client_geom_set(client_t client, int which, rect_t rect)
+{
+    client->geom[which] = *rect;
+    __client_geom_changed(client);
+}
+
+void
+client_container_set(client_t client, xcb_window_t container, rect_t rect)
+{
+    client->xcb_container = container;
+    client->geom_seq[CLIENT_GEOM_CONTAINER] = 0;
+    if (rect) client->geom[CLIENT_GEOM_CONTAINER] = *rect;
+    __client_geom_changed(client);
+}
+
+void
+client_configure(client_t client, int which, uint16_t mask, const uint32_t *values)
+{
+    xcb_window_t window = which == CLIENT_GEOM_CONTAINER ? client->xcb_container : client->xcb_window;
+    rect_t rect = &client->geom[which];
+    const uint32_t *v = values;
+
+    /* values come in mask bit order */
+    if (mask & XCB_CONFIG_WINDOW_X)      rect->x = (int32_t)*v ++;
+    if (mask & XCB_CONFIG_WINDOW_Y)      rect->y = (int32_t)*v ++;
+    if (mask & XCB_CONFIG_WINDOW_WIDTH)  rect->w = *v ++;
+    if (mask & XCB_CONFIG_WINDOW_HEIGHT) rect->h = *v ++;
+
+    unsigned int sequence = x_configure_window(window, mask, values);
+    if (mask & (XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+                XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT))
     {
-        if ((tree = xcb_query_tree_reply(x_conn, tree_cookie, NULL)) == NULL)
+        client->geom_seq[which] = sequence;
+        __client_geom_changed(client);
+    }
+}
+
+#ifdef GEOM_CHECK
+
+typedef struct geom_check_s
+{
+    xcb_window_t window;
+    int          which;
+    unsigned int sequence;
+} geom_check_s;
+
+static void
+__geom_check_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    geom_check_s *check = (geom_check_s *)data;
+    xcb_get_geometry_reply_t *geom = (xcb_get_geometry_reply_t *)reply;
+    wnd_dict_node_t node = wnd_dict_find(check->window, WND_DICT_FIND_OP_NONE);
+
+    if (geom && node && node->role == WND_ROLE_CLIENT)
+    {
+        client_t client = (client_t)node->link;
+        unsigned int seq = client->geom_seq[check->which];
+        rect_t r = &client->geom[check->which];
+
+        /* skip if we configured it again after asking */
+        if ((check->which == CLIENT_GEOM_WINDOW || client->xcb_container == check->window) &&
+            (seq == 0 || (int)(seq - check->sequence) < 0) &&
+            (r->x != geom->x || r->y != geom->y || r->w != geom->width || r->h != geom->height))
         {
-            /* XXX need to stop geom query? */
-            return -1;
+            DEBUGP("geom check: %08x cached %d,%d %ux%u server %d,%d %ux%u\n",
+                   check->window, r->x, r->y, r->w, r->h,
+                   geom->x, geom->y, geom->width, geom->height);
         }
-        *parent = tree->parent;
-        free(tree);
     }
 
-    if (rect)
+    free(check);
+}
+
+static void
+__geom_check_one(xcb_window_t window, int which)
+{
+    geom_check_s *check = (geom_check_s *)malloc(sizeof(geom_check_s));
+    if (check == NULL) return;
+
+    check->window   = window;
+    check->which    = which;
+    check->sequence = x_get_geometry(window);
+    reply_wait(check->sequence, __geom_check_cb, check);
+}
+
+static void
+__geom_check(void *data)
+{
+    int i;
+
+    timeout_add(&geom_check_timer, GEOM_CHECK_INTERVAL);
+
+    for (i = 0; i < screen_count; ++ i)
     {
-        if ((geom = xcb_get_geometry_reply(x_conn, geom_cookie, NULL)) == NULL)
-            return -1;
-        rect->x = geom->x;
-        rect->y = geom->y;
-        rect->w = geom->width;
-        rect->h = geom->height;
-        free(geom);
-    }
+        list_entry_t cur = list_next(&screens[i].client_list);
+        while (cur != &screens[i].client_list)
+        {
+            client_t client = CONTAINER_OF(cur, client_s, client_node);
+            cur = list_next(cur);
 
-    return 0;
+            __geom_check_one(client->xcb_window, CLIENT_GEOM_WINDOW);
+            if (client->xcb_container != XCB_NONE)
+                __geom_check_one(client->xcb_container, CLIENT_GEOM_CONTAINER);
+        }
+    }
 }
 
+#endif
+
 void
 focus_set(client_t client)
 {
@@ -677,21 +1921,140 @@ focus_set(client_t client)
 
     xcb_set_input_focus(x_conn, XCB_INPUT_FOCUS_POINTER_ROOT, client->xcb_window, XCB_CURRENT_TIME);
     client->screen->focus = client;
+    ewmh_client_raise(client);
+    ipc_focus(client);
 }
 
-int
-main(void)
+void
+client_close(client_t client)
 {
-    int ret;
-    
-    ret = __init();
-    if (ret == 0)
+    const uint32_t *protocols = (const uint32_t *)client_prop_get(client, CLIENT_PROP_PROTOCOLS);
+    xcb_client_message_event_t m;
+
+    /* not known yet, asking is harmless */
+    if (protocols && !(*protocols & CLIENT_PROTOCOL_DELETE_WINDOW))
+    {
+        xcb_kill_client(x_conn, client->xcb_window);
+        return;
+    }
+
+    memset(&m, 0, sizeof(m));
+    m.response_type  = XCB_CLIENT_MESSAGE;
+    m.format         = 32;
+    m.window         = client->xcb_window;
+    m.type           = ATOM(WM_PROTOCOLS);
+    m.data.data32[0] = ATOM(WM_DELETE_WINDOW);
+    m.data.data32[1] = XCB_CURRENT_TIME;
+    xcb_send_event(x_conn, 0, client->xcb_window, XCB_EVENT_MASK_NO_EVENT, (const char *)&m);
+}
+
+static void
+__desktop_announce(screen_t screen)
+{
+    xcb_window_t root = screen->xcb_screen->root;
+
+    xcb_change_property(x_conn, XCB_PROP_MODE_REPLACE, root, ATOM(_NET_NUMBER_OF_DESKTOPS),
+                        XCB_ATOM_CARDINAL, 32, 1, &desktop_count);
+    xcb_change_property(x_conn, XCB_PROP_MODE_REPLACE, root, ATOM(_NET_CURRENT_DESKTOP),
+                        XCB_ATOM_CARDINAL, 32, 1, &screen->desktop_current);
+}
+
+static void
+__desktop_hide(client_t client)
+{
+    if (!client->mapped || client->desktop_hidden) return;
+
+    client->desktop_hidden = 1;
+    if (client->screen->focus == client)
     {
-        cc_simple->init(cc_simple);
-        __setup();
+        if (client->class && client->class->client_aevent_blur)
+            client->class->client_aevent_blur(client->class, client);
+        client->screen->focus = NULL;
     }
-    if (ret == 0) __event_loop();
-    ret = __cleanup();
+    if (client->class && client->class->client_unmap)
+        client->class->client_unmap(client->class, client);
+}
+
+static void
+__desktop_show(client_t client)
+{
+    if (client->desktop_hidden) __client_map(client);
+}
+
+/* Only the clients of the two desktops are visited, and the server
+ * is grabbed so nothing is drawn until all of them changed */
+void
+desktop_switch(screen_t screen, unsigned int desktop)
+{
+    list_entry_t list, cur;
+
+    if (desktop >= desktop_count || desktop == screen->desktop_current)
+        return;
+
+    xcb_grab_server(x_conn);
+
+    list = __desktop_list(screen, screen->desktop_current);
+    screen->desktop_current = desktop;
+    for (cur = list_next(list); cur != list; cur = list_next(cur))
+        __desktop_hide(CONTAINER_OF(cur, client_s, desktop_node));
+
+    list = __desktop_list(screen, desktop);
+    for (cur = list_next(list); cur != list; cur = list_next(cur))
+        __desktop_show(CONTAINER_OF(cur, client_s, desktop_node));
+
+    __desktop_announce(screen);
+    xcb_ungrab_server(x_conn);
+}
+
+void
+client_desktop_set(client_t client, unsigned int desktop)
+{
+    if (desktop != DESKTOP_ALL && desktop >= desktop_count)
+        return;
+    if (desktop == client->desktop)
+        return;
+
+    list_del(&client->desktop_node);
+    client->desktop = desktop;
+    list_add(__desktop_list(client->screen, desktop), &client->desktop_node);
+    __desktop_property(client);
+    client_place_update(client);
+
+    if (__desktop_visible(client)) __desktop_show(client);
+    else __desktop_hide(client);
+}
+
+static void
+xcb_event_client_message(xcb_generic_event_t *e)
+{
+    xcb_client_message_event_t *message = (xcb_client_message_event_t *)e;
+    wnd_dict_node_t node = wnd_dict_find(message->window, WND_DICT_FIND_OP_NONE);
+
+    if (node == NULL || message->format != 32) return;
 
-    return ret;
+    if (message->type == ATOM(_NET_CURRENT_DESKTOP) && node->role == WND_ROLE_ROOT)
+        desktop_switch((screen_t)node->link, message->data.data32[0]);
+    else if (message->type == ATOM(_NET_WM_DESKTOP) && node->role == WND_ROLE_CLIENT)
+        client_desktop_set((client_t)node->link, message->data.data32[0]);
+}
+
+static void
+xcb_event_key_press(xcb_generic_event_t *e)
+{
+    key_press((xcb_key_press_event_t *)e);
+}
+
+static void
+xcb_event_mapping_notify(xcb_generic_event_t *e)
+{
+    keys_mapping_notify((xcb_mapping_notify_event_t *)e);
+}
+
+/* Offline run over a recorded trace: everything the server said
+ * comes from the trace, timers fire where they fired when recording */
+void
+wm_replay(void)
+{
+    do wm_dispatch();
+    while (processing_flag && trace_replay_step());
 }
@@ -1,6 +1,7 @@
 #ifndef __WM_BASE_H__
 #define __WM_BASE_H__
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -32,6 +33,106 @@ typedef struct rect_s
 
 typedef rect_s *rect_t;
 
+/* Timeouts on a hierarchical timer wheel, see timer.c. Adding and
+ * cancelling are O(1); a timeout_s is owned by the caller and may be
+ * re-added while active to move it. */
+#define TIMEOUT_TICK_NS 1000000ull
+
+typedef void(*timeout_callback_f)(void *data);
+
+typedef struct timeout_s *timeout_t;
+typedef struct timeout_s
+{
+    list_entry_s       node;
+    uint64_t           expire;      /* in ticks */
+    int                active;
+    timeout_callback_f callback;
+    void              *data;
+} timeout_s;
+
+uint64_t time_now_ns(void);
+uint64_t time_real_ns(void);
+void     timeout_init(timeout_t t, timeout_callback_f callback, void *data);
+void     timeout_add(timeout_t t, uint64_t delay_ns);
+void     timeout_cancel(timeout_t t);
+void     timeout_run(uint64_t now_ns);
+uint64_t timeout_next(void);
+
+/* Main loop, see loop.c. Watches are epoll registrations owned by
+ * the caller, signals are routed through a signalfd. */
+typedef struct loop_watch_s *loop_watch_t;
+typedef void(*loop_watch_callback_f)(loop_watch_t watch, uint32_t events);
+typedef void(*loop_signal_callback_f)(int signo);
+
+typedef struct loop_watch_s
+{
+    int                   fd;
+    loop_watch_callback_f callback;
+    void                 *data;
+} loop_watch_s;
+
+int  loop_init(void);
+int  loop_signal(int signo, loop_signal_callback_f callback);
+int  loop_watch_add(loop_watch_t watch, uint32_t events);
+int  loop_watch_mod(loop_watch_t watch, uint32_t events);
+void loop_watch_del(loop_watch_t watch);
+void loop_wait(void);
+void loop_cleanup(void);
+int  loop_listen(const char *env, const char *name, char *path, size_t size, int backlog);
+
+/* Fixed size object pools, see pool.c. Every initialized pool is on
+ * the pools list for the statistics; live and high count objects. */
+typedef struct pool_s *pool_t;
+typedef struct pool_s
+{
+    const char    *name;
+    size_t         size;        /* object size, rounded up for alignment */
+    unsigned int   per_chunk;
+    void          *free;
+    void          *chunks;
+    unsigned long  live;
+    unsigned long  high;
+    unsigned long  allocs;
+    unsigned long  nchunks;
+    struct pool_s *next;
+} pool_s;
+
+extern pool_t pools;
+
+void  pool_init(pool_t pool, const char *name, size_t size, unsigned int per_chunk);
+void *pool_alloc(pool_t pool);
+void  pool_free(pool_t pool, void *obj);
+void  pool_destroy(pool_t pool);
+
+/* Record/replay, see trace.c. Recording is done by the xcb backend,
+ * replaying is a backend of its own. */
+#define TRACE_MODE_OFF    0
+#define TRACE_MODE_RECORD 1
+#define TRACE_MODE_REPLAY 2
+
+typedef struct trace_replay_stats_s
+{
+    unsigned long events;
+    unsigned long replies;
+    unsigned long timers;
+    unsigned long desyncs;
+} trace_replay_stats_s;
+
+extern int                  trace_mode;
+extern trace_replay_stats_s trace_replay_stats;
+
+int   trace_record_open(const char *path);
+int   trace_replay_open(const char *path);
+void  trace_close(void);
+void  trace_record_setup(const xcb_setup_t *setup);
+void  trace_record_id(uint32_t id);
+void  trace_record_event(xcb_generic_event_t *e);
+void  trace_record_batch_end(void);
+void  trace_record_reply(void *reply, xcb_generic_error_t *error);
+void  trace_timer(uint64_t now);
+uint64_t trace_clock(void);
+int   trace_replay_step(void);
+
 typedef void(*mouse_motion_callback_f)(void *data, int abs_x, int abs_y);
 typedef void(*mouse_release_callback_f)(void *data);
 
@@ -43,21 +144,228 @@ typedef struct screen_s
     mouse_motion_callback_f  mouse_motion_callback;
     mouse_release_callback_f mouse_release_callback;
     void                    *mouse_cb_data;
+    /* latest pointer position not yet handed to the callback */
+    int                      mouse_motion_pending;
+    int                      mouse_motion_x;
+    int                      mouse_motion_y;
+    uint64_t                 mouse_motion_last;
+    timeout_s                mouse_motion_timer;
 
     struct client_s *focus;
     list_entry_s client_list;
     list_entry_s auto_scan_list;
+
+    /* clients by desktop, DESKTOP_ALL ones in the last list */
+    unsigned int  desktop_current;
+    list_entry_s *desktop_clients;
+
+    /* see monitor.c; monitor_last is where monitor_at looks first */
+    struct monitor_s *monitors;
+    int               monitor_count;
+    int               monitor_last;
 } screen_s;
 
 typedef screen_s *screen_t;
 
+/* Monitors, see monitor.c. A screen has at least one; with USE_RANDR
+ * they are the RandR monitors. Each lists the clients whose centre is
+ * on it, or nearest to it when on none. */
+typedef struct monitor_s *monitor_t;
+typedef struct monitor_s
+{
+    screen_t     screen;
+    rect_s       geom;          /* root coordinates */
+    xcb_atom_t   name;          /* XCB_NONE without RandR */
+    int          primary;
+    list_entry_s clients;       /* of client_s.monitor_node */
+    unsigned int client_count;
+} monitor_s;
+
+/* Atoms, all interned by wm_init in one batch. ATOM(name) is usable
+ * anywhere after that; an atom is added by adding it to ATOM_LIST, or
+ * at build time with -D'ATOM_LIST_EXTRA(A)=A(NAME) ...'. Runs that are
+ * indexed by offset (window types, states) must keep their order. */
+#define ATOM_LIST(A)                                                    \
+    A(WM_PROTOCOLS) A(WM_DELETE_WINDOW) A(WM_TAKE_FOCUS) A(WM_STATE)     \
+    A(UTF8_STRING) A(_NET_WM_NAME)                                      \
+    A(_NET_WM_PING) A(_NET_WM_SYNC_REQUEST) A(_NET_WM_SYNC_REQUEST_COUNTER) \
+    A(_NET_WM_DESKTOP) A(_NET_NUMBER_OF_DESKTOPS) A(_NET_CURRENT_DESKTOP) \
+    A(_NET_CLIENT_LIST) A(_NET_CLIENT_LIST_STACKING)                    \
+    A(_NET_WM_WINDOW_TYPE)                                              \
+    A(_NET_WM_WINDOW_TYPE_NORMAL) A(_NET_WM_WINDOW_TYPE_DIALOG)         \
+    A(_NET_WM_WINDOW_TYPE_DOCK) A(_NET_WM_WINDOW_TYPE_DESKTOP)           \
+    A(_NET_WM_WINDOW_TYPE_TOOLBAR) A(_NET_WM_WINDOW_TYPE_MENU)          \
+    A(_NET_WM_WINDOW_TYPE_UTILITY) A(_NET_WM_WINDOW_TYPE_SPLASH)        \
+    A(_NET_WM_STATE)                                                    \
+    A(_NET_WM_STATE_MODAL) A(_NET_WM_STATE_STICKY)                      \
+    A(_NET_WM_STATE_MAXIMIZED_VERT) A(_NET_WM_STATE_MAXIMIZED_HORZ)     \
+    A(_NET_WM_STATE_SHADED) A(_NET_WM_STATE_SKIP_TASKBAR)               \
+    A(_NET_WM_STATE_SKIP_PAGER) A(_NET_WM_STATE_HIDDEN)                 \
+    A(_NET_WM_STATE_FULLSCREEN) A(_NET_WM_STATE_ABOVE)                  \
+    A(_NET_WM_STATE_BELOW) A(_NET_WM_STATE_DEMANDS_ATTENTION)         \
+    A(_CWM_RESTART_FRAMES)
+
+#ifndef ATOM_LIST_EXTRA
+#define ATOM_LIST_EXTRA(A)
+#endif
+
+#define ATOM_ID(name) ATOM_ID_ ## name
+#define __ATOM_ENUM(name) ATOM_ID(name),
+enum { ATOM_LIST(__ATOM_ENUM) ATOM_LIST_EXTRA(__ATOM_ENUM) ATOM_COUNT };
+#undef __ATOM_ENUM
+
+extern xcb_atom_t atoms[ATOM_COUNT];
+#define ATOM(name) atoms[ATOM_ID(name)]
+
+#define CLIENT_WM_CLASS_MAX 64
+
+#define EWMH_CLIENT_LIST 0
+#define EWMH_STACKING    1
+#define EWMH_LISTS       2
+#define EWMH_INDEX_NONE  0xffffffff
+
+/* _NET_WM_WINDOW_TYPE, the first one of a window's list that we know;
+ * windows without one are NORMAL, or DIALOG if transient */
+#define WINDOW_TYPE_ANY     (-1)
+#define WINDOW_TYPE_NORMAL  0
+#define WINDOW_TYPE_DIALOG  1
+#define WINDOW_TYPE_DOCK    2
+#define WINDOW_TYPE_DESKTOP 3
+#define WINDOW_TYPE_TOOLBAR 4
+#define WINDOW_TYPE_MENU    5
+#define WINDOW_TYPE_UTILITY 6
+#define WINDOW_TYPE_SPLASH  7
+#define WINDOW_TYPE_COUNT   8
+
+/* Client property cache, see prop.c. Each property is fetched when
+ * first asked for, kept parsed in the client and, once asked for,
+ * refetched at the end of the event batch it changed in. */
+#define CLIENT_PROP_WM_NAME      0
+#define CLIENT_PROP_NET_WM_NAME  1
+#define CLIENT_PROP_WM_HINTS     2
+#define CLIENT_PROP_NORMAL_HINTS 3
+#define CLIENT_PROP_PROTOCOLS    4
+#define CLIENT_PROP_NET_WM_STATE 5
+#define CLIENT_PROP_SYNC_COUNTER 6
+#define CLIENT_PROP_COUNT        7
+#define CLIENT_PROP_BIT(prop)    (1u << (prop))
+
+#define CLIENT_TITLE_MAX 128
+
+/* WM_HINTS, ICCCM 4.1.2.4 */
+#define WM_HINTS_INPUT   (1 << 0)
+#define WM_HINTS_STATE   (1 << 1)
+#define WM_HINTS_GROUP   (1 << 6)
+#define WM_HINTS_URGENCY (1 << 8)
+
+typedef struct client_wm_hints_s
+{
+    uint32_t     flags;
+    int          input;
+    int          initial_state;
+    xcb_window_t group;
+} client_wm_hints_s;
+
+/* WM_NORMAL_HINTS, ICCCM 4.1.2.3; fields without their flag are 0 */
+#define SIZE_HINTS_MIN     (1 << 4)
+#define SIZE_HINTS_MAX     (1 << 5)
+#define SIZE_HINTS_INC     (1 << 6)
+#define SIZE_HINTS_ASPECT  (1 << 7)
+#define SIZE_HINTS_BASE    (1 << 8)
+#define SIZE_HINTS_GRAVITY (1 << 9)
+
+typedef struct client_size_hints_s
+{
+    uint32_t flags;
+    int      min_w, min_h, max_w, max_h;
+    int      inc_w, inc_h, base_w, base_h;
+    int      min_aspect_num, min_aspect_den;
+    int      max_aspect_num, max_aspect_den;
+    int      gravity;
+} client_size_hints_s;
+
+/* the WM_PROTOCOLS we know of */
+#define CLIENT_PROTOCOL_DELETE_WINDOW (1 << 0)
+#define CLIENT_PROTOCOL_TAKE_FOCUS    (1 << 1)
+#define CLIENT_PROTOCOL_PING          (1 << 2)
+#define CLIENT_PROTOCOL_SYNC_REQUEST  (1 << 3)
+
+/* _NET_WM_STATE, in the order of the atoms */
+#define CLIENT_STATE_MODAL             (1 << 0)
+#define CLIENT_STATE_STICKY            (1 << 1)
+#define CLIENT_STATE_MAXIMIZED_VERT    (1 << 2)
+#define CLIENT_STATE_MAXIMIZED_HORZ    (1 << 3)
+#define CLIENT_STATE_SHADED            (1 << 4)
+#define CLIENT_STATE_SKIP_TASKBAR      (1 << 5)
+#define CLIENT_STATE_SKIP_PAGER        (1 << 6)
+#define CLIENT_STATE_HIDDEN            (1 << 7)
+#define CLIENT_STATE_FULLSCREEN        (1 << 8)
+#define CLIENT_STATE_ABOVE             (1 << 9)
+#define CLIENT_STATE_BELOW             (1 << 10)
+#define CLIENT_STATE_DEMANDS_ATTENTION (1 << 11)
+#define CLIENT_STATE_COUNT             12
+
+typedef struct client_props_s
+{
+    uint16_t            valid;      /* have a parsed value */
+    uint16_t            wanted;     /* asked for, so kept up to date */
+    uint16_t            fetching;   /* a request is in flight */
+    uint16_t            dirty;      /* changed, refetched at batch end */
+    unsigned int        seq[CLIENT_PROP_COUNT];
+    list_entry_s        dirty_node;
+
+    char                wm_name[CLIENT_TITLE_MAX];
+    char                net_wm_name[CLIENT_TITLE_MAX];
+    client_wm_hints_s   hints;
+    client_size_hints_s size_hints;
+    uint32_t            protocols;
+    uint32_t            state;
+    uint32_t            sync_counter;   /* XCB_NONE if it has none */
+} client_props_s;
+
+typedef client_props_s *client_props_t;
+
 typedef struct client_s
 {
     screen_t               screen;
     xcb_drawable_t         xcb_window;
+    xcb_window_t           xcb_container; /* XCB_NONE unless the class has one */
+    /* geometry cache, see client_geom_get */
+    rect_s                 geom[2];
+    unsigned int           geom_seq[2];
     list_entry_s           client_node;
     struct client_class_s *class;
     void                  *priv;
+    /* fetched along with the attach replies, see client rules;
+     * WM_CLASS parts are truncated to fit */
+    char                   wm_instance[CLIENT_WM_CLASS_MAX];
+    char                   wm_class[CLIENT_WM_CLASS_MAX];
+    int                    window_type;
+    xcb_window_t           transient_for;
+    /* desktops, see desktop_switch; mapped is whether the client
+     * wants to be seen, desktop_hidden whether we hide it */
+    unsigned int           desktop;
+    int                    mapped;
+    int                    desktop_hidden;
+    /* the last unmap of a frameless client's own window by its class,
+     * so the UnmapNotify it causes is not taken for a withdrawal */
+    unsigned int           unmap_seq;
+    list_entry_s           desktop_node;
+    /* places in the EWMH client lists, see ewmh.c */
+    unsigned int           ewmh_index[EWMH_LISTS];
+    client_props_s         props;
+    monitor_t              monitor;
+    list_entry_s           monitor_node;
+    /* cells counted in a placement grid (-1 if none), see place.c */
+    int                    place_grid;
+    uint16_t               place_cells[4];
+    /* already mapped when we started, keeps its position */
+    int                    adopted;
+    /* _NET_WM_SYNC_REQUEST, see sync.c */
+    uint32_t               sync_alarm;
+    uint64_t               sync_value;
+    int                    sync_busy;
+    timeout_s              sync_timer;
 } client_s;
 
 typedef client_s *client_t;
@@ -68,18 +376,21 @@ typedef struct wnd_dict_node_s
     xcb_window_t wnd;
     int          role;
     void        *link;
-    struct wnd_dict_node_s *next;
 } wnd_dict_node_s;
 
+/* TOUCH returns the existing node if the window is already known */
 wnd_dict_node_t wnd_dict_find(xcb_window_t wnd, int op);
+unsigned int    wnd_dict_count(void);
 
-#define WND_ROLE_INIT          0
-#define WND_ROLE_ROOT          1
-#define WND_ROLE_CLIENT        2
-#define WND_ROLE_CLIENT_IGNORE 3
-#define WND_DICT_FIND_OP_NONE  0
-#define WND_DICT_FIND_OP_TOUCH 1
-#define WND_DICT_FIND_OP_ERASE 2
+#define WND_ROLE_INIT           0
+#define WND_ROLE_ROOT           1
+#define WND_ROLE_CLIENT         2
+#define WND_ROLE_CLIENT_IGNORE  3
+#define WND_ROLE_CLIENT_PENDING 4
+#define WND_ROLE_SYNC_ALARM     5      /* link is the client */
+#define WND_DICT_FIND_OP_NONE   0
+#define WND_DICT_FIND_OP_TOUCH  1
+#define WND_DICT_FIND_OP_ERASE  2
 
 
 typedef struct client_class_s *client_class_t;
@@ -88,6 +399,10 @@ typedef struct client_class_s
     const char *(*class_name_get)(client_class_t self);
     
     list_entry_s auto_scan_node;
+    /* bytes of private data kept in the client's own slot, zeroed and
+     * set as client->priv before client_try_attach; 0 if the class
+     * allocates priv itself */
+    size_t       priv_size;
 
     void(*init)(client_class_t self);
     int (*client_try_attach)(client_class_t self, client_t client);
@@ -104,20 +419,497 @@ typedef struct client_class_s
     void(*client_event_reparent_notify)(client_class_t self, client_t client, xcb_reparent_notify_event_t *e);
     void(*client_aevent_focus)(client_class_t self, client_t client);
     void(*client_aevent_blur)(client_class_t self, client_t client);
+    /* a property asked for through client_prop_get has a new value */
+    void(*client_aevent_property)(client_class_t self, client_t client, int prop);
+    /* the client answered the last sync request, or took too long */
+    void(*client_aevent_sync)(client_class_t self, client_t client);
+    /* asked from outside (see ipc.c) to take the outer rect, that of
+     * the container if it has one; may be NULL to refuse */
+    void(*client_move_resize)(client_class_t self, client_t client, rect_t rect);
+    /* take the client back after a restart, in the container the last
+     * process left it in; geom, desktop and mapped are as they were.
+     * May be NULL, the client is then detached and adopted anew */
+    void(*client_resume)(client_class_t self, client_t client, xcb_window_t container);
 } client_class_s;
 
+int  client_priv_reserve(size_t size);
 void client_class_auto_scan_attach(screen_t screen, client_class_t cc);
 void client_class_auto_scan_detach(screen_t screen, client_class_t cc);
+/* Client rules, see rules.c. A new window goes to the class of the
+ * best matching rule first and to the auto scan classes after that.
+ * NULL, WINDOW_TYPE_ANY and RULE_ANY match anything; a higher
+ * priority wins, ties go to the rule added first. Rules are owned by
+ * the caller and must stay put while added. */
+#define RULE_ANY 0
+#define RULE_YES 1
+#define RULE_NO  2
+
+typedef struct client_rule_s *client_rule_t;
+typedef struct client_rule_s
+{
+    const char     *wm_class;
+    const char     *wm_instance;
+    int             window_type;
+    int             transient;
+    int             priority;
+    client_class_t  class;
+
+    /* internal */
+    list_entry_s           rule_node;
+    unsigned long          order;
+    unsigned int           hash;
+    struct client_rule_s  *index_next;
+} client_rule_s;
+
+int            client_rule_add(client_rule_t rule);
+void           client_rule_remove(client_rule_t rule);
+client_class_t client_rule_match(client_t client);
+void           client_rule_cleanup(void);
+
 int  screen_mouse_attach(screen_t screen, mouse_motion_callback_f motion_callback, mouse_release_callback_f release_callback, void *data);
 #define SCREEN_MOUSE_POINTER_ATTACH_ATTACHED 0
 #define SCREEN_MOUSE_POINTER_ATTACH_FAILED   1
 void screen_mouse_detach(screen_t screen);
 void focus_set(client_t client);
+/* WM_DELETE_WINDOW if the client takes it, KillClient otherwise */
+void client_close(client_t client);
+
+/* Virtual desktops. Switching hides the clients of the old desktop
+ * and shows those of the new one in one server grab; DESKTOP_ALL
+ * clients stay. desktop_count is read once, by wm_init. */
+#define DESKTOP_COUNT_DEFAULT 10
+#define DESKTOP_ALL           0xffffffff
+
+extern unsigned int desktop_count;
+
+void desktop_switch(screen_t screen, unsigned int desktop);
+void client_desktop_set(client_t client, unsigned int desktop);
+
+/* _NET_CLIENT_LIST(_STACKING) upkeep, see ewmh.c. Changes are only
+ * recorded; ewmh_flush writes them, once per event batch. */
+void ewmh_init(void);
+void ewmh_client_add(client_t client);
+void ewmh_client_remove(client_t client);
+void ewmh_client_raise(client_t client);
+void ewmh_flush(void);
+void ewmh_cleanup(void);
+
+int       monitor_init(void);
+int       monitor_event(xcb_generic_event_t *e);
+monitor_t monitor_at(screen_t screen, int x, int y);
+void      monitor_cleanup(void);
+void      client_monitor_update(client_t client);
+void      client_monitor_detach(client_t client);
+
+/* Placement of new windows, see place.c. Classes that place their
+ * clients call place_find with the rect they are about to use, if
+ * place_mode is PLACE_MODE_SMART. */
+#define PLACE_MODE_AS_IS 0
+#define PLACE_MODE_SMART 1
+
+extern int place_mode;
+
+int  place_init(void);
+void place_find(client_t client, rect_t rect);
+void place_cleanup(void);
+void client_place_update(client_t client);
+void client_place_detach(client_t client);
+
+/* Key bindings, see keys.c. A binding is on every root, whatever
+ * the state of Lock, NumLock and ScrollLock; keysym is looked for in
+ * the unshifted and shifted columns, so letters are lower case, with
+ * XCB_MOD_MASK_SHIFT in modifiers if wanted. Bindings are owned by the
+ * caller and must stay put while added. */
+typedef void(*key_callback_f)(screen_t screen, void *data);
+
+typedef struct key_binding_s *key_binding_t;
+typedef struct key_binding_s
+{
+    uint16_t       modifiers;
+    xcb_keysym_t   keysym;
+    key_callback_f callback;
+    void          *data;
+
+    /* internal */
+    list_entry_s   binding_node;
+} key_binding_s;
+
+int  keys_init(void);
+void keys_mapping_notify(xcb_mapping_notify_event_t *e);
+void keys_cleanup(void);
+int  key_binding_add(key_binding_t binding);
+void key_binding_remove(key_binding_t binding);
+void key_press(xcb_key_press_event_t *e);
+
+/* _NET_WM_SYNC_REQUEST, see sync.c. A class about to configure a
+ * client calls client_sync_request first; while client_sync_busy it
+ * holds further configures back until client_aevent_sync. Without
+ * USE_XSYNC, or for clients without a counter, a request is never
+ * sent and the client is never busy. */
+#define SYNC_TIMEOUT (100 * 1000000ull)
+
+int  sync_init(void);
+int  sync_event(xcb_generic_event_t *e);
+void sync_cleanup(void);
+void client_sync_attach(client_t client);
+void client_sync_detach(client_t client);
+int  client_sync_request(client_t client);
+static inline int client_sync_busy(client_t client) { return client->sync_busy; }
+
+/* Compositing, see comp.c. Set comp_enabled before wm_init to ask for
+ * it; it reads 0 again unless compositing really started, which needs
+ * a USE_COMPOSITE build. comp_event sees every event before its
+ * handler and returns 1 for the ones that were its own. */
+#define COMP_FRAME_INTERVAL_DEFAULT (1000000000ull / 60)
+
+extern int      comp_enabled;
+extern uint64_t comp_frame_interval;
 
-int  xh_window_geom_get(xcb_window_t window, xcb_window_t *parent, rect_t geom);
+int  comp_init(void);
+int  comp_event(xcb_generic_event_t *e);
+void comp_cleanup(void);
+
+/* Control socket, see ipc.c. Batches of commands come in over a UNIX
+ * socket and are applied in one pass; subscribers are told of clients
+ * coming, going and taking the focus. ipc_flush writes what the
+ * subscribers were told, once per loop iteration. */
+int  ipc_init(void);
+void ipc_flush(void);
+void ipc_cleanup(void);
+void ipc_client_attach(client_t client);
+void ipc_client_detach(client_t client);
+void ipc_focus(client_t client);
+
+/* Hot restart, see restart.c. wm_restart (SIGHUP) stops the loop,
+ * wm_cleanup saves what restart_resumable clients need into a memfd,
+ * and main calls restart_exec; wm_setup of the new process resumes
+ * them through restart_load. */
+#define RESTART_CLASS_NAME_MAX 32
+
+typedef struct restart_screen_s
+{
+    uint32_t root;
+    uint32_t desktop_current;
+    uint32_t focus;             /* client window, or XCB_NONE */
+} restart_screen_s;
+
+typedef struct restart_client_s
+{
+    uint32_t window;
+    uint32_t container;
+    uint32_t transient_for;
+    uint32_t desktop;
+    int32_t  screen;
+    int32_t  window_type;
+    int32_t  mapped;
+    int32_t  desktop_hidden;
+    rect_s   geom[2];
+    char     wm_instance[CLIENT_WM_CLASS_MAX];
+    char     wm_class[CLIENT_WM_CLASS_MAX];
+    char     class_name[RESTART_CLASS_NAME_MAX];
+} restart_client_s;
+
+extern int restart_requested;
+
+void restart_init(char *const *argv);
+int  restart_prepare(void);
+int  restart_save(void);
+int  restart_exec(void);
+int  restart_load(const restart_screen_s **rs, const restart_client_s **rc);
+void restart_done(void);
+
+static inline int
+restart_resumable(client_t client)
+{
+    return client->xcb_container != XCB_NONE && client->class->client_resume != NULL;
+}
+
+/* Property cache. client_prop_get returns the parsed value (a
+ * client_wm_hints_s for WM_HINTS, a uint32_t of CLIENT_PROTOCOL_ bits
+ * for WM_PROTOCOLS, ...) or NULL while it is being fetched; a property
+ * the window does not have reads as zeroes. client_prop_fetch asks for
+ * several at once. */
+void        prop_init(void);
+void        client_prop_attach(client_t client);
+void        client_prop_detach(client_t client);
+void        client_prop_fetch(client_t client, unsigned int mask);
+const void *client_prop_get(client_t client, int prop);
+void        client_prop_changed(client_t client, xcb_atom_t atom, int deleted);
+const char *client_title(client_t client);
+void        prop_flush(void);
+
+
+/* Geometry cache. Rects follow what we configure through
+ * client_configure and what the server reports in ConfigureNotify,
+ * so reading them never costs a round trip. The window rect is
+ * relative to its parent, the container rect to the root. */
+#define CLIENT_GEOM_WINDOW    0
+#define CLIENT_GEOM_CONTAINER 1
+
+int  client_geom_get(client_t client, int which, rect_t rect);
+void client_geom_set(client_t client, int which, rect_t rect);
+void client_container_set(client_t client, xcb_window_t container, rect_t rect);
+void client_configure(client_t client, int which, uint16_t mask, const uint32_t *values);
+
+/* Asynchronous replies: issue a request, hand its sequence to
+ * reply_wait and return. The callback runs from the event loop once
+ * the reply (or error) arrives; both are freed after it returns and
+ * both are NULL if the connection broke meanwhile. */
+typedef void(*reply_callback_f)(void *data, void *reply, xcb_generic_error_t *error);
+
+void reply_wait(unsigned int sequence, reply_callback_f callback, void *data);
+int  reply_process(void);
+void reply_drain(void);
+int  reply_pending(void);
+
+/* Counters kept by the event loop, batch_hist[b] counts batches of
+ * 2^b to 2^(b+1)-1 events */
+#define EVENT_BATCH_HIST 11
+
+typedef struct event_batch_stats_s
+{
+    unsigned long batches;
+    unsigned long events;
+    unsigned long batch_max;
+    unsigned long batch_hist[EVENT_BATCH_HIST];
+    unsigned long flushes;
+    unsigned long coalesced_motion;
+    unsigned long coalesced_configure;
+    unsigned long coalesced_map_pairs;
+} event_batch_stats_s;
+
+extern event_batch_stats_s event_batch_stats;
+
+/* Runtime statistics, see stats.c. Every handled event is counted
+ * per type with its handler time; hist[b] counts handler times below
+ * 2^b ns. round_trips counts the times we blocked on a reply. */
+#define STATS_EVENT_TYPES 128
+#define STATS_HIST        32
+
+typedef struct stats_event_s
+{
+    unsigned long count;
+    uint64_t      ns_total;
+    uint64_t      ns_max;
+    unsigned long hist[STATS_HIST];
+} stats_event_s;
+
+typedef struct stats_s
+{
+    uint64_t      start;
+    unsigned long round_trips;
+    unsigned long replies;
+    unsigned long ewmh_appends;
+    unsigned long ewmh_rewrites;
+    unsigned long prop_fetches;
+    unsigned long prop_refetches;
+    unsigned long sync_requests;
+    unsigned long sync_timeouts;
+    /* compositor frames; ns is the time to issue one, pixels the
+     * area repainted */
+    unsigned long comp_frames;
+    unsigned long comp_bypasses;
+    uint64_t      comp_frame_ns;
+    uint64_t      comp_frame_ns_max;
+    uint64_t      comp_pixels;
+    uint64_t      comp_pixels_last;
+    /* control socket lines, the ops they held and events sent out */
+    unsigned long ipc_batches;
+    unsigned long ipc_ops;
+    unsigned long ipc_events;
+    stats_event_s event[STATS_EVENT_TYPES];
+} stats_s;
+
+extern stats_s stats;
+
+int  stats_init(void);
+void stats_cleanup(void);
+void stats_print(FILE *out, int json);
+
+static inline void
+stats_event(int type, uint64_t ns)
+{
+    stats_event_s *e = &stats.event[type & (STATS_EVENT_TYPES - 1)];
+    int b = ns ? 64 - __builtin_clzll(ns) : 0;
+
+    if (b >= STATS_HIST) b = STATS_HIST - 1;
+    ++ e->count;
+    ++ e->hist[b];
+    e->ns_total += ns;
+    if (ns > e->ns_max) e->ns_max = ns;
+}
+
+/* Pointer motion reaches mouse_motion_callback at most once per
+ * interval (ns), so a drag configures no faster than the display. */
+#define MOUSE_MOTION_INTERVAL_DEFAULT (1000000000ull / 60)
+extern uint64_t mouse_motion_interval;
 
 extern xcb_connection_t *x_conn;
 extern screen_t screens;
 extern int      screen_count;
 
+/* Connection backend, see x.c. Plain requests go to x_conn; whatever
+ * produces an answer, and the requests a model of the server has to
+ * follow, go through the x_* calls below so that the server can be
+ * replaced by a trace (trace.c) or an in-memory model (mock.c). The
+ * request entries may be NULL, the request is then sent to x_conn.
+ * All of them return the sequence number of the request. */
+typedef struct x_backend_s *x_backend_t;
+typedef struct x_backend_s
+{
+    int offline;                /* no server behind x_conn */
+
+    xcb_connection_t    *(*connect)(int *screen);
+    int                  (*connection_error)(void);
+    const xcb_setup_t   *(*get_setup)(void);
+    uint32_t             (*generate_id)(void);
+    xcb_generic_event_t *(*event_next)(int read);
+    void                 (*batch_end)(void);
+    int                  (*reply_poll)(unsigned int sequence, void **reply, xcb_generic_error_t **error);
+    void                *(*reply_wait)(unsigned int sequence, xcb_generic_error_t **error);
+
+    unsigned int (*intern_atom)(const char *name, int name_length);
+    unsigned int (*query_tree)(xcb_window_t window);
+    unsigned int (*get_geometry)(xcb_window_t window);
+    unsigned int (*get_window_attributes)(xcb_window_t window);
+    unsigned int (*get_property)(xcb_window_t window, xcb_atom_t property, xcb_atom_t type, uint32_t long_length);
+    unsigned int (*create_window)(xcb_window_t window, xcb_window_t parent, rect_t rect,
+                                  unsigned int border, xcb_visualid_t visual,
+                                  uint32_t mask, const uint32_t *values);
+    unsigned int (*reparent_window)(xcb_window_t window, xcb_window_t parent, int x, int y);
+    unsigned int (*configure_window)(xcb_window_t window, uint16_t mask, const uint32_t *values);
+    unsigned int (*map_window)(xcb_window_t window);
+    unsigned int (*unmap_window)(xcb_window_t window);
+    unsigned int (*destroy_window)(xcb_window_t window);
+} x_backend_s;
+
+extern x_backend_t x_backend;
+extern x_backend_s x_backend_xcb;
+extern x_backend_s x_backend_replay;
+extern x_backend_s x_backend_mock;
+
+/* In-memory server for benchmarks, see mock.c. mock_use goes before
+ * wm_init; events are 32 bytes and are taken by wm_dispatch. */
+#define MOCK_ROOT   0x00000100
+#define MOCK_WIDTH  1920
+#define MOCK_HEIGHT 1080
+
+void mock_use(void);
+void mock_window_add(xcb_window_t window, xcb_window_t parent, rect_t rect, int override_redirect, int mapped);
+void mock_window_class(xcb_window_t window, const char *instance, const char *class);
+int  mock_window_mapped(xcb_window_t window);
+void mock_event_push(const void *event);
+int  mock_event_pending(void);
+unsigned long mock_requests(void);
+
+static inline xcb_connection_t *x_connect(int *screen) { return x_backend->connect(screen); }
+static inline int x_connection_error(void) { return x_backend->connection_error(); }
+static inline const xcb_setup_t *x_get_setup(void) { return x_backend->get_setup(); }
+static inline uint32_t x_generate_id(void) { return x_backend->generate_id(); }
+static inline xcb_generic_event_t *x_event_next(int read) { return x_backend->event_next(read); }
+static inline void x_batch_end(void) { x_backend->batch_end(); }
+
+static inline int
+x_reply_poll(unsigned int sequence, void **reply, xcb_generic_error_t **error)
+{
+    return x_backend->reply_poll(sequence, reply, error);
+}
+
+static inline void *
+x_reply_wait(unsigned int sequence, xcb_generic_error_t **error)
+{
+    return x_backend->reply_wait(sequence, error);
+}
+
+static inline unsigned int
+x_intern_atom(const char *name, int name_length)
+{
+    if (x_backend->intern_atom) return x_backend->intern_atom(name, name_length);
+    return xcb_intern_atom(x_conn, 0, name_length, name).sequence;
+}
+
+static inline unsigned int
+x_query_tree(xcb_window_t window)
+{
+    if (x_backend->query_tree) return x_backend->query_tree(window);
+    return xcb_query_tree(x_conn, window).sequence;
+}
+
+static inline unsigned int
+x_get_geometry(xcb_window_t window)
+{
+    if (x_backend->get_geometry) return x_backend->get_geometry(window);
+    return xcb_get_geometry(x_conn, window).sequence;
+}
+
+static inline unsigned int
+x_get_property(xcb_window_t window, xcb_atom_t property, xcb_atom_t type, uint32_t long_length)
+{
+    if (x_backend->get_property) return x_backend->get_property(window, property, type, long_length);
+    return xcb_get_property(x_conn, 0, window, property, type, 0, long_length).sequence;
+}
+
+static inline unsigned int
+x_get_window_attributes(xcb_window_t window)
+{
+    if (x_backend->get_window_attributes) return x_backend->get_window_attributes(window);
+    return xcb_get_window_attributes(x_conn, window).sequence;
+}
+
+/* an InputOutput window of the parent's depth */
+static inline unsigned int
+x_create_window(xcb_window_t window, xcb_window_t parent, rect_t rect, unsigned int border,
+                xcb_visualid_t visual, uint32_t mask, const uint32_t *values)
+{
+    if (x_backend->create_window)
+        return x_backend->create_window(window, parent, rect, border, visual, mask, values);
+    return xcb_create_window(x_conn, XCB_COPY_FROM_PARENT, window, parent,
+                             rect->x, rect->y, rect->w, rect->h, border,
+                             XCB_WINDOW_CLASS_INPUT_OUTPUT, visual, mask, values).sequence;
+}
+
+static inline unsigned int
+x_reparent_window(xcb_window_t window, xcb_window_t parent, int x, int y)
+{
+    if (x_backend->reparent_window) return x_backend->reparent_window(window, parent, x, y);
+    return xcb_reparent_window(x_conn, window, parent, x, y).sequence;
+}
+
+static inline unsigned int
+x_configure_window(xcb_window_t window, uint16_t mask, const uint32_t *values)
+{
+    if (x_backend->configure_window) return x_backend->configure_window(window, mask, values);
+    return xcb_configure_window(x_conn, window, mask, values).sequence;
+}
+
+static inline unsigned int
+x_map_window(xcb_window_t window)
+{
+    if (x_backend->map_window) return x_backend->map_window(window);
+    return xcb_map_window(x_conn, window).sequence;
+}
+
+static inline unsigned int
+x_unmap_window(xcb_window_t window)
+{
+    if (x_backend->unmap_window) return x_backend->unmap_window(window);
+    return xcb_unmap_window(x_conn, window).sequence;
+}
+
+static inline unsigned int
+x_destroy_window(xcb_window_t window)
+{
+    if (x_backend->destroy_window) return x_backend->destroy_window(window);
+    return xcb_destroy_window(x_conn, window).sequence;
+}
+
+/* The window manager itself, see base.c; main.c drives it */
+int  wm_init(void);
+int  wm_setup(void);
+void wm_restart(void);
+void wm_dispatch(void);
+void wm_loop(void);
+void wm_replay(void);
+int  wm_cleanup(void);
+
 #endif
@@ -23,6 +23,18 @@ typedef struct cc_simple_data_s
     int      mouse_mode_x;
     int      mouse_mode_y;
     client_t mouse_mode_client;
+
+    /* live resize, the size not sent yet while the client is busy
+     * with the one before */
+    int      resize_pending;
+    uint32_t resize_size[2];
+
+    /* outline mode: drags only move an XOR frame on the root, the
+     * client is configured once on release */
+    int            outline;
+    int            outline_drawn;
+    rect_s         outline_geom;     /* container rect the frame shows */
+    xcb_gcontext_t *outline_gc;      /* per screen, created on first use */
 } cc_simple_data_s;
 
 #define MOUSE_MODE_NORMAL                 0
@@ -36,6 +48,12 @@ scc_init(client_class_t self)
     data->inactive_border_color = screens[0].xcb_screen->black_pixel;
     data->active_border_color   = screens[0].xcb_screen->white_pixel;
     data->mouse_mode = MOUSE_MODE_NORMAL;
+    data->outline_drawn = 0;
+    data->outline_gc = (xcb_gcontext_t *)calloc(screen_count, sizeof(xcb_gcontext_t));
+
+    /* the outline class only gets what client rules hand it */
+    if (data->outline) return;
+
     int i;
     for (i = 0; i < screen_count; ++ i)
         client_class_auto_scan_attach(&screens[i], self);
@@ -43,42 +61,44 @@ scc_init(client_class_t self)
 
 static const char *
 scc_class_name_get(client_class_t self)
-{ return "SimpleClientClass"; }
+{ return ((cc_simple_data_t)self)->outline ? "SimpleOutlineClientClass" : "SimpleClientClass"; }
 
-static int
-scc_client_try_attach(client_class_t self, client_t client)
+/* Draw or erase, it is the same XOR, the frame of outline_geom */
+static void
+scc_outline_toggle(cc_simple_data_t data, screen_t screen)
 {
-    cc_simple_data_t data = (cc_simple_data_t)self;
-    cc_simple_priv_t priv = malloc(sizeof(cc_simple_priv_s));
-    if (priv == NULL)
-        return CLIENT_TRY_ATTACH_FAILED;
-    
-    rect_s geom;
-    client->priv = priv;
-    client->class = self;
+    int id = screen - screens;
+    xcb_gcontext_t gc = data->outline_gc ? data->outline_gc[id] : XCB_NONE;
+    xcb_rectangle_t r;
 
-    xh_window_geom_get(client->xcb_window, NULL, &geom);
+    if (data->outline_gc == NULL) return;
+    if (gc == XCB_NONE)
+    {
+        uint32_t values[] = { XCB_GX_XOR,
+                              screen->xcb_screen->black_pixel ^ screen->xcb_screen->white_pixel,
+                              2,
+                              XCB_SUBWINDOW_MODE_INCLUDE_INFERIORS };
+        gc = data->outline_gc[id] = x_generate_id();
+        xcb_create_gc(x_conn, gc, screen->xcb_screen->root,
+                      XCB_GC_FUNCTION | XCB_GC_FOREGROUND | XCB_GC_LINE_WIDTH |
+                      XCB_GC_SUBWINDOW_MODE, values);
+    }
 
-    priv->mapped = 0;
-    priv->xcb_container = xcb_generate_id(x_conn);
-    uint32_t mask       = XCB_CW_OVERRIDE_REDIRECT | XCB_CW_EVENT_MASK;
-    uint32_t values[]   = { 1,
-                            XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT |
-                            XCB_EVENT_MASK_STRUCTURE_NOTIFY |
-                            XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY };
-    
-    xcb_create_window(x_conn,
-                      XCB_COPY_FROM_PARENT,
-                      priv->xcb_container,
-                      client->screen->xcb_screen->root,
-                      geom.x, geom.y,
-                      geom.w, geom.h,
-                      1,        /* border width */
-                      XCB_WINDOW_CLASS_INPUT_OUTPUT,
-                      client->screen->xcb_screen->root_visual,
-                      mask, values);
-    xcb_reparent_window(x_conn, client->xcb_window, priv->xcb_container, 0, 0);
-    xcb_map_window(x_conn, client->xcb_window);
+    /* the container border included */
+    r.x      = data->outline_geom.x + 1;
+    r.y      = data->outline_geom.y + 1;
+    r.width  = data->outline_geom.w;
+    r.height = data->outline_geom.h;
+    xcb_poly_rectangle(x_conn, screen->xcb_screen->root, gc, 1, &r);
+    data->outline_drawn = !data->outline_drawn;
+}
+
+/* Button grabs, border and dictionary entry of a new container */
+static void
+scc_container_setup(cc_simple_data_t data, client_t client)
+{
+    cc_simple_priv_t priv = client->priv;
+    uint32_t values[1];
 
     xcb_grab_button(x_conn, 0, priv->xcb_container, XCB_EVENT_MASK_BUTTON_PRESS,
                     XCB_GRAB_MODE_SYNC, XCB_GRAB_MODE_SYNC, XCB_NONE, XCB_NONE,
@@ -94,18 +114,79 @@ scc_client_try_attach(client_class_t self, client_t client)
     wnd_dict_node_t node = wnd_dict_find(priv->xcb_container, WND_DICT_FIND_OP_TOUCH);
     node->role = WND_ROLE_CLIENT;
     node->link = client;
+}
+
+static int
+scc_client_try_attach(client_class_t self, client_t client)
+{
+    cc_simple_data_t data = (cc_simple_data_t)self;
+    cc_simple_priv_t priv = client->priv;
+    
+    rect_s geom;
+    client_geom_get(client, CLIENT_GEOM_WINDOW, &geom);
+    client->class = self;
+
+    /* new top level windows go where they overlap others least */
+    if (place_mode == PLACE_MODE_SMART && !client->adopted &&
+        client->window_type == WINDOW_TYPE_NORMAL && client->transient_for == XCB_NONE)
+        place_find(client, &geom);
+
+    priv->mapped = 0;
+    priv->xcb_container = x_generate_id();
+    uint32_t mask       = XCB_CW_OVERRIDE_REDIRECT | XCB_CW_EVENT_MASK;
+    uint32_t values[]   = { 1,
+                            XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT |
+                            XCB_EVENT_MASK_STRUCTURE_NOTIFY |
+                            XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY };
     
+    x_create_window(priv->xcb_container,
+                    client->screen->xcb_screen->root,
+                    &geom,
+                    1,        /* border width */
+                    client->screen->xcb_screen->root_visual,
+                    mask, values);
+    x_reparent_window(client->xcb_window, priv->xcb_container, 0, 0);
+    x_map_window(client->xcb_window);
+
+    client_container_set(client, priv->xcb_container, &geom);
+    geom.x = geom.y = 0;
+    client_geom_set(client, CLIENT_GEOM_WINDOW, &geom);
+
+    scc_container_setup(data, client);
     return CLIENT_TRY_ATTACH_ATTACHED;
 }
 
+static void
+scc_client_resume(client_class_t self, client_t client, xcb_window_t container)
+{
+    cc_simple_data_t data = (cc_simple_data_t)self;
+    cc_simple_priv_t priv = client->priv;
+    uint32_t values[1] = { XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT |
+                           XCB_EVENT_MASK_STRUCTURE_NOTIFY |
+                           XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY };
+
+    client->class = self;
+    priv->xcb_container = container;
+    priv->mapped = client->mapped && !client->desktop_hidden;
+
+    /* what the last process selected went with it */
+    xcb_change_window_attributes(x_conn, container, XCB_CW_EVENT_MASK, values);
+    client_container_set(client, container, NULL);
+    scc_container_setup(data, client);
+}
+
 static void
 scc_client_map(client_class_t self, client_t client)
 {
     cc_simple_priv_t priv = client->priv;
+
+    /* a client that withdrew itself asks again with a MapRequest */
+    x_map_window(client->xcb_window);
+    
     if (priv->mapped) return;
     priv->mapped = 1;
     
-    xcb_map_window(x_conn, priv->xcb_container);
+    x_map_window(priv->xcb_container);
 }
 
 static void
@@ -115,7 +196,7 @@ scc_client_unmap(client_class_t self, client_t client)
     if (priv->mapped == 0) return;
     priv->mapped = 0;
     
-    xcb_unmap_window(x_conn, priv->xcb_container);
+    x_unmap_window(priv->xcb_container);
 }
 
 static void scc_mouse_release_callback(void *__data);
@@ -125,21 +206,46 @@ scc_client_detach(client_class_t self, client_t client, int keep_mapped)
 {
     cc_simple_data_t data = (cc_simple_data_t)self;
     cc_simple_priv_t priv = client->priv;
-    rect_s geom;
 
     if (data->mouse_mode != MOUSE_MODE_NORMAL && data->mouse_mode_client == client)
     {
         scc_mouse_release_callback(data);
     }
-    
-    xh_window_geom_get(priv->xcb_container, NULL, &geom);
-    xcb_reparent_window(x_conn, client->xcb_window, client->screen->xcb_screen->root, geom.x, geom.y);
+
+    rect_s geom;
+    client_geom_get(client, CLIENT_GEOM_CONTAINER, &geom);
+    x_reparent_window(client->xcb_window, client->screen->xcb_screen->root, geom.x, geom.y);
 
     int m = priv->mapped;
     scc_client_unmap(self, client);
     
     wnd_dict_find(priv->xcb_container, WND_DICT_FIND_OP_ERASE);
-    if (m && keep_mapped) xcb_map_window(x_conn, client->xcb_window);
+    x_destroy_window(priv->xcb_container);
+    if (m && keep_mapped) x_map_window(client->xcb_window);
+
+    client_container_set(client, XCB_NONE, NULL);
+    client->priv = NULL;
+}
+
+/* Resize container and client to the pending size, unless the client
+ * has not caught up with the last one */
+static void
+scc_resize_step(cc_simple_data_t data, client_t client)
+{
+    rect_s geom;
+
+    if (!data->resize_pending || client_sync_busy(client)) return;
+    data->resize_pending = 0;
+
+    /* a client asked to sync without a new size would not answer */
+    client_geom_get(client, CLIENT_GEOM_CONTAINER, &geom);
+    if (geom.w == data->resize_size[0] && geom.h == data->resize_size[1]) return;
+
+    client_sync_request(client);
+    client_configure(client, CLIENT_GEOM_CONTAINER,
+                     XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, data->resize_size);
+    client_configure(client, CLIENT_GEOM_WINDOW,
+                     XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, data->resize_size);
 }
 
 static void
@@ -147,7 +253,6 @@ scc_mouse_motion_callback(void *__data, int abs_x, int abs_y)
 {
     cc_simple_data_t data = (cc_simple_data_t)__data;
     client_t client = data->mouse_mode_client;
-    cc_simple_priv_t priv = client->priv;
 
     switch (data->mouse_mode)
     {
@@ -156,8 +261,16 @@ scc_mouse_motion_callback(void *__data, int abs_x, int abs_y)
         uint32_t values[2];
         values[0] = data->mouse_mode_x + abs_x;
         values[1] = data->mouse_mode_y + abs_y;
-        xcb_configure_window(x_conn, priv->xcb_container,
-                             XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y, values);
+        if (data->outline_drawn)
+        {
+            scc_outline_toggle(data, client->screen);
+            data->outline_geom.x = values[0];
+            data->outline_geom.y = values[1];
+            scc_outline_toggle(data, client->screen);
+            break;
+        }
+        client_configure(client, CLIENT_GEOM_CONTAINER,
+                         XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y, values);
         break;
     }
 
@@ -168,8 +281,18 @@ scc_mouse_motion_callback(void *__data, int abs_x, int abs_y)
         int h = data->mouse_mode_y + abs_y;
         values[0] = w < 32 ? 32 : w;
         values[1] = h < 32 ? 32 : h;
-        xcb_configure_window(x_conn, priv->xcb_container,
-                             XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, values);
+        if (data->outline_drawn)
+        {
+            scc_outline_toggle(data, client->screen);
+            data->outline_geom.w = values[0];
+            data->outline_geom.h = values[1];
+            scc_outline_toggle(data, client->screen);
+            break;
+        }
+        data->resize_size[0] = values[0];
+        data->resize_size[1] = values[1];
+        data->resize_pending = 1;
+        scc_resize_step(data, client);
         break;
     }
     
@@ -182,19 +305,39 @@ scc_mouse_release_callback(void *__data)
 {
     cc_simple_data_t data = (cc_simple_data_t)__data;
     client_t client = data->mouse_mode_client;
-    cc_simple_priv_t priv = client->priv;
+
+    if (data->outline_drawn)
+    {
+        /* the one configure of the drag */
+        uint32_t values[4] = { data->outline_geom.x, data->outline_geom.y,
+                               data->outline_geom.w, data->outline_geom.h };
+
+        scc_outline_toggle(data, client->screen);
+        xcb_ungrab_server(x_conn);
+        client_configure(client, CLIENT_GEOM_CONTAINER,
+                         XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+                         XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, values);
+    }
 
     switch (data->mouse_mode)
     {
     case MOUSE_MODE_RESIZE_WINDOW_BY_MOUSE:
     {
-        xcb_get_geometry_reply_t *geom = xcb_get_geometry_reply(x_conn, xcb_get_geometry(x_conn, priv->xcb_container), NULL);
-        uint32_t values[2] = { geom->width, geom->height };
+        rect_s geom;
+
+        /* the last size goes out whether the client caught up or not */
+        if (data->resize_pending)
+        {
+            data->resize_pending = 0;
+            client_configure(client, CLIENT_GEOM_CONTAINER,
+                             XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, data->resize_size);
+        }
 
-        xcb_configure_window(x_conn, client->xcb_window,
-                             XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, values);
+        client_geom_get(client, CLIENT_GEOM_CONTAINER, &geom);
+        uint32_t values[2] = { geom.w, geom.h };
 
-        free(geom);
+        client_configure(client, CLIENT_GEOM_WINDOW,
+                         XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, values);
         /* no break, same as move window mode */
     }
     
@@ -213,7 +356,6 @@ static int
 scc_client_event_button_press(client_class_t self, client_t client, xcb_button_press_event_t *button_press)
 {
     cc_simple_data_t data = (cc_simple_data_t)self;
-    cc_simple_priv_t priv = client->priv;
 
     focus_set(client);
     
@@ -225,21 +367,36 @@ scc_client_event_button_press(client_class_t self, client_t client, xcb_button_p
         data->mouse_mode        = mode;
         data->mouse_mode_client = client;
         
-        xcb_get_geometry_reply_t *geom = xcb_get_geometry_reply(x_conn, xcb_get_geometry(x_conn, priv->xcb_container), NULL);
+        rect_s geom;
+        client_geom_get(client, CLIENT_GEOM_CONTAINER, &geom);
         switch (mode)
         {
         case MOUSE_MODE_MOVE_WINDOW_BY_MOUSE:
-            data->mouse_mode_x = geom->x - button_press->root_x;
-            data->mouse_mode_y = geom->y - button_press->root_y;
+            data->mouse_mode_x = geom.x - button_press->root_x;
+            data->mouse_mode_y = geom.y - button_press->root_y;
             break;
 
         case MOUSE_MODE_RESIZE_WINDOW_BY_MOUSE:
-            data->mouse_mode_x = geom->width - button_press->root_x;
-            data->mouse_mode_y = geom->height - button_press->root_y;
+            data->mouse_mode_x = geom.w - button_press->root_x;
+            data->mouse_mode_y = geom.h - button_press->root_y;
+            data->resize_pending = 0;
+            /* known by the first motion, see client_sync_request */
+            client_prop_fetch(client, CLIENT_PROP_BIT(CLIENT_PROP_PROTOCOLS) |
+                              CLIENT_PROP_BIT(CLIENT_PROP_SYNC_COUNTER));
             break;
         }
-        free(geom);
         
+        /* the frame is drawn over whatever is below, which must hold
+         * still until it is erased; under a compositor the root is
+         * hidden, and without GCs nothing can be drawn, so drag for
+         * real there. Only a drawn frame is ungrabbed on release. */
+        if (data->outline && !comp_enabled && data->outline_gc)
+        {
+            xcb_grab_server(x_conn);
+            data->outline_geom = geom;
+            scc_outline_toggle(data, client->screen);
+        }
+
         screen_mouse_attach(client->screen, scc_mouse_motion_callback, scc_mouse_release_callback, data);
         xcb_allow_events(x_conn, XCB_ALLOW_SYNC_POINTER, button_press->time);
         
@@ -254,7 +411,13 @@ scc_client_event_map_notify(client_class_t self, client_t client, xcb_map_notify
 
 static void
 scc_client_event_unmap_notify(client_class_t self, client_t client, xcb_unmap_notify_event_t *e)
-{ }
+{
+    cc_simple_priv_t priv = client->priv;
+
+    /* the client unmapped its window, don't leave an empty frame */
+    if (e->window == client->xcb_window && e->event == priv->xcb_container)
+        scc_client_unmap(self, client);
+}
 
 static void
 scc_client_event_reparent_notify(client_class_t self, client_t client, xcb_reparent_notify_event_t *e)
@@ -268,12 +431,41 @@ scc_client_aevent_focus(client_class_t self, client_t client)
     cc_simple_priv_t priv = client->priv;
     
     values[0] = XCB_STACK_MODE_ABOVE;
-    xcb_configure_window(x_conn, priv->xcb_container, XCB_CONFIG_WINDOW_STACK_MODE, values);
+    x_configure_window(priv->xcb_container, XCB_CONFIG_WINDOW_STACK_MODE, values);
 
     values[0] = data->active_border_color;
     xcb_change_window_attributes(x_conn, priv->xcb_container, XCB_CW_BORDER_PIXEL, values);
 }
 
+static void
+scc_client_aevent_sync(client_class_t self, client_t client)
+{
+    cc_simple_data_t data = (cc_simple_data_t)self;
+
+    if (data->mouse_mode == MOUSE_MODE_RESIZE_WINDOW_BY_MOUSE && data->mouse_mode_client == client)
+        scc_resize_step(data, client);
+}
+
+static void
+scc_client_move_resize(client_class_t self, client_t client, rect_t rect)
+{
+    cc_simple_data_t data = (cc_simple_data_t)self;
+    rect_s geom;
+
+    /* the mouse has it */
+    if (data->mouse_mode != MOUSE_MODE_NORMAL && data->mouse_mode_client == client)
+        return;
+
+    client_geom_get(client, CLIENT_GEOM_CONTAINER, &geom);
+    uint32_t values[4] = { rect->x, rect->y, rect->w, rect->h };
+    client_configure(client, CLIENT_GEOM_CONTAINER,
+                     XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+                     XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, values);
+    if (geom.w != rect->w || geom.h != rect->h)
+        client_configure(client, CLIENT_GEOM_WINDOW,
+                         XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT, values + 2);
+}
+
 static void
 scc_client_aevent_blur(client_class_t self, client_t client)
 {
@@ -285,23 +477,38 @@ scc_client_aevent_blur(client_class_t self, client_t client)
     xcb_change_window_attributes(x_conn, priv->xcb_container, XCB_CW_BORDER_PIXEL, values);
 }
 
+/* both classes are this one table, so a hook cannot go to just one */
+#define SCC_INTERFACE                                                   \
+    {                                                                   \
+        .init                         = scc_init,                       \
+        .class_name_get               = scc_class_name_get,             \
+        .priv_size                    = sizeof(cc_simple_priv_s),       \
+        .client_try_attach            = scc_client_try_attach,          \
+        .client_map                   = scc_client_map,                 \
+        .client_unmap                 = scc_client_unmap,               \
+        .client_detach                = scc_client_detach,              \
+        .client_event_button_press    = scc_client_event_button_press,  \
+        .client_event_map_notify      = scc_client_event_map_notify,    \
+        .client_event_unmap_notify    = scc_client_event_unmap_notify,  \
+        .client_event_reparent_notify = scc_client_event_reparent_notify, \
+        .client_aevent_focus          = scc_client_aevent_focus,        \
+        .client_aevent_blur           = scc_client_aevent_blur,         \
+        .client_aevent_sync           = scc_client_aevent_sync,         \
+        .client_move_resize           = scc_client_move_resize,         \
+        .client_resume                = scc_client_resume,              \
+    }
+
 cc_simple_data_s __cc_simple = 
 {
-    .interface = 
-    {
-        .init                         = scc_init,
-        .class_name_get               = scc_class_name_get,
-        .client_try_attach            = scc_client_try_attach,
-        .client_map                   = scc_client_map,
-        .client_unmap                 = scc_client_unmap,
-        .client_detach                = scc_client_detach,
-        .client_event_button_press    = scc_client_event_button_press,
-        .client_event_map_notify      = scc_client_event_map_notify,
-        .client_event_unmap_notify    = scc_client_event_unmap_notify,
-        .client_event_reparent_notify = scc_client_event_reparent_notify,
-        .client_aevent_focus          = scc_client_aevent_focus,
-        .client_aevent_blur           = scc_client_aevent_blur,
-    },
+    .interface = SCC_INTERFACE,
 };
 
 client_class_t cc_simple = (client_class_t)&__cc_simple;
+
+cc_simple_data_s __cc_simple_outline = 
+{
+    .interface = SCC_INTERFACE,
+    .outline = 1,
+};
+
+client_class_t cc_simple_outline = (client_class_t)&__cc_simple_outline;
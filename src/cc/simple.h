@@ -2,5 +2,8 @@
 #define __WM_CC_SIMPLE_H__
 
 extern client_class_t cc_simple;
+/* the same, but moves and resizes with an outline; it attaches only
+ * the clients a rule gives it */
+extern client_class_t cc_simple_outline;
 
 #endif
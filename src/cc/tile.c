@@ -0,0 +1,473 @@
+#include "../base.h"
+#include "tile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Tiling client class.
+ *
+ * Each desktop of each screen keeps a binary layout tree, and windows
+ * on all desktops one of their own laid over it: leaves are clients,
+ * inner nodes split their rectangle side by side or one above the
+ * other. A desktop switch only unmaps and maps windows, the trees stay
+ * as they are, so a desktop comes back as it was left.
+ * A new window splits the focused leaf, or if the focus is not tiled
+ * a leaf of the emptier side all the way down; a leaving one hands its space
+ * to its sibling, and a drag moves the split of the window's parent.
+ *
+ * Every node remembers the rectangle it was last laid out in and a
+ * subtree whose rectangle did not change is not visited, so a change
+ * only touches the windows that actually move. Those are collected and
+ * configured together at the end of the change.
+ *
+ * Only normal, non-transient windows are tiled; everything else is
+ * left to the classes after this one. */
+
+#define TILE_BORDER       1
+#define TILE_RATIO_SCALE  1000
+#define TILE_RATIO_MIN    50
+#define TILE_SPLIT_CHUNK  64
+
+#define TILE_LEAF    0
+#define TILE_SPLIT_H 1          /* children side by side */
+#define TILE_SPLIT_V 2          /* children one above the other */
+
+typedef struct tile_node_s *tile_node_t;
+typedef struct tile_node_s
+{
+    int          type;
+    int          ratio;         /* share of child[0], per TILE_RATIO_SCALE */
+    int          leaves;        /* in this subtree */
+    rect_s       rect;          /* last layout, all zero if never laid out */
+    tile_node_t  parent;
+    tile_node_t  child[2];
+    client_t     client;        /* leaves */
+    tile_node_t  dirty_next;    /* leaves waiting for their configure */
+    int          dirty;
+} tile_node_s;
+
+typedef struct cc_tile_priv_s *cc_tile_priv_t;
+typedef struct cc_tile_priv_s
+{
+    tile_node_s leaf;           /* first, leaves are cast back to this */
+    int         mapped;         /* in the layout */
+    tile_node_t *tree;          /* the root of that layout */
+} cc_tile_priv_s;
+
+typedef struct cc_tile_data_s *cc_tile_data_t;
+typedef struct cc_tile_data_s
+{
+    client_class_s interface;
+
+    uint32_t inactive_border_color;
+    uint32_t active_border_color;
+
+    tile_node_t   *roots;       /* desktop_count + 1 per screen */
+    pool_s         split_pool;
+    tile_node_t    dirty;
+
+    client_t       resize_client;
+} cc_tile_data_s;
+
+static void
+tile_init(client_class_t self)
+{
+    cc_tile_data_t data = (cc_tile_data_t)self;
+    int i;
+
+    data->inactive_border_color = screens[0].xcb_screen->black_pixel;
+    data->active_border_color   = screens[0].xcb_screen->white_pixel;
+    data->roots = (tile_node_t *)calloc(screen_count * (desktop_count + 1), sizeof(tile_node_t));
+    data->dirty   = NULL;
+    data->resize_client = NULL;
+    pool_init(&data->split_pool, "tile", sizeof(tile_node_s), TILE_SPLIT_CHUNK);
+
+    for (i = 0; i < screen_count; ++ i)
+        client_class_auto_scan_attach(&screens[i], self);
+}
+
+static const char *
+tile_class_name_get(client_class_t self)
+{ return "TileClientClass"; }
+
+static inline int
+__rect_equal(rect_t a, rect_t b)
+{
+    return a->x == b->x && a->y == b->y && a->w == b->w && a->h == b->h;
+}
+
+/* Lay node out in rect. Subtrees that keep their rectangle are skipped
+ * unless forced, which a node whose split or children changed is. */
+static void
+__layout(cc_tile_data_t data, tile_node_t node, rect_t rect, int force)
+{
+    if (!force && __rect_equal(&node->rect, rect))
+        return;
+    node->rect = *rect;
+
+    if (node->type == TILE_LEAF)
+    {
+        if (!node->dirty)
+        {
+            node->dirty = 1;
+            node->dirty_next = data->dirty;
+            data->dirty = node;
+        }
+        return;
+    }
+
+    rect_s a = *rect, b = *rect;
+    if (node->type == TILE_SPLIT_H)
+    {
+        a.w = rect->w * node->ratio / TILE_RATIO_SCALE;
+        b.x = rect->x + a.w;
+        b.w = rect->w - a.w;
+    }
+    else
+    {
+        a.h = rect->h * node->ratio / TILE_RATIO_SCALE;
+        b.y = rect->y + a.h;
+        b.h = rect->h - a.h;
+    }
+
+    __layout(data, node->child[0], &a, 0);
+    __layout(data, node->child[1], &b, 0);
+}
+
+/* One configure per moved window, issued back to back */
+static void
+__flush(cc_tile_data_t data)
+{
+    while (data->dirty)
+    {
+        tile_node_t leaf = data->dirty;
+        data->dirty = leaf->dirty_next;
+        leaf->dirty = 0;
+
+        /* a leaf taken out meanwhile has no place to go */
+        if (!((cc_tile_priv_t)leaf)->mapped)
+            continue;
+
+        int w = leaf->rect.w - 2 * TILE_BORDER;
+        int h = leaf->rect.h - 2 * TILE_BORDER;
+        uint32_t values[5] = { leaf->rect.x, leaf->rect.y,
+                               w < 1 ? 1 : w, h < 1 ? 1 : h, TILE_BORDER };
+
+        client_configure(leaf->client, CLIENT_GEOM_WINDOW,
+                         XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y |
+                         XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT |
+                         XCB_CONFIG_WINDOW_BORDER_WIDTH, values);
+    }
+}
+
+/* the tree of the client's screen and desktop, as it is now */
+static inline tile_node_t *
+__tree(cc_tile_data_t data, client_t client)
+{
+    return &data->roots[(client->screen - screens) * (desktop_count + 1) +
+                        (client->desktop == DESKTOP_ALL ? desktop_count : client->desktop)];
+}
+
+static void
+__screen_rect(client_t client, rect_t rect)
+{
+    rect->x = rect->y = 0;
+    rect->w = client->screen->xcb_screen->width_in_pixels;
+    rect->h = client->screen->xcb_screen->height_in_pixels;
+}
+
+/* descend into the child with fewer windows, which keeps the tree
+ * balanced when windows arrive without focus to guide them */
+static tile_node_t
+__emptiest(tile_node_t node)
+{
+    while (node->type != TILE_LEAF)
+        node = node->child[node->child[1]->leaves < node->child[0]->leaves];
+    return node;
+}
+
+static void
+__count(tile_node_t node, int delta)
+{
+    for (; node; node = node->parent)
+        node->leaves += delta;
+}
+
+static void
+__insert(cc_tile_data_t data, client_t client)
+{
+    cc_tile_priv_t priv = client->priv;
+    tile_node_t *tree = __tree(data, client);
+    tile_node_t leaf = &priv->leaf, target = NULL;
+    client_t focus = client->screen->focus;
+    rect_s rect;
+
+    priv->mapped = 1;
+    priv->tree   = tree;
+    leaf->type   = TILE_LEAF;
+    leaf->leaves = 1;
+    leaf->parent = NULL;
+    leaf->client = client;
+    leaf->rect.x = leaf->rect.y = leaf->rect.w = leaf->rect.h = 0;
+
+    if (focus && focus->class == client->class &&
+        ((cc_tile_priv_t)focus->priv)->mapped && ((cc_tile_priv_t)focus->priv)->tree == tree)
+        target = &((cc_tile_priv_t)focus->priv)->leaf;
+    else if (*tree)
+        target = __emptiest(*tree);
+
+    if (target == NULL)
+    {
+        *tree = leaf;
+        __screen_rect(client, &rect);
+        __layout(data, leaf, &rect, 1);
+    }
+    else
+    {
+        tile_node_t split = (tile_node_t)pool_alloc(&data->split_pool);
+        if (split == NULL)
+        {
+            priv->mapped = 0;
+            return;
+        }
+
+        split->type     = target->rect.w >= target->rect.h ? TILE_SPLIT_H : TILE_SPLIT_V;
+        split->ratio    = TILE_RATIO_SCALE / 2;
+        split->leaves   = target->leaves;
+        split->rect     = target->rect;
+        split->parent   = target->parent;
+        split->child[0] = target;
+        split->child[1] = leaf;
+        split->client   = NULL;
+        split->dirty    = 0;
+
+        if (target->parent)
+            target->parent->child[target->parent->child[1] == target] = split;
+        else *tree = split;
+        target->parent = split;
+        leaf->parent   = split;
+        __count(split, 1);
+
+        rect = split->rect;
+        __layout(data, split, &rect, 1);
+    }
+}
+
+static void
+__remove(cc_tile_data_t data, client_t client)
+{
+    cc_tile_priv_t priv = client->priv;
+    tile_node_t leaf = &priv->leaf, split = leaf->parent;
+
+    priv->mapped = 0;
+
+    if (split == NULL)
+    {
+        *priv->tree = NULL;
+        return;
+    }
+
+    __count(split->parent, -1);
+
+    /* the sibling takes the place, and the space, of the split */
+    tile_node_t sibling = split->child[split->child[0] == leaf];
+    sibling->parent = split->parent;
+    if (split->parent)
+        split->parent->child[split->parent->child[1] == split] = sibling;
+    else *priv->tree = sibling;
+
+    rect_s rect = split->rect;
+    leaf->parent = NULL;
+    pool_free(&data->split_pool, split);
+
+    __layout(data, sibling, &rect, 0);
+}
+
+static int
+tile_client_try_attach(client_class_t self, client_t client)
+{
+    cc_tile_data_t data = (cc_tile_data_t)self;
+    cc_tile_priv_t priv = client->priv;
+
+    if (client->window_type != WINDOW_TYPE_NORMAL || client->transient_for != XCB_NONE)
+        return CLIENT_TRY_ATTACH_FAILED;
+
+    client->class = self;
+    priv->mapped  = 0;
+    priv->leaf.dirty = 0;
+
+    uint32_t values[1] = { data->inactive_border_color };
+    xcb_change_window_attributes(x_conn, client->xcb_window, XCB_CW_BORDER_PIXEL, values);
+
+    xcb_grab_button(x_conn, 0, client->xcb_window, XCB_EVENT_MASK_BUTTON_PRESS,
+                    XCB_GRAB_MODE_SYNC, XCB_GRAB_MODE_SYNC, XCB_NONE, XCB_NONE,
+                    XCB_BUTTON_INDEX_1, XCB_MOD_MASK_ANY);
+
+    xcb_grab_button(x_conn, 0, client->xcb_window, XCB_EVENT_MASK_BUTTON_PRESS,
+                    XCB_GRAB_MODE_SYNC, XCB_GRAB_MODE_SYNC, XCB_NONE, XCB_NONE,
+                    XCB_BUTTON_INDEX_3, XCB_MOD_MASK_ANY);
+
+    return CLIENT_TRY_ATTACH_ATTACHED;
+}
+
+static void
+tile_client_map(client_class_t self, client_t client)
+{
+    cc_tile_data_t data = (cc_tile_data_t)self;
+    cc_tile_priv_t priv = client->priv;
+
+    /* moved to another desktop while it was hidden */
+    if (priv->mapped && priv->tree != __tree(data, client))
+        __remove(data, client);
+    if (!priv->mapped)
+        __insert(data, client);
+    __flush(data);
+    x_map_window(client->xcb_window);
+}
+
+static void
+tile_client_unmap(client_class_t self, client_t client)
+{
+    cc_tile_data_t data = (cc_tile_data_t)self;
+    cc_tile_priv_t priv = client->priv;
+
+    if (!priv->mapped) return;
+
+    /* hidden with its desktop, it keeps its place there */
+    if (client->desktop_hidden && priv->tree == __tree(data, client))
+    {
+        client->unmap_seq = x_unmap_window(client->xcb_window);
+        return;
+    }
+
+    __remove(data, client);
+    client->unmap_seq = x_unmap_window(client->xcb_window);
+    __flush(data);
+}
+
+static void tile_mouse_release_callback(void *__data);
+
+static void
+tile_client_detach(client_class_t self, client_t client, int keep_mapped)
+{
+    cc_tile_data_t data = (cc_tile_data_t)self;
+    cc_tile_priv_t priv = client->priv;
+
+    if (data->resize_client == client)
+        tile_mouse_release_callback(data);
+
+    if (priv->mapped)
+    {
+        __remove(data, client);
+        __flush(data);
+    }
+    client->priv = NULL;
+}
+
+static void
+tile_mouse_motion_callback(void *__data, int abs_x, int abs_y)
+{
+    cc_tile_data_t data = (cc_tile_data_t)__data;
+    client_t client = data->resize_client;
+    cc_tile_priv_t priv = client->priv;
+    tile_node_t split = priv->leaf.parent;
+    int ratio;
+
+    if (split == NULL) return;
+
+    if (split->type == TILE_SPLIT_H)
+        ratio = split->rect.w ? (abs_x - split->rect.x) * TILE_RATIO_SCALE / split->rect.w : 0;
+    else
+        ratio = split->rect.h ? (abs_y - split->rect.y) * TILE_RATIO_SCALE / split->rect.h : 0;
+
+    if (ratio < TILE_RATIO_MIN) ratio = TILE_RATIO_MIN;
+    if (ratio > TILE_RATIO_SCALE - TILE_RATIO_MIN) ratio = TILE_RATIO_SCALE - TILE_RATIO_MIN;
+    if (ratio == split->ratio) return;
+
+    split->ratio = ratio;
+    rect_s rect = split->rect;
+    __layout(data, split, &rect, 1);
+    __flush(data);
+}
+
+static void
+tile_mouse_release_callback(void *__data)
+{
+    cc_tile_data_t data = (cc_tile_data_t)__data;
+
+    if (data->resize_client == NULL) return;
+    screen_mouse_detach(data->resize_client->screen);
+    data->resize_client = NULL;
+}
+
+static int
+tile_client_event_button_press(client_class_t self, client_t client, xcb_button_press_event_t *button_press)
+{
+    cc_tile_data_t data = (cc_tile_data_t)self;
+    cc_tile_priv_t priv = client->priv;
+
+    focus_set(client);
+
+    /* Mod1 + button 3 drags the split this window sits in */
+    if ((button_press->state & XCB_MOD_MASK_1) &&
+        button_press->detail == XCB_BUTTON_INDEX_3 && priv->leaf.parent)
+    {
+        data->resize_client = client;
+        screen_mouse_attach(client->screen, tile_mouse_motion_callback, tile_mouse_release_callback, data);
+        xcb_allow_events(x_conn, XCB_ALLOW_SYNC_POINTER, button_press->time);
+        return CLIENT_INPUT_CATCHED;
+    }
+    return CLIENT_INPUT_PASS_THROUGH;
+}
+
+static void
+tile_client_event_unmap_notify(client_class_t self, client_t client, xcb_unmap_notify_event_t *e)
+{
+    cc_tile_data_t data = (cc_tile_data_t)self;
+    cc_tile_priv_t priv = client->priv;
+
+    /* the client withdrew, as base.c tells our own unmaps apart */
+    if (e->window == client->xcb_window && priv->mapped && !client->mapped)
+    {
+        __remove(data, client);
+        __flush(data);
+    }
+}
+
+static void
+tile_client_aevent_focus(client_class_t self, client_t client)
+{
+    cc_tile_data_t data = (cc_tile_data_t)self;
+    uint32_t values[1] = { data->active_border_color };
+
+    xcb_change_window_attributes(x_conn, client->xcb_window, XCB_CW_BORDER_PIXEL, values);
+}
+
+static void
+tile_client_aevent_blur(client_class_t self, client_t client)
+{
+    cc_tile_data_t data = (cc_tile_data_t)self;
+    uint32_t values[1] = { data->inactive_border_color };
+
+    xcb_change_window_attributes(x_conn, client->xcb_window, XCB_CW_BORDER_PIXEL, values);
+}
+
+cc_tile_data_s __cc_tile =
+{
+    .interface =
+    {
+        .init                         = tile_init,
+        .class_name_get               = tile_class_name_get,
+        .priv_size                    = sizeof(cc_tile_priv_s),
+        .client_try_attach            = tile_client_try_attach,
+        .client_map                   = tile_client_map,
+        .client_unmap                 = tile_client_unmap,
+        .client_detach                = tile_client_detach,
+        .client_event_button_press    = tile_client_event_button_press,
+        .client_event_unmap_notify    = tile_client_event_unmap_notify,
+        .client_aevent_focus          = tile_client_aevent_focus,
+        .client_aevent_blur           = tile_client_aevent_blur,
+    },
+};
+
+client_class_t cc_tile = (client_class_t)&__cc_tile;
@@ -0,0 +1,6 @@
+#ifndef __WM_CC_TILE_H__
+#define __WM_CC_TILE_H__
+
+extern client_class_t cc_tile;
+
+#endif
@@ -0,0 +1,839 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "base.h"
+
+#ifdef USE_COMPOSITE
+#include <xcb/composite.h>
+#include <xcb/damage.h>
+#include <xcb/xfixes.h>
+#include <xcb/render.h>
+#include <xcb/shape.h>
+#endif
+
+/* Compositing.
+ *
+ * Built with USE_COMPOSITE and turned on with comp_enabled, every
+ * child of the first root, containers as well as frameless and
+ * override redirect windows, is redirected offscreen and painted
+ * here into a back buffer, which is then copied to the overlay.
+ *
+ * Damage is kept client side as at most COMP_DAMAGE_RECTS disjoint
+ * rects: window contents report their bounding box through Damage,
+ * maps, unmaps and moves add the old and the new extents. A frame is
+ * painted at most once per comp_frame_interval, clipped to the union,
+ * and only windows that touch it are composited.
+ *
+ * An opaque window on top covering the whole root is left to paint
+ * itself: redirection is undone and the overlay given back until
+ * something else shows again.
+ *
+ * As with RandR, nothing is done offline or while recording. */
+
+int      comp_enabled        = 0;
+uint64_t comp_frame_interval = COMP_FRAME_INTERVAL_DEFAULT;
+
+#ifdef USE_COMPOSITE
+
+#define COMP_HASH         256
+#define COMP_DAMAGE_RECTS 16
+
+typedef struct comp_win_s *comp_win_t;
+typedef struct comp_win_s
+{
+    xcb_window_t            window;
+    rect_s                  geom;       /* outer, border included */
+    uint8_t                 mapped;
+    uint8_t                 known;      /* attributes are in */
+    uint8_t                 input_only;
+    uint8_t                 alpha;
+    uint8_t                 damaged;    /* reported since the last subtract */
+    xcb_render_pictformat_t format;
+    xcb_damage_damage_t     damage;
+    xcb_pixmap_t            pixmap;     /* named, renamed after a resize */
+    xcb_render_picture_t    picture;
+    list_entry_s            hash_node;
+    list_entry_s            stack_node;
+} comp_win_s;
+
+typedef struct comp_format_s
+{
+    xcb_visualid_t          visual;
+    xcb_render_pictformat_t format;
+    int                     alpha;
+} comp_format_s;
+
+static pool_s       win_pool;
+static list_entry_s win_hash[COMP_HASH];
+static list_entry_s stack;              /* bottom to top */
+
+static comp_format_s *formats      = NULL;
+static int            format_count = 0;
+
+static screen_t             comp_screen = NULL;
+static int                  comp_failed = 0;
+static int                  damage_event_base = -1;
+static int                  bypass = 0;
+static xcb_window_t         overlay = XCB_NONE;
+static xcb_render_picture_t overlay_picture = XCB_NONE;
+static xcb_pixmap_t         buffer = XCB_NONE;
+static xcb_render_picture_t buffer_picture = XCB_NONE;
+static xcb_xfixes_region_t  clip = XCB_NONE;
+static xcb_render_pictformat_t root_format = XCB_NONE;
+
+static rect_s    damage[COMP_DAMAGE_RECTS];
+static int       damage_count = 0;
+static timeout_s frame_timer;
+static int       frame_pending = 0;
+static uint64_t  frame_last = 0;
+
+static inline list_entry_t
+__bucket(xcb_window_t window)
+{
+    return &win_hash[(window * 0x9e3779b1u) >> 24 & (COMP_HASH - 1)];
+}
+
+static comp_win_t
+__find(xcb_window_t window)
+{
+    list_entry_t head = __bucket(window), cur;
+
+    for (cur = list_next(head); cur != head; cur = list_next(cur))
+    {
+        comp_win_t w = CONTAINER_OF(cur, comp_win_s, hash_node);
+        if (w->window == window) return w;
+    }
+    return NULL;
+}
+
+static const comp_format_s *
+__format(xcb_visualid_t visual)
+{
+    int i;
+
+    for (i = 0; i < format_count; ++ i)
+        if (formats[i].visual == visual) return &formats[i];
+    return NULL;
+}
+
+static inline int
+__overlap(const rect_s *a, const rect_s *b)
+{
+    return a->x < b->x + (int)b->w && b->x < a->x + (int)a->w &&
+        a->y < b->y + (int)b->h && b->y < a->y + (int)a->h;
+}
+
+static inline rect_s
+__bbox(const rect_s *a, const rect_s *b)
+{
+    rect_s r;
+    int x1 = a->x + (int)a->w > b->x + (int)b->w ? a->x + (int)a->w : b->x + (int)b->w;
+    int y1 = a->y + (int)a->h > b->y + (int)b->h ? a->y + (int)a->h : b->y + (int)b->h;
+
+    r.x = a->x < b->x ? a->x : b->x;
+    r.y = a->y < b->y ? a->y : b->y;
+    r.w = x1 - r.x;
+    r.h = y1 - r.y;
+    return r;
+}
+
+static void __frame(void *data);
+
+static void
+__schedule(void)
+{
+    uint64_t now, due;
+
+    if (frame_pending || bypass || overlay_picture == XCB_NONE) return;
+
+    now = time_now_ns();
+    due = frame_last + comp_frame_interval;
+    timeout_add(&frame_timer, due > now ? due - now : 0);
+    frame_pending = 1;
+}
+
+/* Add a rect in root coordinates to the damage. Overlapping rects are
+ * merged into their bounding box; when all slots are taken the pair
+ * growing least is merged. */
+static void
+__damage_add(int x, int y, int w, int h)
+{
+    int x1 = x + w, y1 = y + h;
+    int width  = comp_screen->xcb_screen->width_in_pixels;
+    int height = comp_screen->xcb_screen->height_in_pixels;
+    rect_s r;
+    int i;
+
+    if (bypass) return;
+
+    if (x < 0) x = 0;
+    if (y < 0) y = 0;
+    if (x1 > width)  x1 = width;
+    if (y1 > height) y1 = height;
+    if (x1 <= x || y1 <= y) return;
+
+    r.x = x;
+    r.y = y;
+    r.w = x1 - x;
+    r.h = y1 - y;
+
+    for (i = 0; i < damage_count; )
+    {
+        if (__overlap(&damage[i], &r))
+        {
+            r = __bbox(&damage[i], &r);
+            damage[i] = damage[-- damage_count];
+            i = 0;
+        }
+        else ++ i;
+
+        if (i == damage_count && damage_count == COMP_DAMAGE_RECTS)
+        {
+            uint64_t best = UINT64_MAX;
+            int j, k = 0;
+
+            for (j = 0; j < damage_count; ++ j)
+            {
+                rect_s b = __bbox(&damage[j], &r);
+                uint64_t grow = (uint64_t)b.w * b.h - (uint64_t)damage[j].w * damage[j].h;
+                if (grow < best)
+                {
+                    best = grow;
+                    k = j;
+                }
+            }
+            r = __bbox(&damage[k], &r);
+            damage[k] = damage[-- damage_count];
+            i = 0;
+        }
+    }
+
+    damage[damage_count ++] = r;
+    __schedule();
+}
+
+static inline void
+__damage_win(comp_win_t w)
+{
+    if (w->mapped) __damage_add(w->geom.x, w->geom.y, w->geom.w, w->geom.h);
+}
+
+static void
+__win_release(comp_win_t w)
+{
+    if (w->picture != XCB_NONE)
+    {
+        xcb_render_free_picture(x_conn, w->picture);
+        w->picture = XCB_NONE;
+    }
+    if (w->pixmap != XCB_NONE)
+    {
+        xcb_free_pixmap(x_conn, w->pixmap);
+        w->pixmap = XCB_NONE;
+    }
+}
+
+static void
+__win_track(comp_win_t w)
+{
+    if (!w->mapped || !w->known || w->input_only || w->damage != XCB_NONE)
+        return;
+
+    w->damage = x_generate_id();
+    xcb_damage_create(x_conn, w->damage, w->window, XCB_DAMAGE_REPORT_LEVEL_BOUNDING_BOX);
+}
+
+static comp_win_t
+__win_add(xcb_window_t window, int x, int y, int w, int h, int border)
+{
+    comp_win_t cw = __find(window);
+
+    if (cw == NULL)
+    {
+        cw = (comp_win_t)pool_alloc(&win_pool);
+        if (cw == NULL) return NULL;
+        memset(cw, 0, sizeof(comp_win_s));
+        cw->window = window;
+        list_add_before(__bucket(window), &cw->hash_node);
+    }
+    else list_del(&cw->stack_node);
+
+    cw->geom.x = x;
+    cw->geom.y = y;
+    cw->geom.w = w + 2 * border;
+    cw->geom.h = h + 2 * border;
+    list_add_before(&stack, &cw->stack_node);
+    return cw;
+}
+
+static void
+__win_remove(comp_win_t w, int destroyed)
+{
+    __damage_win(w);
+    __win_release(w);
+    /* a destroyed window took its damage with it */
+    if (!destroyed && w->damage != XCB_NONE)
+        xcb_damage_destroy(x_conn, w->damage);
+
+    list_del(&w->hash_node);
+    list_del(&w->stack_node);
+    pool_free(&win_pool, w);
+}
+
+static void
+__attr_apply(xcb_window_t window, xcb_get_window_attributes_reply_t *r, int setup)
+{
+    comp_win_t w = __find(window);
+    const comp_format_s *f;
+
+    if (w == NULL) return;
+
+    w->known = 1;
+    if (r == NULL || r->_class == XCB_WINDOW_CLASS_INPUT_ONLY ||
+        (f = __format(r->visual)) == NULL)
+    {
+        w->input_only = 1;
+        return;
+    }
+
+    w->format = f->format;
+    w->alpha  = f->alpha;
+    if (setup) w->mapped = r->map_state == XCB_MAP_STATE_VIEWABLE;
+    __win_track(w);
+    __damage_win(w);
+}
+
+static void
+__attr_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    __attr_apply((intptr_t)data, (xcb_get_window_attributes_reply_t *)reply, 0);
+}
+
+static void
+__setup_attr_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    __attr_apply((intptr_t)data, (xcb_get_window_attributes_reply_t *)reply, 1);
+}
+
+static void
+__geom_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    xcb_get_geometry_reply_t *r = (xcb_get_geometry_reply_t *)reply;
+    comp_win_t w = __find((intptr_t)data);
+
+    if (w == NULL || r == NULL) return;
+
+    __damage_win(w);
+    w->geom.x = r->x;
+    w->geom.y = r->y;
+    w->geom.w = r->width + 2 * r->border_width;
+    w->geom.h = r->height + 2 * r->border_width;
+    __win_release(w);
+    __damage_win(w);
+}
+
+/* A window we learn of by its id only */
+static void
+__win_query(xcb_window_t window, int setup)
+{
+    if (__win_add(window, 0, 0, 0, 0, 0) == NULL) return;
+
+    reply_wait(xcb_get_geometry(x_conn, window).sequence, __geom_cb, (void *)(intptr_t)window);
+    reply_wait(xcb_get_window_attributes(x_conn, window).sequence,
+               setup ? __setup_attr_cb : __attr_cb, (void *)(intptr_t)window);
+}
+
+static void
+__tree_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    xcb_query_tree_reply_t *r = (xcb_query_tree_reply_t *)reply;
+    xcb_window_t *children;
+    int i, n;
+
+    if (r == NULL) return;
+
+    /* bottom to top, like the stack */
+    children = xcb_query_tree_children(r);
+    n = xcb_query_tree_children_length(r);
+    for (i = 0; i < n; ++ i)
+        if (children[i] != overlay) __win_query(children[i], 1);
+}
+
+static void
+__overlay_set(xcb_window_t window)
+{
+    xcb_xfixes_region_t none = x_generate_id();
+
+    overlay = window;
+
+    /* input goes through to the windows below */
+    xcb_xfixes_create_region(x_conn, none, 0, NULL);
+    xcb_xfixes_set_window_shape_region(x_conn, overlay, XCB_SHAPE_SK_INPUT, 0, 0, none);
+    xcb_xfixes_destroy_region(x_conn, none);
+
+    overlay_picture = x_generate_id();
+    xcb_render_create_picture(x_conn, overlay_picture, overlay, root_format, 0, NULL);
+
+    __damage_add(0, 0, comp_screen->xcb_screen->width_in_pixels,
+                 comp_screen->xcb_screen->height_in_pixels);
+}
+
+static void
+__overlay_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    xcb_composite_get_overlay_window_reply_t *r = (xcb_composite_get_overlay_window_reply_t *)reply;
+
+    /* gone into bypass meanwhile, the overlay was given back */
+    if (r == NULL || bypass) return;
+    __overlay_set(r->overlay_win);
+}
+
+static void
+__redirect(void)
+{
+    xcb_window_t root = comp_screen->xcb_screen->root;
+
+    xcb_composite_redirect_subwindows(x_conn, root, XCB_COMPOSITE_REDIRECT_MANUAL);
+    reply_wait(xcb_composite_get_overlay_window(x_conn, root).sequence, __overlay_cb, NULL);
+}
+
+static void
+__unredirect(void)
+{
+    xcb_window_t root = comp_screen->xcb_screen->root;
+    list_entry_t cur;
+
+    /* window pixmaps are gone along with the redirection */
+    for (cur = list_next(&stack); cur != &stack; cur = list_next(cur))
+        __win_release(CONTAINER_OF(cur, comp_win_s, stack_node));
+
+    if (overlay_picture != XCB_NONE)
+    {
+        xcb_render_free_picture(x_conn, overlay_picture);
+        overlay_picture = XCB_NONE;
+    }
+    overlay = XCB_NONE;
+
+    xcb_composite_unredirect_subwindows(x_conn, root, XCB_COMPOSITE_REDIRECT_MANUAL);
+    xcb_composite_release_overlay_window(x_conn, root);
+
+    timeout_cancel(&frame_timer);
+    frame_pending = 0;
+    damage_count = 0;
+}
+
+/* Bypass while the topmost shown window is opaque and covers the root */
+static void
+__bypass_check(void)
+{
+    int width  = comp_screen->xcb_screen->width_in_pixels;
+    int height = comp_screen->xcb_screen->height_in_pixels;
+    list_entry_t cur;
+    int full = 0;
+
+    for (cur = list_prev(&stack); cur != &stack; cur = list_prev(cur))
+    {
+        comp_win_t w = CONTAINER_OF(cur, comp_win_s, stack_node);
+        if (!w->mapped || w->input_only) continue;
+
+        full = w->known && !w->alpha && w->geom.x <= 0 && w->geom.y <= 0 &&
+            w->geom.x + (int)w->geom.w >= width && w->geom.y + (int)w->geom.h >= height;
+        break;
+    }
+
+    if (full == bypass) return;
+
+    if (full)
+    {
+        __unredirect();
+        bypass = 1;
+        ++ stats.comp_bypasses;
+        DEBUGP("compositing bypassed\n");
+    }
+    else
+    {
+        bypass = 0;
+        __redirect();
+        DEBUGP("compositing resumed\n");
+    }
+}
+
+static void
+__frame(void *data)
+{
+    xcb_rectangle_t rects[COMP_DAMAGE_RECTS];
+    xcb_render_color_t black = { 0, 0, 0, 0xffff };
+    uint64_t t = time_real_ns(), area = 0;
+    list_entry_t cur;
+    int i;
+
+    frame_pending = 0;
+    if (bypass || overlay_picture == XCB_NONE || damage_count == 0) return;
+    frame_last = time_now_ns();
+
+    for (i = 0; i < damage_count; ++ i)
+    {
+        rects[i].x      = damage[i].x;
+        rects[i].y      = damage[i].y;
+        rects[i].width  = damage[i].w;
+        rects[i].height = damage[i].h;
+        area += (uint64_t)damage[i].w * damage[i].h;
+    }
+
+    /* rearm reports first, drawing from now on is the next frame's */
+    for (cur = list_next(&stack); cur != &stack; cur = list_next(cur))
+    {
+        comp_win_t w = CONTAINER_OF(cur, comp_win_s, stack_node);
+        if (!w->damaged) continue;
+        xcb_damage_subtract(x_conn, w->damage, XCB_NONE, XCB_NONE);
+        w->damaged = 0;
+    }
+
+    xcb_xfixes_set_region(x_conn, clip, damage_count, rects);
+    xcb_xfixes_set_picture_clip_region(x_conn, buffer_picture, clip, 0, 0);
+    xcb_render_fill_rectangles(x_conn, XCB_RENDER_PICT_OP_SRC, buffer_picture,
+                               black, damage_count, rects);
+
+    for (cur = list_next(&stack); cur != &stack; cur = list_next(cur))
+    {
+        comp_win_t w = CONTAINER_OF(cur, comp_win_s, stack_node);
+
+        if (!w->mapped || !w->known || w->input_only) continue;
+        for (i = 0; i < damage_count; ++ i)
+            if (__overlap(&damage[i], &w->geom)) break;
+        if (i == damage_count) continue;
+
+        if (w->picture == XCB_NONE)
+        {
+            w->pixmap  = x_generate_id();
+            w->picture = x_generate_id();
+            xcb_composite_name_window_pixmap(x_conn, w->window, w->pixmap);
+            xcb_render_create_picture(x_conn, w->picture, w->pixmap, w->format, 0, NULL);
+        }
+
+        xcb_render_composite(x_conn, w->alpha ? XCB_RENDER_PICT_OP_OVER : XCB_RENDER_PICT_OP_SRC,
+                             w->picture, XCB_NONE, buffer_picture, 0, 0, 0, 0,
+                             w->geom.x, w->geom.y, w->geom.w, w->geom.h);
+    }
+
+    xcb_xfixes_set_picture_clip_region(x_conn, overlay_picture, clip, 0, 0);
+    xcb_render_composite(x_conn, XCB_RENDER_PICT_OP_SRC, buffer_picture, XCB_NONE, overlay_picture,
+                         0, 0, 0, 0, 0, 0,
+                         comp_screen->xcb_screen->width_in_pixels,
+                         comp_screen->xcb_screen->height_in_pixels);
+    damage_count = 0;
+
+    t = time_real_ns() - t;
+    ++ stats.comp_frames;
+    stats.comp_frame_ns += t;
+    if (t > stats.comp_frame_ns_max) stats.comp_frame_ns_max = t;
+    stats.comp_pixels += area;
+    stats.comp_pixels_last = area;
+}
+
+/* The QueryVersion replies of Composite, Damage and XFixes all start
+ * with a 32 bit major and minor; data is the least major << 16 | minor */
+static void
+__version_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    xcb_composite_query_version_reply_t *r = (xcb_composite_query_version_reply_t *)reply;
+
+    if (r == NULL || (r->major_version << 16 | r->minor_version) < (uintptr_t)data)
+        comp_failed = 1;
+}
+
+static void
+__formats_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    xcb_render_query_pict_formats_reply_t *r = (xcb_render_query_pict_formats_reply_t *)reply;
+    xcb_render_pictforminfo_t *info;
+    xcb_render_pictscreen_iterator_t si;
+    int n, i;
+
+    if (r == NULL)
+    {
+        comp_failed = 1;
+        return;
+    }
+
+    info = xcb_render_query_pict_formats_formats(r);
+    n = xcb_render_query_pict_formats_formats_length(r);
+    formats = (comp_format_s *)malloc(r->num_visuals * sizeof(comp_format_s));
+    if (formats == NULL)
+    {
+        comp_failed = 1;
+        return;
+    }
+
+    for (si = xcb_render_query_pict_formats_screens_iterator(r); si.rem; xcb_render_pictscreen_next(&si))
+    {
+        xcb_render_pictdepth_iterator_t di = xcb_render_pictscreen_depths_iterator(si.data);
+        for (; di.rem; xcb_render_pictdepth_next(&di))
+        {
+            xcb_render_pictvisual_iterator_t vi = xcb_render_pictdepth_visuals_iterator(di.data);
+            for (; vi.rem && format_count < (int)r->num_visuals; xcb_render_pictvisual_next(&vi))
+            {
+                comp_format_s *f = &formats[format_count ++];
+                f->visual = vi.data->visual;
+                f->format = vi.data->format;
+                f->alpha  = 0;
+                for (i = 0; i < n; ++ i)
+                    if (info[i].id == f->format)
+                        f->alpha = info[i].type == XCB_RENDER_PICT_TYPE_DIRECT &&
+                            info[i].direct.alpha_mask != 0;
+            }
+        }
+    }
+}
+
+int
+comp_init(void)
+{
+    static xcb_extension_t *exts[] = { &xcb_composite_id, &xcb_damage_id, &xcb_xfixes_id, &xcb_render_id };
+    const xcb_query_extension_reply_t *ext;
+    const comp_format_s *f;
+    xcb_screen_t *s;
+    xcb_generic_error_t *error;
+    int i;
+
+    if (!comp_enabled) return 0;
+    comp_enabled = 0;
+
+    if (x_backend->offline || trace_mode == TRACE_MODE_RECORD)
+        return 0;
+
+    for (i = 0; i < 4; ++ i)
+        xcb_prefetch_extension_data(x_conn, exts[i]);
+    ++ stats.round_trips;
+    for (i = 0; i < 4; ++ i)
+    {
+        ext = xcb_get_extension_data(x_conn, exts[i]);
+        if (ext == NULL || !ext->present)
+        {
+            fprintf(stderr, "compositing needs Composite, Damage, XFixes and Render\n");
+            return 0;
+        }
+        if (exts[i] == &xcb_damage_id)
+            damage_event_base = ext->first_event;
+    }
+
+    /* Composite 0.3 has the overlay, XFixes 2 the regions */
+    comp_failed = 0;
+    reply_wait(xcb_composite_query_version(x_conn, 0, 4).sequence, __version_cb, (void *)(0 << 16 | 3));
+    reply_wait(xcb_damage_query_version(x_conn, 1, 1).sequence, __version_cb, (void *)(1 << 16 | 1));
+    reply_wait(xcb_xfixes_query_version(x_conn, 5, 0).sequence, __version_cb, (void *)(2 << 16 | 0));
+    reply_wait(xcb_render_query_pict_formats(x_conn).sequence, __formats_cb, NULL);
+    reply_drain();
+
+    comp_screen = &screens[0];
+    s = comp_screen->xcb_screen;
+    if (comp_failed || (f = __format(s->root_visual)) == NULL)
+    {
+        fprintf(stderr, "compositing unavailable\n");
+        comp_screen = NULL;
+        return 0;
+    }
+    root_format = f->format;
+
+    error = xcb_request_check(x_conn,
+        xcb_composite_redirect_subwindows_checked(x_conn, s->root, XCB_COMPOSITE_REDIRECT_MANUAL));
+    ++ stats.round_trips;
+    if (error != NULL)
+    {
+        fprintf(stderr, "Can't redirect windows, another compositor running?\n");
+        free(error);
+        comp_screen = NULL;
+        return 0;
+    }
+
+    pool_init(&win_pool, "comp", sizeof(comp_win_s), 64);
+    for (i = 0; i < COMP_HASH; ++ i)
+        list_init(&win_hash[i]);
+    list_init(&stack);
+    timeout_init(&frame_timer, __frame, NULL);
+
+    buffer = x_generate_id();
+    xcb_create_pixmap(x_conn, s->root_depth, buffer, s->root, s->width_in_pixels, s->height_in_pixels);
+    buffer_picture = x_generate_id();
+    xcb_render_create_picture(x_conn, buffer_picture, buffer, root_format, 0, NULL);
+    clip = x_generate_id();
+    xcb_xfixes_create_region(x_conn, clip, 0, NULL);
+
+    /* the overlay first, so the tree can leave it out */
+    reply_wait(xcb_composite_get_overlay_window(x_conn, s->root).sequence, __overlay_cb, NULL);
+    reply_drain();
+    reply_wait(xcb_query_tree(x_conn, s->root).sequence, __tree_cb, NULL);
+    reply_drain();
+
+    comp_enabled = 1;
+    __bypass_check();
+    return 0;
+}
+
+int
+comp_event(xcb_generic_event_t *e)
+{
+    int type = e->response_type & ~0x80;
+    xcb_window_t root;
+    comp_win_t w;
+
+    if (!comp_enabled) return 0;
+    root = comp_screen->xcb_screen->root;
+
+    if (type == damage_event_base + XCB_DAMAGE_NOTIFY)
+    {
+        xcb_damage_notify_event_t *d = (xcb_damage_notify_event_t *)e;
+
+        if ((w = __find(d->drawable)) != NULL && w->damage == d->damage)
+        {
+            w->damaged = 1;
+            /* the area is relative to the inside of the border */
+            __damage_add(w->geom.x + ((int)w->geom.w - d->geometry.width) / 2 + d->area.x,
+                         w->geom.y + ((int)w->geom.h - d->geometry.height) / 2 + d->area.y,
+                         d->area.width, d->area.height);
+        }
+        return 1;
+    }
+
+    switch (type)
+    {
+    case XCB_CREATE_NOTIFY:
+    {
+        xcb_create_notify_event_t *c = (xcb_create_notify_event_t *)e;
+        if (c->parent != root || c->window == overlay) break;
+        if (__win_add(c->window, c->x, c->y, c->width, c->height, c->border_width) == NULL) break;
+        reply_wait(xcb_get_window_attributes(x_conn, c->window).sequence,
+                   __attr_cb, (void *)(intptr_t)c->window);
+        break;
+    }
+
+    case XCB_DESTROY_NOTIFY:
+    {
+        xcb_destroy_notify_event_t *d = (xcb_destroy_notify_event_t *)e;
+        if (d->event != root || (w = __find(d->window)) == NULL) break;
+        __win_remove(w, 1);
+        __bypass_check();
+        break;
+    }
+
+    case XCB_MAP_NOTIFY:
+    {
+        xcb_map_notify_event_t *m = (xcb_map_notify_event_t *)e;
+        if (m->event != root || (w = __find(m->window)) == NULL) break;
+        /* a new backing pixmap comes with every map */
+        __win_release(w);
+        w->mapped = 1;
+        __win_track(w);
+        __damage_win(w);
+        __bypass_check();
+        break;
+    }
+
+    case XCB_UNMAP_NOTIFY:
+    {
+        xcb_unmap_notify_event_t *u = (xcb_unmap_notify_event_t *)e;
+        if (u->event != root || (w = __find(u->window)) == NULL) break;
+        __damage_win(w);
+        w->mapped = 0;
+        __win_release(w);
+        __bypass_check();
+        break;
+    }
+
+    case XCB_CONFIGURE_NOTIFY:
+    {
+        xcb_configure_notify_event_t *c = (xcb_configure_notify_event_t *)e;
+        comp_win_t above;
+
+        if (c->event != root || (w = __find(c->window)) == NULL) break;
+
+        __damage_win(w);
+        if (w->geom.w != c->width + 2u * c->border_width ||
+            w->geom.h != c->height + 2u * c->border_width)
+            __win_release(w);
+        w->geom.x = c->x;
+        w->geom.y = c->y;
+        w->geom.w = c->width + 2 * c->border_width;
+        w->geom.h = c->height + 2 * c->border_width;
+
+        list_del(&w->stack_node);
+        if (c->above_sibling != XCB_NONE && (above = __find(c->above_sibling)) != NULL)
+            list_add_after(&above->stack_node, &w->stack_node);
+        else if (c->above_sibling == XCB_NONE)
+            list_add_after(&stack, &w->stack_node);
+        else list_add_before(&stack, &w->stack_node);
+
+        __damage_win(w);
+        __bypass_check();
+        break;
+    }
+
+    case XCB_REPARENT_NOTIFY:
+    {
+        xcb_reparent_notify_event_t *r = (xcb_reparent_notify_event_t *)e;
+        if (r->event != root) break;
+
+        if (r->parent == root)
+            __win_query(r->window, 0);
+        else if ((w = __find(r->window)) != NULL)
+        {
+            __win_remove(w, 0);
+            __bypass_check();
+        }
+        break;
+    }
+    }
+
+    return 0;
+}
+
+void
+comp_cleanup(void)
+{
+    list_entry_t cur;
+
+    if (comp_screen == NULL) return;
+
+    if (!x_connection_error())
+    {
+        if (!bypass)
+        {
+            /* leaves the windows unredirected and the overlay released */
+            for (cur = list_next(&stack); cur != &stack; cur = list_next(cur))
+            {
+                comp_win_t w = CONTAINER_OF(cur, comp_win_s, stack_node);
+                if (w->damage != XCB_NONE)
+                    xcb_damage_destroy(x_conn, w->damage);
+            }
+            __unredirect();
+        }
+        xcb_render_free_picture(x_conn, buffer_picture);
+        xcb_free_pixmap(x_conn, buffer);
+        xcb_xfixes_destroy_region(x_conn, clip);
+        xcb_flush(x_conn);
+    }
+
+    timeout_cancel(&frame_timer);
+    pool_destroy(&win_pool);
+    free(formats);
+    formats = NULL;
+    format_count = 0;
+    comp_screen = NULL;
+    comp_enabled = 0;
+}
+
+#else
+
+int
+comp_init(void)
+{
+    if (comp_enabled)
+        fprintf(stderr, "built without USE_COMPOSITE, not compositing\n");
+    comp_enabled = 0;
+    return 0;
+}
+
+int  comp_event(xcb_generic_event_t *e) { return 0; }
+void comp_cleanup(void) { }
+
+#endif
@@ -0,0 +1,234 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "base.h"
+
+/* EWMH client lists on the roots.
+ *
+ * _NET_CLIENT_LIST is in attach order and _NET_CLIENT_LIST_STACKING
+ * bottom to top. Each is mirrored here as an array of clients; a
+ * client leaving or being raised leaves a hole, which is squeezed out
+ * when the list is next written. Nothing is written until ewmh_flush,
+ * which the event loop calls once per batch: a list that only grew
+ * gets its new tail appended, one that lost or reordered entries is
+ * rewritten whole. */
+
+typedef struct ewmh_list_s
+{
+    xcb_atom_t    atom;
+    client_t     *clients;
+    unsigned int  count;
+    unsigned int  size;
+    unsigned int  holes;
+    unsigned int  published;    /* entries the property has, unless rewrite */
+    int           rewrite;
+} ewmh_list_s;
+
+typedef struct ewmh_screen_s
+{
+    ewmh_list_s list[EWMH_LISTS];
+    int         dirty;
+} ewmh_screen_s;
+
+static ewmh_screen_s *ewmh_screens = NULL;
+static int            ewmh_dirty   = 0;
+
+static xcb_window_t  *buf      = NULL;
+static unsigned int   buf_size = 0;
+
+void
+ewmh_init(void)
+{
+    int i;
+
+    ewmh_screens = (ewmh_screen_s *)calloc(screen_count, sizeof(ewmh_screen_s));
+    if (ewmh_screens == NULL) return;
+
+    for (i = 0; i < screen_count; ++ i)
+    {
+        ewmh_screens[i].list[EWMH_CLIENT_LIST].atom = ATOM(_NET_CLIENT_LIST);
+        ewmh_screens[i].list[EWMH_STACKING].atom    = ATOM(_NET_CLIENT_LIST_STACKING);
+
+        /* whatever a previous window manager left is stale */
+        ewmh_screens[i].list[EWMH_CLIENT_LIST].rewrite = 1;
+        ewmh_screens[i].list[EWMH_STACKING].rewrite    = 1;
+        ewmh_screens[i].dirty = 1;
+    }
+    ewmh_dirty = 1;
+}
+
+static inline ewmh_screen_s *
+__screen(client_t client)
+{
+    return &ewmh_screens[client->screen - screens];
+}
+
+static void
+__squeeze(ewmh_list_s *l, int which)
+{
+    unsigned int i, n = 0;
+
+    for (i = 0; i < l->count; ++ i)
+    {
+        if (l->clients[i] == NULL) continue;
+        l->clients[n] = l->clients[i];
+        l->clients[n]->ewmh_index[which] = n;
+        ++ n;
+    }
+    l->count = n;
+    l->holes = 0;
+}
+
+static void
+__append(ewmh_screen_s *es, int which, client_t client)
+{
+    ewmh_list_s *l = &es->list[which];
+
+    /* raising over and over between flushes mostly makes holes */
+    if (l->count == l->size && l->holes * 2 >= l->count)
+        __squeeze(l, which);
+
+    if (l->count == l->size)
+    {
+        unsigned int size = l->size ? l->size * 2 : 64;
+        client_t *c = (client_t *)realloc(l->clients, size * sizeof(client_t));
+        if (c == NULL)
+        {
+            client->ewmh_index[which] = EWMH_INDEX_NONE;
+            return;
+        }
+        l->clients = c;
+        l->size = size;
+    }
+
+    client->ewmh_index[which] = l->count;
+    l->clients[l->count ++] = client;
+    es->dirty = ewmh_dirty = 1;
+}
+
+static void
+__hole(ewmh_screen_s *es, int which, client_t client)
+{
+    ewmh_list_s *l = &es->list[which];
+    unsigned int i = client->ewmh_index[which];
+
+    if (i == EWMH_INDEX_NONE) return;
+
+    l->clients[i] = NULL;
+    ++ l->holes;
+    client->ewmh_index[which] = EWMH_INDEX_NONE;
+    l->rewrite = 1;
+    es->dirty = ewmh_dirty = 1;
+}
+
+void
+ewmh_client_add(client_t client)
+{
+    if (ewmh_screens == NULL) return;
+
+    __append(__screen(client), EWMH_CLIENT_LIST, client);
+    __append(__screen(client), EWMH_STACKING, client);
+}
+
+void
+ewmh_client_remove(client_t client)
+{
+    if (ewmh_screens == NULL) return;
+
+    __hole(__screen(client), EWMH_CLIENT_LIST, client);
+    __hole(__screen(client), EWMH_STACKING, client);
+}
+
+void
+ewmh_client_raise(client_t client)
+{
+    ewmh_screen_s *es;
+    ewmh_list_s *l;
+    unsigned int i;
+
+    if (ewmh_screens == NULL) return;
+
+    es = __screen(client);
+    l = &es->list[EWMH_STACKING];
+
+    /* already on top, possibly with holes above */
+    i = client->ewmh_index[EWMH_STACKING];
+    if (i == EWMH_INDEX_NONE) return;
+    while (++ i < l->count && l->clients[i] == NULL) ;
+    if (i == l->count) return;
+
+    __hole(es, EWMH_STACKING, client);
+    __append(es, EWMH_STACKING, client);
+}
+
+static void
+__write(xcb_window_t root, ewmh_list_s *l, int which)
+{
+    unsigned int i, from;
+
+    if (l->rewrite)
+    {
+        __squeeze(l, which);
+        from = 0;
+    }
+    else if (l->count > l->published)
+        from = l->published;
+    else return;
+
+    if (buf_size < l->count - from)
+    {
+        xcb_window_t *b = (xcb_window_t *)realloc(buf, (l->count - from) * sizeof(xcb_window_t));
+        if (b == NULL) return;
+        buf = b;
+        buf_size = l->count - from;
+    }
+
+    for (i = from; i < l->count; ++ i)
+        buf[i - from] = l->clients[i]->xcb_window;
+
+    xcb_change_property(x_conn, l->rewrite ? XCB_PROP_MODE_REPLACE : XCB_PROP_MODE_APPEND,
+                        root, l->atom, XCB_ATOM_WINDOW, 32, l->count - from, buf);
+
+    if (l->rewrite) ++ stats.ewmh_rewrites;
+    else ++ stats.ewmh_appends;
+
+    l->published = l->count;
+    l->rewrite = 0;
+}
+
+void
+ewmh_flush(void)
+{
+    int i, w;
+
+    if (!ewmh_dirty) return;
+    ewmh_dirty = 0;
+
+    for (i = 0; i < screen_count; ++ i)
+    {
+        ewmh_screen_s *es = &ewmh_screens[i];
+        if (!es->dirty) continue;
+        es->dirty = 0;
+
+        for (w = 0; w < EWMH_LISTS; ++ w)
+            __write(screens[i].xcb_screen->root, &es->list[w], w);
+    }
+}
+
+void
+ewmh_cleanup(void)
+{
+    int i, w;
+
+    if (ewmh_screens == NULL) return;
+
+    for (i = 0; i < screen_count; ++ i)
+        for (w = 0; w < EWMH_LISTS; ++ w)
+            free(ewmh_screens[i].list[w].clients);
+
+    free(ewmh_screens);
+    ewmh_screens = NULL;
+    free(buf);
+    buf = NULL;
+    buf_size = 0;
+}
@@ -0,0 +1,701 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "base.h"
+
+/* Control socket.
+ *
+ * A line is one batch: commands separated by ';', each a verb, a
+ * selector and arguments,
+ *
+ *     move SEL X Y; resize SEL W H; focus SEL; close SEL; desktop SEL N
+ *
+ * where SEL is a window id (client or frame), "*" or class=WM_CLASS.
+ * The whole line is parsed and checked before anything is done, so a
+ * bad command or a window that is gone fails the batch with nothing
+ * applied. The rest is one pass over every client_list inside one
+ * server grab: ops naming a window are found through a small hash
+ * built for the batch, the others are matched against each client in
+ * passing, and all the moves and resizes of a client are one
+ * configure. Only the last focus command of a line counts, for the
+ * last client it matches in list order, and none at all if that
+ * client is not shown once the line is done. The requests then go out
+ * with the loop's own flush. The answer is "ok N", N being the
+ * clients touched, or "error ...".
+ *
+ * "restart" is wm_restart. "subscribe" turns a connection into a
+ * stream of "attach ID CLASS", "detach ID" and "focus ID" lines,
+ * starting with the clients there are. Lines are buffered and written once per loop iteration; a
+ * subscriber more than IPC_OUT_MAX behind is dropped.
+ *
+ * Connections that go away while loop_wait may still hold an event
+ * for them are only freed by ipc_flush, outside of it. Like the key
+ * bindings the socket is not opened offline or while recording, as a
+ * trace has no record of what came in over it. */
+
+#define IPC_LINE_MAX (256 * 1024)
+#define IPC_OUT_MAX  (1024 * 1024)
+
+#define IPC_OP_MOVE    0
+#define IPC_OP_RESIZE  1
+#define IPC_OP_FOCUS   2
+#define IPC_OP_CLOSE   3
+#define IPC_OP_DESKTOP 4
+
+#define IPC_SEL_CLIENT 0
+#define IPC_SEL_ALL    1
+#define IPC_SEL_CLASS  2
+
+#define IPC_EVENT_ATTACH 0
+#define IPC_EVENT_DETACH 1
+#define IPC_EVENT_FOCUS  2
+
+typedef struct ipc_conn_s *ipc_conn_t;
+typedef struct ipc_conn_s
+{
+    loop_watch_s watch;
+    list_entry_s conn_node;     /* on conns, or dead once closed */
+    uint32_t     events;        /* epoll mask it is watched with */
+    int          subscribed;
+    int          eof;           /* nothing more to read */
+    int          dead;
+    char        *in;
+    size_t       in_len, in_size;
+    char        *out;
+    size_t       out_len, out_size;
+} ipc_conn_s;
+
+typedef struct ipc_op_s
+{
+    int         op;
+    int         sel;
+    client_t    client;         /* IPC_SEL_CLIENT */
+    const char *class;          /* IPC_SEL_CLASS, into the line */
+    long        arg[2];
+    int         next;           /* next op on the same client, or -1 */
+} ipc_op_s;
+
+typedef struct ipc_slot_s
+{
+    client_t client;
+    int      head, tail;
+} ipc_slot_s;
+
+static const struct { const char *name; int op; int argc; } verbs[] =
+{
+    { "move",    IPC_OP_MOVE,    2 },
+    { "resize",  IPC_OP_RESIZE,  2 },
+    { "focus",   IPC_OP_FOCUS,   0 },
+    { "close",   IPC_OP_CLOSE,   0 },
+    { "desktop", IPC_OP_DESKTOP, 1 },
+};
+
+static const char *event_names[] = { "attach", "detach", "focus" };
+
+static loop_watch_s listen_watch;
+static char         listen_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+static list_entry_s conns = { &conns, &conns };
+static list_entry_s dead  = { &dead, &dead };
+static int          subscribers = 0;
+
+/* per batch, kept between them */
+static ipc_op_s    *ops        = NULL;
+static int          ops_size   = 0;
+static int         *wild       = NULL;
+static ipc_slot_s  *slots      = NULL;
+static unsigned int slots_size = 0;
+
+static void
+__conn_kill(ipc_conn_t c)
+{
+    if (c->dead) return;
+
+    c->dead = 1;
+    if (c->subscribed) -- subscribers;
+    loop_watch_del(&c->watch);
+    close(c->watch.fd);
+    list_del(&c->conn_node);
+    list_add(&dead, &c->conn_node);
+}
+
+static void
+__conn_free(ipc_conn_t c)
+{
+    free(c->in);
+    free(c->out);
+    free(c);
+}
+
+static int
+__out(ipc_conn_t c, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (c->dead) return -1;
+
+    while (1)
+    {
+        va_start(ap, fmt);
+        n = vsnprintf(c->out + c->out_len, c->out_size - c->out_len, fmt, ap);
+        va_end(ap);
+        if (n < 0) return -1;
+        if (c->out_len + n < c->out_size) break;
+
+        if (c->out_len + n + 1 > IPC_OUT_MAX)
+        {
+            /* too far behind to catch up */
+            __conn_kill(c);
+            return -1;
+        }
+
+        size_t size = c->out_size ? c->out_size : 256;
+        while (size < c->out_len + n + 1) size <<= 1;
+        char *o = (char *)realloc(c->out, size);
+        if (o == NULL)
+        {
+            __conn_kill(c);
+            return -1;
+        }
+        c->out = o;
+        c->out_size = size;
+    }
+
+    c->out_len += n;
+    return 0;
+}
+
+/* Input until EOF, and room for output only while some is left */
+static void
+__conn_watch(ipc_conn_t c)
+{
+    uint32_t events = (c->eof ? 0 : EPOLLIN | EPOLLRDHUP) | (c->out_len ? EPOLLOUT : 0);
+
+    if (c->dead || events == c->events) return;
+    c->events = events;
+    if (loop_watch_mod(&c->watch, events))
+        __conn_kill(c);
+}
+
+static void
+__conn_write(ipc_conn_t c)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    if (c->dead) return;
+
+    while (done < c->out_len)
+    {
+        n = write(c->watch.fd, c->out + done, c->out_len - done);
+        if (n > 0)
+        {
+            done += n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) break;
+        __conn_kill(c);
+        return;
+    }
+
+    memmove(c->out, c->out + done, c->out_len - done);
+    c->out_len -= done;
+    __conn_watch(c);
+}
+
+static void
+__event(ipc_conn_t c, int event, client_t client)
+{
+    if (event == IPC_EVENT_ATTACH)
+        __out(c, "attach 0x%08x %s\n", client->xcb_window, client->wm_class);
+    else __out(c, "%s 0x%08x\n", event_names[event], client->xcb_window);
+    ++ stats.ipc_events;
+}
+
+static void
+__broadcast(int event, client_t client)
+{
+    list_entry_t cur, next;
+
+    for (cur = list_next(&conns); cur != &conns; cur = next)
+    {
+        ipc_conn_t c = CONTAINER_OF(cur, ipc_conn_s, conn_node);
+        next = list_next(cur);
+        if (c->subscribed) __event(c, event, client);
+    }
+}
+
+void
+ipc_client_attach(client_t client)
+{
+    if (subscribers) __broadcast(IPC_EVENT_ATTACH, client);
+}
+
+void
+ipc_client_detach(client_t client)
+{
+    if (subscribers) __broadcast(IPC_EVENT_DETACH, client);
+}
+
+void
+ipc_focus(client_t client)
+{
+    if (subscribers) __broadcast(IPC_EVENT_FOCUS, client);
+}
+
+static void
+__subscribe(ipc_conn_t c)
+{
+    list_entry_t cur;
+    int i;
+
+    if (c->subscribed) return;
+    c->subscribed = 1;
+    ++ subscribers;
+
+    __out(c, "ok 0\n");
+    for (i = 0; i < screen_count; ++ i)
+    {
+        for (cur = list_next(&screens[i].client_list); cur != &screens[i].client_list; cur = list_next(cur))
+            __event(c, IPC_EVENT_ATTACH, CONTAINER_OF(cur, client_s, client_node));
+        if (screens[i].focus)
+            __event(c, IPC_EVENT_FOCUS, screens[i].focus);
+    }
+}
+
+static unsigned int
+__hash(client_t client)
+{
+    uintptr_t p = (uintptr_t)client;
+    return (unsigned int)((p >> 4) * 0x9e3779b1u) >> 8;
+}
+
+static ipc_slot_s *
+__slot(client_t client, int add)
+{
+    unsigned int i = __hash(client) & (slots_size - 1);
+
+    while (slots[i].client != client)
+    {
+        if (slots[i].client == NULL)
+        {
+            if (!add) return NULL;
+            slots[i].client = client;
+            slots[i].head = slots[i].tail = -1;
+            break;
+        }
+        i = (i + 1) & (slots_size - 1);
+    }
+    return &slots[i];
+}
+
+/* Fills ops[0 .. *count); returns NULL, or what is wrong */
+static const char *
+__parse(char *line, int *count, int *index)
+{
+    char *cmd, *save_cmd, *tok, *save_tok, *end;
+    int n = 0, v, a;
+
+    for (cmd = strtok_r(line, ";", &save_cmd); cmd; cmd = strtok_r(NULL, ";", &save_cmd))
+    {
+        ipc_op_s *op;
+
+        if ((tok = strtok_r(cmd, " \t\r", &save_tok)) == NULL)
+            continue;               /* empty */
+        *index = n;
+
+        if (n == ops_size)
+        {
+            int size = ops_size ? ops_size * 2 : 64;
+            ipc_op_s *o = (ipc_op_s *)realloc(ops, size * sizeof(ipc_op_s));
+            int *w = (int *)realloc(wild, size * sizeof(int));
+            if (o) ops = o;
+            if (w) wild = w;
+            if (o == NULL || w == NULL) return "out of memory";
+            ops_size = size;
+        }
+        op = &ops[n];
+
+        for (v = 0; v < sizeof(verbs) / sizeof(verbs[0]); ++ v)
+            if (strcmp(tok, verbs[v].name) == 0) break;
+        if (v == sizeof(verbs) / sizeof(verbs[0]))
+            return "unknown command";
+        op->op = verbs[v].op;
+
+        if ((tok = strtok_r(NULL, " \t\r", &save_tok)) == NULL)
+            return "no window";
+        if (strcmp(tok, "*") == 0)
+            op->sel = IPC_SEL_ALL;
+        else if (strncmp(tok, "class=", 6) == 0)
+        {
+            op->sel   = IPC_SEL_CLASS;
+            op->class = tok + 6;
+        }
+        else
+        {
+            unsigned long id = strtoul(tok, &end, 0);
+            wnd_dict_node_t node;
+
+            if (*end || end == tok) return "bad window";
+            node = wnd_dict_find(id, WND_DICT_FIND_OP_NONE);
+            if (node == NULL || node->role != WND_ROLE_CLIENT)
+                return "no such window";
+            op->sel    = IPC_SEL_CLIENT;
+            op->client = (client_t)node->link;
+        }
+
+        for (a = 0; a < verbs[v].argc; ++ a)
+        {
+            if ((tok = strtok_r(NULL, " \t\r", &save_tok)) == NULL)
+                return "missing argument";
+            op->arg[a] = strtol(tok, &end, 0);
+            if (*end || end == tok) return "bad argument";
+        }
+        if (strtok_r(NULL, " \t\r", &save_tok))
+            return "too many arguments";
+
+        if (op->op == IPC_OP_RESIZE && (op->arg[0] <= 0 || op->arg[1] <= 0))
+            return "bad size";
+        if (op->op == IPC_OP_DESKTOP && (op->arg[0] < 0 || op->arg[0] >= desktop_count))
+            return "bad desktop";
+        ++ n;
+    }
+
+    *count = n;
+    return NULL;
+}
+
+static inline int
+__match(ipc_op_s *op, client_t client)
+{
+    return op->sel == IPC_SEL_ALL || strcmp(client->wm_class, op->class) == 0;
+}
+
+/* Ops on one client, in the order they came */
+static int
+__apply_client(client_t client, int head, int nwild, client_t *focus, int *focus_index)
+{
+    int i = head, w = 0, k, touched = 0, close = 0;
+    int which = client->xcb_container != XCB_NONE ? CLIENT_GEOM_CONTAINER : CLIENT_GEOM_WINDOW;
+    rect_s geom = client->geom[which], r = geom;
+
+    while (i >= 0 || w < nwild)
+    {
+        if (i >= 0 && (w == nwild || i < wild[w]))
+        {
+            k = i;
+            i = ops[i].next;
+        }
+        else if (!__match(&ops[k = wild[w ++]], client))
+            continue;
+
+        touched = 1;
+        switch (ops[k].op)
+        {
+        case IPC_OP_MOVE:
+            r.x = ops[k].arg[0];
+            r.y = ops[k].arg[1];
+            break;
+
+        case IPC_OP_RESIZE:
+            r.w = ops[k].arg[0];
+            r.h = ops[k].arg[1];
+            break;
+
+        case IPC_OP_FOCUS:
+            /* the clients are walked in list order, not op order */
+            if (k >= *focus_index)
+            {
+                *focus = client;
+                *focus_index = k;
+            }
+            break;
+
+        case IPC_OP_CLOSE:
+            close = 1;
+            break;
+
+        case IPC_OP_DESKTOP:
+            client_desktop_set(client, ops[k].arg[0]);
+            break;
+        }
+        ++ stats.ipc_ops;
+    }
+
+    if (memcmp(&r, &geom, sizeof(r)) && client->class && client->class->client_move_resize)
+        client->class->client_move_resize(client->class, client, &r);
+    if (close) client_close(client);
+    return touched;
+}
+
+static void
+__batch(ipc_conn_t c, char *line)
+{
+    const char *error;
+    client_t focus = NULL;
+    int focus_index = -1;
+    int count = 0, index = 0, nwild = 0, touched = 0, i;
+    unsigned int size;
+    list_entry_t cur;
+
+    ++ stats.ipc_batches;
+
+    if (strcmp(line, "subscribe") == 0)
+    {
+        __subscribe(c);
+        return;
+    }
+    if (strcmp(line, "restart") == 0)
+    {
+        __out(c, "ok 0\n");
+        wm_restart();
+        return;
+    }
+
+    if ((error = __parse(line, &count, &index)))
+    {
+        __out(c, "error %d: %s\n", index + 1, error);
+        return;
+    }
+    if (count == 0)
+    {
+        __out(c, "ok 0\n");
+        return;
+    }
+
+    for (size = 16; size < (unsigned int)count * 2; size <<= 1) ;
+    if (size > slots_size)
+    {
+        ipc_slot_s *s = (ipc_slot_s *)realloc(slots, size * sizeof(ipc_slot_s));
+        if (s == NULL)
+        {
+            __out(c, "error 1: out of memory\n");
+            return;
+        }
+        slots = s;
+        slots_size = size;
+    }
+    memset(slots, 0, slots_size * sizeof(ipc_slot_s));
+
+    /* chain the ops of each named client, list the rest */
+    for (i = 0; i < count; ++ i)
+    {
+        ops[i].next = -1;
+        if (ops[i].sel != IPC_SEL_CLIENT)
+        {
+            wild[nwild ++] = i;
+            continue;
+        }
+
+        ipc_slot_s *s = __slot(ops[i].client, 1);
+        if (s->tail >= 0) ops[s->tail].next = i;
+        else s->head = i;
+        s->tail = i;
+    }
+
+    xcb_grab_server(x_conn);
+    for (i = 0; i < screen_count; ++ i)
+        for (cur = list_next(&screens[i].client_list); cur != &screens[i].client_list; cur = list_next(cur))
+        {
+            client_t client = CONTAINER_OF(cur, client_s, client_node);
+            ipc_slot_s *s = __slot(client, 0);
+
+            if (s == NULL && nwild == 0) continue;
+            touched += __apply_client(client, s ? s->head : -1, nwild, &focus, &focus_index);
+        }
+
+    /* one focus change, for the last focus of the line; if that
+     * client ends up hidden, no earlier one is taken instead */
+    if (focus && focus->mapped && !focus->desktop_hidden)
+        focus_set(focus);
+    xcb_ungrab_server(x_conn);
+
+    __out(c, "ok %d\n", touched);
+}
+
+static void
+__conn_read(ipc_conn_t c)
+{
+    char *line, *nl;
+    ssize_t n;
+
+    while (!c->dead)
+    {
+        if (c->in_len + 1 >= c->in_size)
+        {
+            if (c->in_size >= IPC_LINE_MAX)
+            {
+                __out(c, "error 1: line too long\n");
+                c->eof = 1;
+                return;
+            }
+            size_t size = c->in_size ? c->in_size * 2 : 1024;
+            char *in = (char *)realloc(c->in, size);
+            if (in == NULL)
+            {
+                __conn_kill(c);
+                return;
+            }
+            c->in = in;
+            c->in_size = size;
+        }
+
+        n = read(c->watch.fd, c->in + c->in_len, c->in_size - 1 - c->in_len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == EAGAIN) return;
+        if (n <= 0) break;
+        c->in_len += n;
+        c->in[c->in_len] = 0;
+
+        /* every complete line, then wait for the rest */
+        line = c->in;
+        while (!c->dead && (nl = memchr(line, '\n', c->in + c->in_len - line)))
+        {
+            *nl = 0;
+            __batch(c, line);
+            line = nl + 1;
+        }
+        c->in_len -= line - c->in;
+        memmove(c->in, line, c->in_len);
+    }
+
+    /* the last line needs no newline */
+    c->eof = 1;
+    if (c->in_len && !c->dead)
+    {
+        c->in[c->in_len] = 0;
+        c->in_len = 0;
+        __batch(c, c->in);
+    }
+}
+
+static void
+__conn_ready(loop_watch_t watch, uint32_t events)
+{
+    ipc_conn_t c = CONTAINER_OF(watch, ipc_conn_s, watch);
+
+    /* closed earlier in this round of loop_wait */
+    if (c->dead) return;
+
+    if (!c->eof && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+        __conn_read(c);
+    __conn_write(c);
+
+    /* a subscriber may stop talking and keep listening; the others
+     * are done once their answers are out */
+    if (events & (EPOLLHUP | EPOLLERR) ||
+        (c->eof && !c->subscribed && c->out_len == 0))
+        __conn_kill(c);
+}
+
+static void
+__listen_ready(loop_watch_t watch, uint32_t events)
+{
+    int fd;
+
+    while ((fd = accept4(watch->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        ipc_conn_t c = (ipc_conn_t)calloc(1, sizeof(ipc_conn_s));
+        if (c == NULL)
+        {
+            close(fd);
+            continue;
+        }
+
+        c->watch.fd       = fd;
+        c->watch.callback = __conn_ready;
+        c->watch.data     = NULL;
+        c->events         = EPOLLIN | EPOLLRDHUP;
+
+        if (loop_watch_add(&c->watch, c->events))
+        {
+            close(fd);
+            free(c);
+            continue;
+        }
+        list_add_before(&conns, &c->conn_node);
+    }
+}
+
+int
+ipc_init(void)
+{
+    int fd;
+
+    if (x_backend->offline || trace_mode == TRACE_MODE_RECORD)
+        return 0;
+
+    fd = loop_listen("CWM_IPC_SOCKET", "cwm-ipc", listen_path, sizeof(listen_path), 8);
+    if (fd < 0)
+        return 0;               /* runs fine without it */
+
+    listen_watch.fd       = fd;
+    listen_watch.callback = __listen_ready;
+    listen_watch.data     = NULL;
+    if (loop_watch_add(&listen_watch, EPOLLIN))
+    {
+        close(fd);
+        unlink(listen_path);
+        listen_path[0] = 0;
+    }
+
+    return 0;
+}
+
+/* Once per loop iteration, outside loop_wait */
+void
+ipc_flush(void)
+{
+    list_entry_t cur, next;
+
+    if (subscribers)
+        for (cur = list_next(&conns); cur != &conns; cur = next)
+        {
+            ipc_conn_t c = CONTAINER_OF(cur, ipc_conn_s, conn_node);
+            next = list_next(cur);
+            if (c->out_len && !(c->events & EPOLLOUT)) __conn_write(c);
+        }
+
+    while (!list_empty(&dead))
+    {
+        cur = list_next(&dead);
+        list_del(cur);
+        __conn_free(CONTAINER_OF(cur, ipc_conn_s, conn_node));
+    }
+}
+
+void
+ipc_cleanup(void)
+{
+    while (!list_empty(&conns))
+        __conn_kill(CONTAINER_OF(list_next(&conns), ipc_conn_s, conn_node));
+    ipc_flush();
+
+    if (listen_path[0])
+    {
+        loop_watch_del(&listen_watch);
+        close(listen_watch.fd);
+        unlink(listen_path);
+        listen_path[0] = 0;
+    }
+
+    free(ops);
+    free(wild);
+    free(slots);
+    ops = NULL;
+    wild = NULL;
+    slots = NULL;
+    ops_size = 0;
+    slots_size = 0;
+}
@@ -0,0 +1,270 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "base.h"
+
+/* Key bindings.
+ *
+ * Keysyms are resolved against the keyboard mapping once, when it
+ * comes in at startup and again on every MappingNotify; each binding
+ * then becomes a set of (modifiers, keycode) keys in a flat open
+ * addressed table, and a KeyPress costs one hash and usually one
+ * probe. The grabs of all bindings, times every combination of Lock,
+ * NumLock and ScrollLock, go out back to back without waiting.
+ *
+ * The keyboard is not asked for offline or while recording, as the
+ * replay backend has nothing to answer with; bindings then do
+ * nothing. */
+
+#define KEYSYM_NUM_LOCK    0xff7f
+#define KEYSYM_SCROLL_LOCK 0xff14
+
+#define KEY_MODS (XCB_MOD_MASK_SHIFT | XCB_MOD_MASK_LOCK | XCB_MOD_MASK_CONTROL | \
+                  XCB_MOD_MASK_1 | XCB_MOD_MASK_2 | XCB_MOD_MASK_3 |            \
+                  XCB_MOD_MASK_4 | XCB_MOD_MASK_5)
+#define KEY(mods, keycode) ((uint32_t)(mods) << 8 | (keycode))
+
+typedef struct key_slot_s
+{
+    uint32_t      key;          /* 0 if free, keycodes start at 8 */
+    key_binding_t binding;
+} key_slot_s;
+
+static list_entry_s bindings = { &bindings, &bindings };
+
+static key_slot_s  *table      = NULL;
+static unsigned int table_mask = 0;
+
+static xcb_keysym_t *keysyms = NULL;
+static int           keysyms_per_keycode = 0;
+static int           keycode_count = 0;
+static xcb_keycode_t min_keycode;
+
+static uint16_t lock_mask = XCB_MOD_MASK_LOCK;
+static int      enabled   = 0;
+static int      fetching  = 0;      /* mapping replies outstanding */
+static int      refetch   = 0;      /* changed again meanwhile */
+
+static inline unsigned int
+__slot(uint32_t key)
+{
+    return (key * 0x9e3779b1u) >> 16 & table_mask;
+}
+
+static void
+__put(uint32_t key, key_binding_t b)
+{
+    unsigned int i = __slot(key);
+
+    while (table[i].key != 0)
+    {
+        /* the binding added first keeps the key */
+        if (table[i].key == key) return;
+        i = (i + 1) & table_mask;
+    }
+    table[i].key     = key;
+    table[i].binding = b;
+}
+
+static xcb_keysym_t
+__sym(int keycode, int col)
+{
+    return keysyms[(keycode - min_keycode) * keysyms_per_keycode + col];
+}
+
+/* Rebuild the table and grab it all again */
+static void
+__apply(void)
+{
+    uint16_t locks[8];
+    unsigned int count = 0, used = 0, size;
+    int nlocks = 0, m, k, c, i;
+    list_entry_t cur;
+
+    if (keysyms == NULL) return;
+
+    /* every subset of the lock modifiers */
+    for (m = 0; m <= lock_mask; ++ m)
+        if ((m & lock_mask) == m && nlocks < 8) locks[nlocks ++] = m;
+
+    for (cur = list_next(&bindings); cur != &bindings; cur = list_next(cur))
+        ++ count;
+    /* a keysym is rarely on more than two keys */
+    for (size = 16; size < count * 4; size <<= 1) ;
+
+    free(table);
+    table = (key_slot_s *)calloc(size, sizeof(key_slot_s));
+    table_mask = table ? size - 1 : 0;
+
+    for (i = 0; i < screen_count; ++ i)
+        xcb_ungrab_key(x_conn, XCB_GRAB_ANY, screens[i].xcb_screen->root, XCB_MOD_MASK_ANY);
+    if (table == NULL) return;
+
+    for (cur = list_next(&bindings); cur != &bindings; cur = list_next(cur))
+    {
+        key_binding_t b = CONTAINER_OF(cur, key_binding_s, binding_node);
+        uint16_t mods = b->modifiers & KEY_MODS & ~lock_mask, kmods;
+
+        /* unshifted and shifted columns */
+        for (k = min_keycode; k < min_keycode + keycode_count; ++ k)
+        {
+            for (c = 0; c < 2 && c < keysyms_per_keycode; ++ c)
+                if (__sym(k, c) == b->keysym) break;
+            if (c == 2 || c == keysyms_per_keycode) continue;
+
+            /* kept at most half full */
+            if (used * 2 >= size) break;
+            /* a shifted keysym is typed with Shift */
+            kmods = c == 1 ? mods | XCB_MOD_MASK_SHIFT : mods;
+            __put(KEY(kmods, k), b);
+            ++ used;
+
+            for (i = 0; i < screen_count; ++ i)
+                for (m = 0; m < nlocks; ++ m)
+                    xcb_grab_key(x_conn, 1, screens[i].xcb_screen->root, kmods | locks[m], k,
+                                 XCB_GRAB_MODE_ASYNC, XCB_GRAB_MODE_ASYNC);
+        }
+    }
+}
+
+static void __fetch(void);
+
+static void
+__fetched(void)
+{
+    if (-- fetching) return;
+
+    if (refetch) __fetch();
+    else __apply();
+}
+
+static void
+__keyboard_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    xcb_get_keyboard_mapping_reply_t *r = (xcb_get_keyboard_mapping_reply_t *)reply;
+    int n;
+
+    if (r && (n = xcb_get_keyboard_mapping_keysyms_length(r)) > 0)
+    {
+        xcb_keysym_t *k = (xcb_keysym_t *)malloc(n * sizeof(xcb_keysym_t));
+        if (k)
+        {
+            memcpy(k, xcb_get_keyboard_mapping_keysyms(r), n * sizeof(xcb_keysym_t));
+            free(keysyms);
+            keysyms = k;
+            keysyms_per_keycode = r->keysyms_per_keycode;
+        }
+    }
+    __fetched();
+}
+
+static void
+__modifier_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    xcb_get_modifier_mapping_reply_t *r = (xcb_get_modifier_mapping_reply_t *)reply;
+    xcb_keycode_t *codes;
+    int m, i, per;
+
+    /* needs the keysyms, which come first */
+    if (r && keysyms)
+    {
+        codes = xcb_get_modifier_mapping_keycodes(r);
+        per = r->keycodes_per_modifier;
+        lock_mask = XCB_MOD_MASK_LOCK;
+        for (m = 0; m < 8; ++ m)
+            for (i = 0; i < per; ++ i)
+            {
+                xcb_keycode_t k = codes[m * per + i];
+                xcb_keysym_t s;
+
+                if (k < min_keycode || k >= min_keycode + keycode_count) continue;
+                s = __sym(k, 0);
+                if (s == KEYSYM_NUM_LOCK || s == KEYSYM_SCROLL_LOCK)
+                    lock_mask |= 1 << m;
+            }
+    }
+    __fetched();
+}
+
+static void
+__fetch(void)
+{
+    refetch  = 0;
+    fetching = 2;
+    reply_wait(xcb_get_keyboard_mapping(x_conn, min_keycode, keycode_count).sequence,
+               __keyboard_cb, NULL);
+    reply_wait(xcb_get_modifier_mapping(x_conn).sequence, __modifier_cb, NULL);
+}
+
+int
+keys_init(void)
+{
+    const xcb_setup_t *setup;
+
+    if (x_backend->offline || trace_mode == TRACE_MODE_RECORD)
+        return 0;
+
+    setup = x_get_setup();
+    min_keycode   = setup->min_keycode;
+    keycode_count = setup->max_keycode - setup->min_keycode + 1;
+    enabled = 1;
+    __fetch();
+    return 0;
+}
+
+void
+keys_mapping_notify(xcb_mapping_notify_event_t *e)
+{
+    if (!enabled || e->request == XCB_MAPPING_POINTER) return;
+
+    /* a burst of them while we are still asking costs one more round */
+    if (fetching) refetch = 1;
+    else __fetch();
+}
+
+int
+key_binding_add(key_binding_t binding)
+{
+    if (binding->callback == NULL) return -1;
+
+    list_add_before(&bindings, &binding->binding_node);
+    if (enabled && !fetching) __apply();
+    return 0;
+}
+
+void
+key_binding_remove(key_binding_t binding)
+{
+    list_del(&binding->binding_node);
+    if (enabled && !fetching) __apply();
+}
+
+void
+key_press(xcb_key_press_event_t *e)
+{
+    uint32_t key = KEY(e->state & KEY_MODS & ~lock_mask, e->detail);
+    wnd_dict_node_t node;
+    unsigned int i;
+
+    if (table == NULL) return;
+
+    for (i = __slot(key); table[i].key != key; i = (i + 1) & table_mask)
+        if (table[i].key == 0) return;
+
+    node = wnd_dict_find(e->root, WND_DICT_FIND_OP_NONE);
+    if (node == NULL || node->role != WND_ROLE_ROOT) return;
+
+    table[i].binding->callback((screen_t)node->link, table[i].binding->data);
+}
+
+void
+keys_cleanup(void)
+{
+    free(table);
+    table = NULL;
+    table_mask = 0;
+    free(keysyms);
+    keysyms = NULL;
+    enabled = 0;
+    fetching = refetch = 0;
+}
@@ -0,0 +1,253 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+
+#include "base.h"
+
+/* Main loop plumbing: one epoll set holding the watched fds, a
+ * signalfd for the signals we handle and a timerfd that is armed for
+ * the earliest timeout only, so nothing wakes us up while idle. */
+
+#define LOOP_EVENTS_MAX 16
+
+static int epoll_fd  = -1;
+static int signal_fd = -1;
+static int timer_fd  = -1;
+
+static sigset_t             signal_mask;
+static loop_signal_callback_f signal_callbacks[_NSIG];
+
+static loop_watch_s signal_watch;
+static loop_watch_s timer_watch;
+static uint64_t     timer_armed = 0;
+
+static void
+__signal_ready(loop_watch_t watch, uint32_t events)
+{
+    struct signalfd_siginfo si;
+
+    while (read(signal_fd, &si, sizeof(si)) == sizeof(si))
+    {
+        if (si.ssi_signo < _NSIG && signal_callbacks[si.ssi_signo])
+            signal_callbacks[si.ssi_signo](si.ssi_signo);
+    }
+}
+
+static void
+__timer_ready(loop_watch_t watch, uint32_t events)
+{
+    uint64_t expirations;
+
+    if (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        return;
+
+    uint64_t now = time_now_ns();
+
+    timer_armed = 0;
+    trace_timer(now);
+    timeout_run(now);
+}
+
+static void
+__timer_rearm(void)
+{
+    uint64_t next = timeout_next();
+    struct itimerspec its;
+
+    if (next == timer_armed) return;
+
+    memset(&its, 0, sizeof(its));
+    /* zero disarms, which is what we want when nothing is pending */
+    its.it_value.tv_sec  = next / 1000000000ull;
+    its.it_value.tv_nsec = next % 1000000000ull;
+    if (next && its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+        its.it_value.tv_nsec = 1;
+
+    if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) == 0)
+        timer_armed = next;
+}
+
+int
+loop_init(void)
+{
+    sigemptyset(&signal_mask);
+
+    if ((epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        return -1;
+
+    if ((signal_fd = signalfd(-1, &signal_mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+        return -1;
+
+    if ((timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0)
+        return -1;
+
+    signal_watch.fd       = signal_fd;
+    signal_watch.callback = __signal_ready;
+    signal_watch.data     = NULL;
+    timer_watch.fd        = timer_fd;
+    timer_watch.callback  = __timer_ready;
+    timer_watch.data      = NULL;
+
+    if (loop_watch_add(&signal_watch, EPOLLIN) ||
+        loop_watch_add(&timer_watch, EPOLLIN))
+        return -1;
+
+    return 0;
+}
+
+int
+loop_signal(int signo, loop_signal_callback_f callback)
+{
+    if (signo <= 0 || signo >= _NSIG)
+        return -1;
+
+    signal_callbacks[signo] = callback;
+    sigaddset(&signal_mask, signo);
+
+    /* blocked signals are only ever delivered through the signalfd */
+    if (sigprocmask(SIG_BLOCK, &signal_mask, NULL) < 0)
+        return -1;
+    if (signalfd(signal_fd, &signal_mask, 0) < 0)
+        return -1;
+
+    return 0;
+}
+
+int
+loop_watch_add(loop_watch_t watch, uint32_t events)
+{
+    struct epoll_event ev;
+
+    ev.events   = events;
+    ev.data.ptr = watch;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, watch->fd, &ev);
+}
+
+int
+loop_watch_mod(loop_watch_t watch, uint32_t events)
+{
+    struct epoll_event ev;
+
+    ev.events   = events;
+    ev.data.ptr = watch;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_MOD, watch->fd, &ev);
+}
+
+void
+loop_watch_del(loop_watch_t watch)
+{
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, watch->fd, NULL);
+}
+
+void
+loop_wait(void)
+{
+    struct epoll_event ev[LOOP_EVENTS_MAX];
+    int i, n;
+
+    __timer_rearm();
+
+    n = epoll_wait(epoll_fd, ev, LOOP_EVENTS_MAX, -1);
+    if (n < 0)
+    {
+        if (errno != EINTR)
+            perror("epoll_wait");
+        return;
+    }
+
+    for (i = 0; i < n; ++ i)
+    {
+        loop_watch_t watch = (loop_watch_t)ev[i].data.ptr;
+        if (watch->callback)
+            watch->callback(watch, ev[i].events);
+    }
+}
+
+void
+loop_cleanup(void)
+{
+    if (timer_fd >= 0)  close(timer_fd);
+    if (signal_fd >= 0) close(signal_fd);
+    if (epoll_fd >= 0)  close(epoll_fd);
+
+    timer_fd = signal_fd = epoll_fd = -1;
+    sigprocmask(SIG_UNBLOCK, &signal_mask, NULL);
+}
+
+/* A listening socket for one of our control interfaces: $env, or
+ * name<display> in $XDG_RUNTIME_DIR, or else in a directory of our
+ * own, /tmp/cwm-<uid>, as /tmp is everyone's. It is bound under a
+ * umask that leaves the user alone able to connect from the start.
+ * Returns the descriptor and its path, or -1, having said why. */
+int
+loop_listen(const char *env, const char *name, char *path, size_t size, int backlog)
+{
+    const char *given = getenv(env);
+    const char *dir   = getenv("XDG_RUNTIME_DIR");
+    const char *disp  = getenv("DISPLAY");
+    struct sockaddr_un addr;
+    struct stat st;
+    char own[32];
+    mode_t mask;
+    int fd, n;
+
+    path[0] = 0;
+    if (given)
+        n = snprintf(path, size, "%s", given);
+    else
+    {
+        if (dir == NULL)
+        {
+            snprintf(own, sizeof(own), "/tmp/cwm-%u", (unsigned int)getuid());
+            if ((mkdir(own, S_IRWXU) && errno != EEXIST) || lstat(own, &st) ||
+                !S_ISDIR(st.st_mode) || st.st_uid != getuid() || (st.st_mode & (S_IRWXG | S_IRWXO)))
+            {
+                fprintf(stderr, "Can't listen: %s is not a private directory\n", own);
+                return -1;
+            }
+            dir = own;
+        }
+        n = snprintf(path, size, "%s/%s%s", dir, name, disp ? disp : "");
+    }
+    if (n <= 0 || n >= size || n >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Can't listen: socket path too long\n");
+        path[0] = 0;
+        return -1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        path[0] = 0;
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    unlink(path);
+    mask = umask(S_IRWXG | S_IRWXO);
+    n = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (n || listen(fd, backlog))
+    {
+        fprintf(stderr, "Can't listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        path[0] = 0;
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,170 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "base.h"
+#include "cc/simple.h"
+#include "cc/tile.h"
+
+static void
+__replay_report(uint64_t wall, uint64_t cpu)
+{
+    unsigned long allocs = 0, frees = 0, chunks = 0;
+    pool_t pool;
+
+    /* as counted by the pools; nothing else is */
+    for (pool = pools; pool; pool = pool->next)
+    {
+        allocs += pool->allocs;
+        frees  += pool->allocs - pool->live;
+        chunks += pool->nchunks;
+    }
+
+    fprintf(stderr, "replay: %lu events, %lu replies, %lu timers, %lu desyncs\n"
+            "replay: %.3f ms wall, %.3f ms cpu, %.0f ns cpu/event\n"
+            "replay: %lu pool allocs, %lu frees, %lu chunks\n",
+            trace_replay_stats.events, trace_replay_stats.replies,
+            trace_replay_stats.timers, trace_replay_stats.desyncs,
+            wall / 1e6, cpu / 1e6,
+            trace_replay_stats.events ? (double)cpu / trace_replay_stats.events : 0,
+            allocs, frees, chunks);
+    stats_print(stderr, 0);
+}
+
+static uint64_t
+__cpu_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Mod4+1 .. Mod4+9 switch to desktops 1 to 9 */
+#define DESKTOP_KEYS 9
+
+static key_binding_s desktop_keys[DESKTOP_KEYS];
+
+static void
+__desktop_key(screen_t screen, void *data)
+{
+    desktop_switch(screen, (uintptr_t)data);
+}
+
+static void
+__keys_add(void)
+{
+    int i;
+
+    for (i = 0; i < DESKTOP_KEYS; ++ i)
+    {
+        desktop_keys[i].modifiers = XCB_MOD_MASK_4;
+        desktop_keys[i].keysym    = '1' + i;     /* XK_1 .. XK_9 */
+        desktop_keys[i].callback  = __desktop_key;
+        desktop_keys[i].data      = (void *)(uintptr_t)i;
+        key_binding_add(&desktop_keys[i]);
+    }
+}
+
+static void
+__usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-t] [-s] [-c] [-o class]... [-r trace | -p trace]\n"
+            "  -t        tile normal windows, float the rest\n"
+            "  -s        place new floating windows where they overlap least\n"
+            "  -c        composite (experimental), if built with USE_COMPOSITE\n"
+            "  -o class  move and resize windows of WM_CLASS class as an outline\n"
+            "  -r trace  record the session into trace\n"
+            "  -p trace  replay trace offline and report\n"
+            "SIGHUP restarts in place, keeping the windows as they are\n", name);
+}
+
+int
+main(int argc, char **argv)
+{
+    int ret, opt, tile = 0, outline = 0;
+    client_rule_t rule;
+    
+    while ((opt = getopt(argc, argv, "tsco:r:p:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            tile = 1;
+            break;
+
+        case 's':
+            place_mode = PLACE_MODE_SMART;
+            break;
+
+        case 'c':
+            comp_enabled = 1;
+            break;
+
+        case 'o':
+            rule = (client_rule_t)calloc(1, sizeof(client_rule_s));
+            if (rule == NULL) return 1;
+            rule->wm_class    = optarg;
+            rule->window_type = WINDOW_TYPE_ANY;
+            rule->transient   = RULE_ANY;
+            rule->class       = cc_simple_outline;
+            client_rule_add(rule);
+            outline = 1;
+            break;
+
+        case 'r':
+            if (trace_record_open(optarg))
+            {
+                perror(optarg);
+                return 1;
+            }
+            break;
+
+        case 'p':
+            if (trace_replay_open(optarg))
+            {
+                perror(optarg);
+                return 1;
+            }
+            break;
+
+        default:
+            __usage(argv[0]);
+            return 1;
+        }
+    }
+
+    __keys_add();
+    restart_init(argv);
+
+    uint64_t wall = time_real_ns(), cpu = __cpu_ns();
+
+    ret = wm_init();
+    if (ret == 0)
+    {
+        cc_simple->init(cc_simple);
+        if (outline) cc_simple_outline->init(cc_simple_outline);
+        /* tried before cc_simple, which takes what it declines */
+        if (tile) cc_tile->init(cc_tile);
+        wm_setup();
+    }
+    if (ret == 0)
+    {
+        if (trace_mode == TRACE_MODE_REPLAY)
+            wm_replay();
+        else wm_loop();
+    }
+
+    ret = wm_cleanup();
+
+    /* the clients wait for us in the state wm_cleanup left */
+    if (restart_requested)
+        ret = restart_exec();
+
+    if (trace_mode == TRACE_MODE_REPLAY)
+        __replay_report(time_real_ns() - wall, __cpu_ns() - cpu);
+
+    return ret;
+}
@@ -0,0 +1,595 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "base.h"
+
+/* Mock connection backend: an in-memory model of one screen that
+ * answers tree, geometry and attribute queries and follows the window
+ * requests made through the x_* calls. Everything else goes to an
+ * error connection and is dropped. The model generates no events of
+ * its own; whoever drives it pushes them with mock_event_push. */
+
+#define MOCK_ATOM_FIRST 100
+#define MOCK_ID_BASE    0x00400000
+
+typedef struct mock_window_s *mock_window_t;
+typedef struct mock_window_s
+{
+    xcb_window_t  id;
+    mock_window_t parent;
+    rect_s        geom;
+    unsigned int  border;
+    int           override_redirect;
+    int           mapped;
+    char          wm_class[64];     /* "instance\0class\0" */
+    int           wm_class_len;
+    list_entry_s  children;
+    list_entry_s  sibling;
+} mock_window_s;
+
+typedef struct mock_reply_s
+{
+    unsigned int         sequence;
+    void                *reply;
+    xcb_generic_error_t *error;
+} mock_reply_s;
+
+/* id -> window, linear probing */
+static mock_window_t *table      = NULL;
+static unsigned int   table_size = 0;
+static unsigned int   table_used = 0;
+
+static mock_window_s  root;
+static xcb_setup_t   *setup = NULL;
+
+static mock_reply_s  *replies      = NULL;
+static unsigned int   replies_size = 0;
+static unsigned int   replies_head = 0;
+static unsigned int   replies_tail = 0;
+
+static xcb_generic_event_t **events      = NULL;
+static unsigned int          events_size = 0;
+static unsigned int          events_head = 0;
+static unsigned int          events_tail = 0;
+
+static unsigned int  sequence  = 0;
+static uint32_t      next_id   = MOCK_ID_BASE;
+static xcb_atom_t    next_atom = MOCK_ATOM_FIRST;
+static unsigned long requests  = 0;
+
+static inline unsigned int
+__slot(xcb_window_t id)
+{
+    return (id * 2654435761u) & (table_size - 1);
+}
+
+static mock_window_t
+__find(xcb_window_t id)
+{
+    unsigned int i;
+
+    if (id == root.id) return &root;
+    if (table_size == 0) return NULL;
+
+    for (i = __slot(id); table[i]; i = (i + 1) & (table_size - 1))
+        if (table[i]->id == id) return table[i];
+    return NULL;
+}
+
+static void
+__insert(mock_window_t w)
+{
+    unsigned int i;
+
+    if ((table_used + 1) * 2 > table_size)
+    {
+        mock_window_t *old = table;
+        unsigned int old_size = table_size;
+
+        table_size = table_size ? table_size * 2 : 1024;
+        table = (mock_window_t *)calloc(table_size, sizeof(mock_window_t));
+        for (i = 0; i < old_size; ++ i)
+            if (old[i])
+            {
+                unsigned int j = __slot(old[i]->id);
+                while (table[j]) j = (j + 1) & (table_size - 1);
+                table[j] = old[i];
+            }
+        free(old);
+    }
+
+    for (i = __slot(w->id); table[i]; i = (i + 1) & (table_size - 1)) ;
+    table[i] = w;
+    ++ table_used;
+}
+
+static void
+__remove(xcb_window_t id)
+{
+    unsigned int i, j, k;
+
+    for (i = __slot(id); table[i]; i = (i + 1) & (table_size - 1))
+        if (table[i]->id == id) break;
+    if (table[i] == NULL) return;
+
+    /* backward shift, so lookups never need tombstones */
+    table[i] = NULL;
+    -- table_used;
+    for (j = (i + 1) & (table_size - 1); table[j]; j = (j + 1) & (table_size - 1))
+    {
+        k = __slot(table[j]->id);
+        if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j)))
+        {
+            table[i] = table[j];
+            table[j] = NULL;
+            i = j;
+        }
+    }
+}
+
+static void
+__reply_push(void *reply, xcb_generic_error_t *error)
+{
+    if (replies_tail - replies_head == replies_size)
+    {
+        unsigned int size = replies_size ? replies_size * 2 : 256;
+        mock_reply_s *r = (mock_reply_s *)malloc(size * sizeof(mock_reply_s));
+        unsigned int i, n = replies_tail - replies_head;
+
+        for (i = 0; i < n; ++ i)
+            r[i] = replies[(replies_head + i) & (replies_size - 1)];
+        free(replies);
+        replies = r;
+        replies_size = size;
+        replies_head = 0;
+        replies_tail = n;
+    }
+
+    mock_reply_s *r = &replies[replies_tail ++ & (replies_size - 1)];
+    r->sequence = sequence;
+    r->reply    = reply;
+    r->error    = error;
+}
+
+static void *
+__reply_new(size_t size)
+{
+    xcb_generic_reply_t *r = (xcb_generic_reply_t *)calloc(1, size < 32 ? 32 : size);
+
+    r->response_type = 1;    /* X_Reply */
+    r->sequence      = sequence;
+    r->length        = size > 32 ? (size - 32 + 3) / 4 : 0;
+    return r;
+}
+
+static unsigned int
+__bad_window(xcb_window_t id)
+{
+    xcb_generic_error_t *e = (xcb_generic_error_t *)calloc(1, sizeof(xcb_generic_error_t));
+
+    e->response_type = 0;
+    e->error_code    = XCB_WINDOW;
+    e->sequence      = sequence;
+    e->resource_id   = id;
+    __reply_push(NULL, e);
+    return sequence;
+}
+
+static unsigned int
+__request(void)
+{
+    ++ requests;
+    return ++ sequence;
+}
+
+static xcb_connection_t *
+__mock_connect(int *screen)
+{
+    xcb_screen_t *s;
+    size_t size = sizeof(xcb_setup_t) + 4 + sizeof(xcb_screen_t);
+
+    setup = (xcb_setup_t *)calloc(1, size);
+    setup->status                 = 1;
+    setup->protocol_major_version = 11;
+    setup->length                 = (size - 8) / 4;
+    setup->resource_id_base       = MOCK_ID_BASE;
+    setup->resource_id_mask       = 0x001fffff;
+    setup->vendor_len             = 4;
+    setup->maximum_request_length = 65535;
+    setup->roots_len              = 1;
+    setup->min_keycode            = 8;
+    setup->max_keycode            = 255;
+    memcpy(setup + 1, "mock", 4);
+
+    s = (xcb_screen_t *)((char *)(setup + 1) + 4);
+    s->root             = MOCK_ROOT;
+    s->white_pixel      = 0xffffff;
+    s->width_in_pixels  = MOCK_WIDTH;
+    s->height_in_pixels = MOCK_HEIGHT;
+    s->root_visual      = 0x21;
+    s->root_depth       = 24;
+
+    root.id     = MOCK_ROOT;
+    root.parent = NULL;
+    root.geom.x = root.geom.y = 0;
+    root.geom.w = MOCK_WIDTH;
+    root.geom.h = MOCK_HEIGHT;
+    root.mapped = 1;
+    list_init(&root.children);
+
+    if (screen) *screen = 0;
+    return xcb_connect_to_fd(-1, NULL);
+}
+
+static int
+__mock_connection_error(void)
+{
+    return setup == NULL;
+}
+
+static const xcb_setup_t *
+__mock_get_setup(void)
+{
+    return setup;
+}
+
+static uint32_t
+__mock_generate_id(void)
+{
+    return ++ next_id;
+}
+
+static xcb_generic_event_t *
+__mock_event_next(int read)
+{
+    if (events_head == events_tail)
+        return NULL;
+    return events[events_head ++ & (events_size - 1)];
+}
+
+static void
+__mock_batch_end(void)
+{ }
+
+static int
+__mock_reply_poll(unsigned int seq, void **reply, xcb_generic_error_t **error)
+{
+    *reply = NULL;
+    *error = NULL;
+
+    if (replies_head == replies_tail)
+        return 1;
+
+    mock_reply_s *r = &replies[replies_head ++ & (replies_size - 1)];
+    *reply = r->reply;
+    *error = r->error;
+    return 1;
+}
+
+static void *
+__mock_reply_wait(unsigned int seq, xcb_generic_error_t **error)
+{
+    void *reply;
+    __mock_reply_poll(seq, &reply, error);
+    return reply;
+}
+
+static unsigned int
+__mock_intern_atom(const char *name, int name_length)
+{
+    xcb_intern_atom_reply_t *r;
+
+    __request();
+    r = (xcb_intern_atom_reply_t *)__reply_new(sizeof(*r));
+    r->atom = next_atom ++;
+    __reply_push(r, NULL);
+    return sequence;
+}
+
+static unsigned int
+__mock_query_tree(xcb_window_t window)
+{
+    mock_window_t w;
+    xcb_query_tree_reply_t *r;
+    list_entry_t cur;
+    int n = 0;
+
+    __request();
+    if ((w = __find(window)) == NULL)
+        return __bad_window(window);
+
+    for (cur = list_next(&w->children); cur != &w->children; cur = list_next(cur))
+        ++ n;
+
+    r = (xcb_query_tree_reply_t *)__reply_new(sizeof(*r) + n * sizeof(xcb_window_t));
+    r->root           = root.id;
+    r->parent         = w->parent ? w->parent->id : XCB_NONE;
+    r->children_len   = n;
+
+    xcb_window_t *children = xcb_query_tree_children(r);
+    n = 0;
+    for (cur = list_next(&w->children); cur != &w->children; cur = list_next(cur))
+        children[n ++] = CONTAINER_OF(cur, mock_window_s, sibling)->id;
+
+    __reply_push(r, NULL);
+    return sequence;
+}
+
+static unsigned int
+__mock_get_geometry(xcb_window_t window)
+{
+    mock_window_t w;
+    xcb_get_geometry_reply_t *r;
+
+    __request();
+    if ((w = __find(window)) == NULL)
+        return __bad_window(window);
+
+    r = (xcb_get_geometry_reply_t *)__reply_new(sizeof(*r));
+    r->depth        = 24;
+    r->root         = root.id;
+    r->x            = w->geom.x;
+    r->y            = w->geom.y;
+    r->width        = w->geom.w;
+    r->height       = w->geom.h;
+    r->border_width = w->border;
+    __reply_push(r, NULL);
+    return sequence;
+}
+
+static unsigned int
+__mock_get_window_attributes(xcb_window_t window)
+{
+    mock_window_t w, a;
+    xcb_get_window_attributes_reply_t *r;
+    int viewable = 1;
+
+    __request();
+    if ((w = __find(window)) == NULL)
+        return __bad_window(window);
+
+    for (a = w; a; a = a->parent)
+        if (!a->mapped) viewable = 0;
+
+    r = (xcb_get_window_attributes_reply_t *)__reply_new(sizeof(*r));
+    r->_class            = XCB_WINDOW_CLASS_INPUT_OUTPUT;
+    r->override_redirect = w->override_redirect;
+    r->map_state         = !w->mapped ? XCB_MAP_STATE_UNMAPPED :
+        viewable ? XCB_MAP_STATE_VIEWABLE : XCB_MAP_STATE_UNVIEWABLE;
+    __reply_push(r, NULL);
+    return sequence;
+}
+
+/* WM_CLASS as set by mock_window_class, every other property is unset */
+static unsigned int
+__mock_get_property(xcb_window_t window, xcb_atom_t property, xcb_atom_t type, uint32_t long_length)
+{
+    mock_window_t w;
+    xcb_get_property_reply_t *r;
+    int len = 0;
+
+    __request();
+    if ((w = __find(window)) == NULL)
+        return __bad_window(window);
+
+    if (property == XCB_ATOM_WM_CLASS && w->wm_class_len)
+        len = w->wm_class_len < (int)long_length * 4 ? w->wm_class_len : (int)long_length * 4;
+
+    r = (xcb_get_property_reply_t *)__reply_new(sizeof(*r) + len);
+    if (len)
+    {
+        r->format    = 8;
+        r->type      = XCB_ATOM_STRING;
+        r->value_len = len;
+        r->bytes_after = w->wm_class_len - len;
+        memcpy(r + 1, w->wm_class, len);
+    }
+    __reply_push(r, NULL);
+    return sequence;
+}
+
+static unsigned int
+__mock_create_window(xcb_window_t window, xcb_window_t parent, rect_t rect,
+                     unsigned int border, xcb_visualid_t visual,
+                     uint32_t mask, const uint32_t *values)
+{
+    int override_redirect = 0;
+
+    __request();
+
+    /* values come in mask order, override-redirect is the tenth */
+    if (mask & XCB_CW_OVERRIDE_REDIRECT)
+        override_redirect = values[__builtin_popcount(mask & (XCB_CW_OVERRIDE_REDIRECT - 1))];
+
+    mock_window_add(window, parent, rect, override_redirect, 0);
+    if (__find(window)) __find(window)->border = border;
+    return sequence;
+}
+
+static unsigned int
+__mock_reparent_window(xcb_window_t window, xcb_window_t parent, int x, int y)
+{
+    mock_window_t w = __find(window), p = __find(parent);
+
+    __request();
+    if (w == NULL || p == NULL || w == &root)
+        return sequence;
+
+    list_del(&w->sibling);
+    list_add_before(&p->children, &w->sibling);
+    w->parent = p;
+    w->geom.x = x;
+    w->geom.y = y;
+    return sequence;
+}
+
+static unsigned int
+__mock_configure_window(xcb_window_t window, uint16_t mask, const uint32_t *values)
+{
+    mock_window_t w = __find(window);
+    int i = 0;
+
+    __request();
+    if (w == NULL) return sequence;
+
+    if (mask & XCB_CONFIG_WINDOW_X)            w->geom.x = (int32_t)values[i ++];
+    if (mask & XCB_CONFIG_WINDOW_Y)            w->geom.y = (int32_t)values[i ++];
+    if (mask & XCB_CONFIG_WINDOW_WIDTH)        w->geom.w = values[i ++];
+    if (mask & XCB_CONFIG_WINDOW_HEIGHT)       w->geom.h = values[i ++];
+    if (mask & XCB_CONFIG_WINDOW_BORDER_WIDTH) w->border = values[i ++];
+    return sequence;
+}
+
+static unsigned int
+__mock_map_window(xcb_window_t window)
+{
+    mock_window_t w = __find(window);
+
+    __request();
+    if (w) w->mapped = 1;
+    return sequence;
+}
+
+static unsigned int
+__mock_unmap_window(xcb_window_t window)
+{
+    mock_window_t w = __find(window);
+
+    __request();
+    if (w && w != &root) w->mapped = 0;
+    return sequence;
+}
+
+static void
+__destroy(mock_window_t w)
+{
+    while (!list_empty(&w->children))
+        __destroy(CONTAINER_OF(list_next(&w->children), mock_window_s, sibling));
+
+    list_del(&w->sibling);
+    __remove(w->id);
+    free(w);
+}
+
+static unsigned int
+__mock_destroy_window(xcb_window_t window)
+{
+    mock_window_t w = __find(window);
+
+    __request();
+    if (w && w != &root) __destroy(w);
+    return sequence;
+}
+
+x_backend_s x_backend_mock =
+{
+    .offline               = 1,
+    .connect               = __mock_connect,
+    .connection_error      = __mock_connection_error,
+    .get_setup             = __mock_get_setup,
+    .generate_id           = __mock_generate_id,
+    .event_next            = __mock_event_next,
+    .batch_end             = __mock_batch_end,
+    .reply_poll            = __mock_reply_poll,
+    .reply_wait            = __mock_reply_wait,
+    .intern_atom           = __mock_intern_atom,
+    .query_tree            = __mock_query_tree,
+    .get_geometry          = __mock_get_geometry,
+    .get_window_attributes = __mock_get_window_attributes,
+    .get_property          = __mock_get_property,
+    .create_window         = __mock_create_window,
+    .reparent_window       = __mock_reparent_window,
+    .configure_window      = __mock_configure_window,
+    .map_window            = __mock_map_window,
+    .unmap_window          = __mock_unmap_window,
+    .destroy_window        = __mock_destroy_window,
+};
+
+void
+mock_use(void)
+{
+    x_backend = &x_backend_mock;
+}
+
+void
+mock_window_add(xcb_window_t window, xcb_window_t parent, rect_t rect, int override_redirect, int mapped)
+{
+    mock_window_t p = __find(parent);
+    mock_window_t w;
+
+    if (p == NULL || __find(window)) return;
+    if ((w = (mock_window_t)malloc(sizeof(mock_window_s))) == NULL) return;
+
+    w->id                = window;
+    w->parent            = p;
+    w->geom              = *rect;
+    w->border            = 0;
+    w->override_redirect = override_redirect;
+    w->mapped            = mapped;
+    w->wm_class_len      = 0;
+    list_init(&w->children);
+    list_add_before(&p->children, &w->sibling);
+    __insert(w);
+}
+
+void
+mock_window_class(xcb_window_t window, const char *instance, const char *class)
+{
+    mock_window_t w = __find(window);
+    int a, b;
+
+    if (w == NULL) return;
+
+    a = strlen(instance) + 1;
+    b = strlen(class) + 1;
+    if (a + b > (int)sizeof(w->wm_class)) return;
+
+    memcpy(w->wm_class, instance, a);
+    memcpy(w->wm_class + a, class, b);
+    w->wm_class_len = a + b;
+}
+
+void
+mock_event_push(const void *event)
+{
+    xcb_generic_event_t *e;
+
+    if (events_tail - events_head == events_size)
+    {
+        unsigned int size = events_size ? events_size * 2 : 1024;
+        xcb_generic_event_t **q = (xcb_generic_event_t **)malloc(size * sizeof(*q));
+        unsigned int i, n = events_tail - events_head;
+
+        for (i = 0; i < n; ++ i)
+            q[i] = events[(events_head + i) & (events_size - 1)];
+        free(events);
+        events = q;
+        events_size = size;
+        events_head = 0;
+        events_tail = n;
+    }
+
+    e = (xcb_generic_event_t *)malloc(sizeof(xcb_generic_event_t));
+    memcpy(e, event, 32);
+    e->full_sequence = e->sequence;
+    events[events_tail ++ & (events_size - 1)] = e;
+}
+
+int
+mock_window_mapped(xcb_window_t window)
+{
+    mock_window_t w = __find(window);
+    return w ? w->mapped : -1;
+}
+
+int
+mock_event_pending(void)
+{
+    return events_tail - events_head;
+}
+
+unsigned long
+mock_requests(void)
+{
+    return requests;
+}
@@ -0,0 +1,329 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "base.h"
+
+#ifdef USE_RANDR
+#include <xcb/randr.h>
+#endif
+
+/* Monitors.
+ *
+ * Every screen starts with one monitor covering its root. Built with
+ * USE_RANDR and given RandR 1.5, the monitors of each screen are read
+ * with GetMonitors and read again on every RandR notify; the clients
+ * of a screen are then placed anew, which is the only time all of
+ * them are visited. Otherwise a client moves between monitors only
+ * when its own geometry changes, and checking that it has not is one
+ * rect test.
+ *
+ * RandR is left alone offline and while recording, so a trace plays
+ * back the same whether or not the build has it. */
+
+typedef struct monitor_query_s
+{
+    int pending;                /* GetMonitors in flight */
+    int again;                  /* changed meanwhile, ask once more */
+} monitor_query_s;
+
+static monitor_query_s *queries = NULL;
+#ifdef USE_RANDR
+static int randr_event_base = -1;
+#endif
+
+static inline int
+__contains(rect_t r, int x, int y)
+{
+    return x >= r->x && y >= r->y &&
+        x < r->x + (int)r->w && y < r->y + (int)r->h;
+}
+
+static int
+__set(screen_t screen, const rect_s *geom, const xcb_atom_t *names, const int *primary, int count)
+{
+    monitor_t monitors = (monitor_t)malloc(count * sizeof(monitor_s));
+    list_entry_t cur;
+    int i;
+
+    if (monitors == NULL) return -1;
+
+    for (i = 0; i < count; ++ i)
+    {
+        monitors[i].screen       = screen;
+        monitors[i].geom         = geom[i];
+        monitors[i].name         = names ? names[i] : XCB_NONE;
+        monitors[i].primary      = primary ? primary[i] : i == 0;
+        monitors[i].client_count = 0;
+        list_init(&monitors[i].clients);
+    }
+
+    free(screen->monitors);
+    screen->monitors      = monitors;
+    screen->monitor_count = count;
+    screen->monitor_last  = 0;
+
+    /* the old lists went with the old array */
+    for (cur = list_next(&screen->client_list); cur != &screen->client_list; cur = list_next(cur))
+        CONTAINER_OF(cur, client_s, client_node)->monitor = NULL;
+    for (cur = list_next(&screen->client_list); cur != &screen->client_list; cur = list_next(cur))
+        client_monitor_update(CONTAINER_OF(cur, client_s, client_node));
+
+    return 0;
+}
+
+static int
+__set_root(screen_t screen)
+{
+    rect_s r = { 0, 0, screen->xcb_screen->width_in_pixels, screen->xcb_screen->height_in_pixels };
+    return __set(screen, &r, NULL, NULL, 1);
+}
+
+#ifdef USE_RANDR
+
+static void __query(int id);
+
+static void
+__monitors_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    int id = (intptr_t)data;
+    screen_t screen = &screens[id];
+    xcb_randr_get_monitors_reply_t *r = (xcb_randr_get_monitors_reply_t *)reply;
+
+    queries[id].pending = 0;
+    if (queries[id].again)
+    {
+        /* this one is already stale */
+        __query(id);
+        return;
+    }
+
+    int n = r ? xcb_randr_get_monitors_monitors_length(r) : 0;
+    if (n == 0)
+    {
+        __set_root(screen);
+        return;
+    }
+
+    rect_s     *geom    = (rect_s *)malloc(n * sizeof(rect_s));
+    xcb_atom_t *names   = (xcb_atom_t *)malloc(n * sizeof(xcb_atom_t));
+    int        *primary = (int *)malloc(n * sizeof(int));
+    xcb_randr_monitor_info_iterator_t it = xcb_randr_get_monitors_monitors_iterator(r);
+    int i;
+
+    if (geom && names && primary)
+    {
+        for (i = 0; it.rem; ++ i, xcb_randr_monitor_info_next(&it))
+        {
+            geom[i].x    = it.data->x;
+            geom[i].y    = it.data->y;
+            geom[i].w    = it.data->width;
+            geom[i].h    = it.data->height;
+            names[i]     = it.data->name;
+            primary[i]   = it.data->primary;
+        }
+        if (__set(screen, geom, names, primary, n) == 0)
+            DEBUGP("screen %d: %d monitors\n", id, n);
+    }
+
+    free(geom);
+    free(names);
+    free(primary);
+}
+
+static void
+__query(int id)
+{
+    queries[id].again   = 0;
+    queries[id].pending = 1;
+    reply_wait(xcb_randr_get_monitors(x_conn, screens[id].xcb_screen->root, 1).sequence,
+               __monitors_cb, (void *)(intptr_t)id);
+}
+
+static void
+__version_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    xcb_randr_query_version_reply_t *r = (xcb_randr_query_version_reply_t *)reply;
+    int i;
+
+    /* GetMonitors is 1.5 */
+    if (r == NULL || r->major_version < 1 ||
+        (r->major_version == 1 && r->minor_version < 5))
+    {
+        randr_event_base = -1;
+        return;
+    }
+
+    for (i = 0; i < screen_count; ++ i)
+    {
+        xcb_randr_select_input(x_conn, screens[i].xcb_screen->root,
+                               XCB_RANDR_NOTIFY_MASK_SCREEN_CHANGE |
+                               XCB_RANDR_NOTIFY_MASK_CRTC_CHANGE |
+                               XCB_RANDR_NOTIFY_MASK_OUTPUT_CHANGE);
+        __query(i);
+    }
+}
+
+static void
+__randr_init(void)
+{
+    const xcb_query_extension_reply_t *ext;
+
+    if (x_backend->offline || trace_mode == TRACE_MODE_RECORD)
+        return;
+
+    ext = xcb_get_extension_data(x_conn, &xcb_randr_id);
+    ++ stats.round_trips;
+    if (ext == NULL || !ext->present)
+        return;
+
+    randr_event_base = ext->first_event;
+    reply_wait(xcb_randr_query_version(x_conn, 1, 5).sequence, __version_cb, NULL);
+}
+
+#endif
+
+int
+monitor_init(void)
+{
+    int i;
+
+    queries = (monitor_query_s *)calloc(screen_count, sizeof(monitor_query_s));
+    if (queries == NULL) return -1;
+
+    for (i = 0; i < screen_count; ++ i)
+    {
+        screens[i].monitors = NULL;
+        if (__set_root(&screens[i]))
+            return -1;
+    }
+
+#ifdef USE_RANDR
+    __randr_init();
+#endif
+    return 0;
+}
+
+int
+monitor_event(xcb_generic_event_t *e)
+{
+#ifdef USE_RANDR
+    int type = e->response_type & ~0x80;
+    xcb_window_t root;
+    int i;
+
+    if (randr_event_base < 0) return 0;
+
+    if (type == randr_event_base + XCB_RANDR_SCREEN_CHANGE_NOTIFY)
+        root = ((xcb_randr_screen_change_notify_event_t *)e)->root;
+    else if (type == randr_event_base + XCB_RANDR_NOTIFY)
+        root = XCB_NONE;
+    else return 0;
+
+    /* a notify names no root, ask for every screen; a burst of them
+     * costs one GetMonitors each, plus one if it arrives mid-flight */
+    for (i = 0; i < screen_count; ++ i)
+    {
+        if (root != XCB_NONE && screens[i].xcb_screen->root != root)
+            continue;
+        if (queries[i].pending) queries[i].again = 1;
+        else __query(i);
+    }
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+monitor_t
+monitor_at(screen_t screen, int x, int y)
+{
+    int i;
+
+    /* most lookups hit the monitor of the one before */
+    if (__contains(&screen->monitors[screen->monitor_last].geom, x, y))
+        return &screen->monitors[screen->monitor_last];
+
+    for (i = 0; i < screen->monitor_count; ++ i)
+        if (__contains(&screen->monitors[i].geom, x, y))
+        {
+            screen->monitor_last = i;
+            return &screen->monitors[i];
+        }
+    return NULL;
+}
+
+static monitor_t
+__nearest(screen_t screen, int x, int y)
+{
+    monitor_t best = &screen->monitors[0];
+    long best_d = -1;
+    int i;
+
+    for (i = 0; i < screen->monitor_count; ++ i)
+    {
+        rect_t r = &screen->monitors[i].geom;
+        long dx = x < r->x ? r->x - x : x >= r->x + (int)r->w ? x - (r->x + (int)r->w - 1) : 0;
+        long dy = y < r->y ? r->y - y : y >= r->y + (int)r->h ? y - (r->y + (int)r->h - 1) : 0;
+        long d = dx * dx + dy * dy;
+
+        if (best_d < 0 || d < best_d)
+        {
+            best = &screen->monitors[i];
+            best_d = d;
+        }
+    }
+    return best;
+}
+
+/* Put the client on the monitor its centre is on, or the nearest one */
+void
+client_monitor_update(client_t client)
+{
+    screen_t screen = client->screen;
+    rect_t r = &client->geom[client->xcb_container != XCB_NONE ? CLIENT_GEOM_CONTAINER : CLIENT_GEOM_WINDOW];
+    int cx = r->x + (int)r->w / 2;
+    int cy = r->y + (int)r->h / 2;
+    monitor_t m;
+
+    if (screen->monitors == NULL) return;
+    if (client->monitor && __contains(&client->monitor->geom, cx, cy))
+        return;
+
+    m = monitor_at(screen, cx, cy);
+    if (m == NULL) m = __nearest(screen, cx, cy);
+    if (m == client->monitor) return;
+
+    if (client->monitor)
+    {
+        list_del(&client->monitor_node);
+        -- client->monitor->client_count;
+    }
+    client->monitor = m;
+    list_add_before(&m->clients, &client->monitor_node);
+    ++ m->client_count;
+}
+
+void
+client_monitor_detach(client_t client)
+{
+    if (client->monitor == NULL) return;
+
+    list_del(&client->monitor_node);
+    -- client->monitor->client_count;
+    client->monitor = NULL;
+}
+
+void
+monitor_cleanup(void)
+{
+    int i;
+
+    for (i = 0; i < screen_count && screens; ++ i)
+    {
+        free(screens[i].monitors);
+        screens[i].monitors = NULL;
+        screens[i].monitor_count = 0;
+    }
+    free(queries);
+    queries = NULL;
+}
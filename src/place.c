@@ -0,0 +1,239 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "base.h"
+
+/* Smart placement.
+ *
+ * Each screen is cut into PLACE_CELL sized cells, and every desktop
+ * (plus one grid for DESKTOP_ALL) has a grid counting how many mapped
+ * clients cover each cell. A client moves in the grids only when the
+ * cells it covers change, so a desktop switch or a small move costs
+ * nothing here.
+ *
+ * Placing a window sums the grid of the current desktop and the
+ * DESKTOP_ALL one over its monitor into a summed area table; the
+ * overlap of every cell aligned position is then four lookups. The
+ * cost depends on the monitor size, not on the number of windows. The
+ * position with the least overlap wins, and among equal ones the
+ * topmost, then leftmost. */
+
+#define PLACE_CELL 16
+
+int place_mode = PLACE_MODE_AS_IS;
+
+typedef struct place_screen_s
+{
+    unsigned int cols, rows;
+    uint16_t   **grid;          /* desktop_count + 1, allocated on use */
+} place_screen_s;
+
+static place_screen_s *place_screens = NULL;
+
+static uint32_t *sat      = NULL;
+static size_t    sat_size = 0;
+
+int
+place_init(void)
+{
+    int i;
+
+    place_screens = (place_screen_s *)calloc(screen_count, sizeof(place_screen_s));
+    if (place_screens == NULL) return -1;
+
+    for (i = 0; i < screen_count; ++ i)
+    {
+        place_screen_s *ps = &place_screens[i];
+        ps->cols = (screens[i].xcb_screen->width_in_pixels + PLACE_CELL - 1) / PLACE_CELL;
+        ps->rows = (screens[i].xcb_screen->height_in_pixels + PLACE_CELL - 1) / PLACE_CELL;
+        ps->grid = (uint16_t **)calloc(desktop_count + 1, sizeof(uint16_t *));
+        if (ps->grid == NULL) return -1;
+    }
+    return 0;
+}
+
+static inline place_screen_s *
+__screen(client_t client)
+{
+    return &place_screens[client->screen - screens];
+}
+
+static inline int
+__clamp(int v, int lo, int hi)
+{
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+static void
+__add(place_screen_s *ps, int g, const uint16_t *c, int delta)
+{
+    uint16_t *grid = ps->grid[g];
+    unsigned int x, y;
+
+    if (grid == NULL)
+    {
+        if (delta < 0) return;
+        grid = ps->grid[g] = (uint16_t *)calloc(ps->cols * ps->rows, sizeof(uint16_t));
+        if (grid == NULL) return;
+    }
+
+    for (y = c[1]; y < c[3]; ++ y)
+    {
+        uint16_t *row = grid + y * ps->cols;
+        for (x = c[0]; x < c[2]; ++ x)
+            row[x] += delta;
+    }
+}
+
+/* Cells the outer rect of the client covers, clipped to the screen */
+static void
+__cells(place_screen_s *ps, client_t client, uint16_t *c)
+{
+    rect_t r = &client->geom[client->xcb_container != XCB_NONE ? CLIENT_GEOM_CONTAINER : CLIENT_GEOM_WINDOW];
+
+    c[0] = __clamp(r->x / PLACE_CELL, 0, ps->cols);
+    c[1] = __clamp(r->y / PLACE_CELL, 0, ps->rows);
+    c[2] = __clamp((r->x + (int)r->w + PLACE_CELL - 1) / PLACE_CELL, 0, ps->cols);
+    c[3] = __clamp((r->y + (int)r->h + PLACE_CELL - 1) / PLACE_CELL, 0, ps->rows);
+}
+
+void
+client_place_update(client_t client)
+{
+    place_screen_s *ps;
+    uint16_t c[4];
+    int g;
+
+    if (place_screens == NULL) return;
+    ps = __screen(client);
+
+    g = client->mapped ? (client->desktop == DESKTOP_ALL ? (int)desktop_count : (int)client->desktop) : -1;
+    if (g >= 0) __cells(ps, client, c);
+
+    if (g == client->place_grid &&
+        (g < 0 || memcmp(c, client->place_cells, sizeof(c)) == 0))
+        return;
+
+    if (client->place_grid >= 0)
+        __add(ps, client->place_grid, client->place_cells, -1);
+    client->place_grid = g;
+    if (g >= 0)
+    {
+        memcpy(client->place_cells, c, sizeof(c));
+        __add(ps, g, c, 1);
+    }
+}
+
+void
+client_place_detach(client_t client)
+{
+    if (place_screens == NULL || client->place_grid < 0) return;
+
+    __add(__screen(client), client->place_grid, client->place_cells, -1);
+    client->place_grid = -1;
+}
+
+/* Move rect, of a client not in the grids yet, to the spot of its
+ * monitor it overlaps the others least on */
+void
+place_find(client_t client, rect_t rect)
+{
+    place_screen_s *ps;
+    monitor_t m;
+    const uint16_t *a, *b;
+    unsigned int x0, y0, x1, y1, cols, rows, wc, hc, x, y;
+    unsigned int best_x = 0, best_y = 0;
+    uint64_t best = UINT64_MAX;
+
+    if (place_screens == NULL) return;
+    ps = __screen(client);
+
+    /* the monitor it asked to be on */
+    m = monitor_at(client->screen, rect->x + (int)rect->w / 2, rect->y + (int)rect->h / 2);
+    if (m == NULL) m = &client->screen->monitors[0];
+
+    x0 = __clamp((m->geom.x + PLACE_CELL - 1) / PLACE_CELL, 0, ps->cols);
+    y0 = __clamp((m->geom.y + PLACE_CELL - 1) / PLACE_CELL, 0, ps->rows);
+    x1 = __clamp((m->geom.x + (int)m->geom.w) / PLACE_CELL, 0, ps->cols);
+    y1 = __clamp((m->geom.y + (int)m->geom.h) / PLACE_CELL, 0, ps->rows);
+    cols = x1 > x0 ? x1 - x0 : 0;
+    rows = y1 > y0 ? y1 - y0 : 0;
+    wc = (rect->w + 2 + PLACE_CELL - 1) / PLACE_CELL;   /* with the border */
+    hc = (rect->h + 2 + PLACE_CELL - 1) / PLACE_CELL;
+
+    if (wc > cols || hc > rows)
+    {
+        /* does not fit, show its top left at least */
+        rect->x = m->geom.x;
+        rect->y = m->geom.y;
+        return;
+    }
+
+    if (sat_size < (size_t)(cols + 1) * (rows + 1))
+    {
+        uint32_t *s = (uint32_t *)realloc(sat, (size_t)(cols + 1) * (rows + 1) * sizeof(uint32_t));
+        if (s == NULL) return;
+        sat = s;
+        sat_size = (size_t)(cols + 1) * (rows + 1);
+    }
+
+    a = ps->grid[client->screen->desktop_current];
+    b = ps->grid[desktop_count];
+
+    /* sat[(y + 1) * (cols + 1) + x + 1] sums the cells above and left */
+    memset(sat, 0, (cols + 1) * sizeof(uint32_t));
+    for (y = 0; y < rows; ++ y)
+    {
+        uint32_t *row = sat + (y + 1) * (cols + 1), *up = row - (cols + 1);
+        size_t off = (size_t)(y + y0) * ps->cols + x0;
+        uint32_t sum = 0;
+
+        row[0] = 0;
+        for (x = 0; x < cols; ++ x)
+        {
+            sum += (a ? a[off + x] : 0) + (b ? b[off + x] : 0);
+            row[x + 1] = up[x + 1] + sum;
+        }
+    }
+
+    for (y = 0; y + hc <= rows && best; ++ y)
+    {
+        const uint32_t *top = sat + y * (cols + 1), *bottom = sat + (y + hc) * (cols + 1);
+        for (x = 0; x + wc <= cols; ++ x)
+        {
+            uint64_t o = bottom[x + wc] - bottom[x] - top[x + wc] + top[x];
+            if (o < best)
+            {
+                best = o;
+                best_x = x;
+                best_y = y;
+                if (o == 0) break;
+            }
+        }
+    }
+
+    rect->x = (x0 + best_x) * PLACE_CELL;
+    rect->y = (y0 + best_y) * PLACE_CELL;
+}
+
+void
+place_cleanup(void)
+{
+    int i;
+    unsigned int d;
+
+    if (place_screens == NULL) return;
+
+    for (i = 0; i < screen_count; ++ i)
+    {
+        if (place_screens[i].grid == NULL) continue;
+        for (d = 0; d <= desktop_count; ++ d)
+            free(place_screens[i].grid[d]);
+        free(place_screens[i].grid);
+    }
+    free(place_screens);
+    place_screens = NULL;
+    free(sat);
+    sat = NULL;
+    sat_size = 0;
+}
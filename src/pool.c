@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "base.h"
+
+/* Fixed size object pools.
+ *
+ * Objects are cut from chunks of per_chunk objects; a freed object
+ * goes on the pool's free list, its first word being the link. Chunks
+ * are only returned to the system by pool_destroy, so a map/destroy
+ * storm settles into list pushes and pops once the pool has grown to
+ * the storm's high-water mark. */
+
+#define POOL_ALIGN 16
+
+typedef struct pool_chunk_s
+{
+    struct pool_chunk_s *next;
+    /* objects follow, aligned */
+} pool_chunk_s;
+
+#define POOL_CHUNK_HEADER ((sizeof(pool_chunk_s) + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1))
+
+pool_t pools = NULL;
+
+void
+pool_init(pool_t pool, const char *name, size_t size, unsigned int per_chunk)
+{
+    if (size < sizeof(void *)) size = sizeof(void *);
+
+    pool->name      = name;
+    pool->size      = (size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+    pool->per_chunk = per_chunk ? per_chunk : 1;
+    pool->free      = NULL;
+    pool->chunks    = NULL;
+    pool->live      = 0;
+    pool->high      = 0;
+    pool->allocs    = 0;
+    pool->nchunks   = 0;
+
+    pool->next = pools;
+    pools = pool;
+}
+
+static int
+__pool_grow(pool_t pool)
+{
+    pool_chunk_s *chunk = (pool_chunk_s *)malloc(POOL_CHUNK_HEADER + pool->size * pool->per_chunk);
+    char *obj;
+    unsigned int i;
+
+    if (chunk == NULL) return -1;
+
+    chunk->next = (pool_chunk_s *)pool->chunks;
+    pool->chunks = chunk;
+    ++ pool->nchunks;
+
+    /* thread the new objects so the first one is handed out first */
+    obj = (char *)chunk + POOL_CHUNK_HEADER + pool->size * (pool->per_chunk - 1);
+    for (i = 0; i < pool->per_chunk; ++ i, obj -= pool->size)
+    {
+        *(void **)obj = pool->free;
+        pool->free = obj;
+    }
+    return 0;
+}
+
+void *
+pool_alloc(pool_t pool)
+{
+    void *obj;
+
+    if (pool->free == NULL && __pool_grow(pool))
+        return NULL;
+
+    obj = pool->free;
+    pool->free = *(void **)obj;
+
+    ++ pool->allocs;
+    if (++ pool->live > pool->high)
+        pool->high = pool->live;
+    return obj;
+}
+
+void
+pool_free(pool_t pool, void *obj)
+{
+    if (obj == NULL) return;
+
+    *(void **)obj = pool->free;
+    pool->free = obj;
+    -- pool->live;
+}
+
+void
+pool_destroy(pool_t pool)
+{
+    pool_chunk_s *chunk = (pool_chunk_s *)pool->chunks;
+    pool_t *p;
+
+    while (chunk)
+    {
+        pool_chunk_s *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    pool->chunks  = NULL;
+    pool->free    = NULL;
+    pool->live    = 0;
+    pool->nchunks = 0;
+
+    for (p = &pools; *p; p = &(*p)->next)
+    {
+        if (*p == pool)
+        {
+            *p = pool->next;
+            break;
+        }
+    }
+}
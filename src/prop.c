@@ -0,0 +1,357 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "base.h"
+
+/* Client property cache.
+ *
+ * Nothing is read until somebody asks: client_prop_get of a property
+ * that is not cached sends the GetProperty and returns NULL, the reply
+ * is parsed into client->props and the class is told through
+ * client_aevent_property. Several properties asked for together go out
+ * back to back and come in with one read.
+ *
+ * PropertyNotify only marks a property. One that was never asked for
+ * is dropped from the cache; one that was is refetched by prop_flush
+ * at the end of the batch, so a client rewriting its title ten times
+ * in a batch costs one request. A reply to a fetch that was overtaken
+ * by a change is recognized by its sequence and ignored. */
+
+typedef void(*prop_parse_f)(client_t client, xcb_get_property_reply_t *prop);
+
+typedef struct prop_desc_s
+{
+    xcb_atom_t   atom;
+    xcb_atom_t   type;
+    uint32_t     length;        /* in 32 bit units */
+    prop_parse_f parse;
+} prop_desc_s;
+
+static prop_desc_s  descs[CLIENT_PROP_COUNT];
+static list_entry_s dirty_clients = { &dirty_clients, &dirty_clients };
+
+/* X resource ids leave the top 3 bits clear, which is where the
+ * property goes in a reply's data */
+#define PROP_DATA(window, prop) ((void *)(uintptr_t)(((uintptr_t)(window) << 3) | (prop)))
+#define PROP_DATA_WINDOW(data)  ((xcb_window_t)((uintptr_t)(data) >> 3))
+#define PROP_DATA_PROP(data)    ((int)((uintptr_t)(data) & 7))
+
+static void
+__parse_string(char *out, xcb_get_property_reply_t *prop, int utf8)
+{
+    int len = prop ? xcb_get_property_value_length(prop) : 0;
+    const char *v = prop ? (const char *)xcb_get_property_value(prop) : NULL;
+
+    if (prop && prop->format != 8) len = 0;
+    if (len > CLIENT_TITLE_MAX - 1)
+    {
+        len = CLIENT_TITLE_MAX - 1;
+        /* do not leave half a character behind */
+        if (utf8 && (v[len] & 0xc0) == 0x80)
+            while (len > 0 && (v[-- len] & 0xc0) == 0x80) ;
+    }
+
+    if (len) memcpy(out, v, len);
+    out[len] = 0;
+}
+
+static void
+__parse_wm_name(client_t client, xcb_get_property_reply_t *prop)
+{
+    __parse_string(client->props.wm_name, prop, 0);
+}
+
+static void
+__parse_net_wm_name(client_t client, xcb_get_property_reply_t *prop)
+{
+    __parse_string(client->props.net_wm_name, prop, 1);
+}
+
+static inline const uint32_t *
+__card32(xcb_get_property_reply_t *prop, int *n)
+{
+    if (prop == NULL || prop->format != 32)
+    {
+        *n = 0;
+        return NULL;
+    }
+    *n = xcb_get_property_value_length(prop) / 4;
+    return (const uint32_t *)xcb_get_property_value(prop);
+}
+
+static void
+__parse_wm_hints(client_t client, xcb_get_property_reply_t *prop)
+{
+    client_wm_hints_s *h = &client->props.hints;
+    int n;
+    const uint32_t *v = __card32(prop, &n);
+
+    memset(h, 0, sizeof(*h));
+    if (n < 9) return;
+
+    h->flags = v[0];
+    if (h->flags & WM_HINTS_INPUT) h->input         = v[1];
+    if (h->flags & WM_HINTS_STATE) h->initial_state = v[2];
+    if (h->flags & WM_HINTS_GROUP) h->group         = v[8];
+}
+
+static void
+__parse_normal_hints(client_t client, xcb_get_property_reply_t *prop)
+{
+    client_size_hints_s *h = &client->props.size_hints;
+    int n;
+    const uint32_t *v = __card32(prop, &n);
+
+    memset(h, 0, sizeof(*h));
+    /* pre-ICCCM clients send 15 without base size and gravity */
+    if (n < 15) return;
+
+    h->flags = v[0];
+    if (n < 18) h->flags &= ~(SIZE_HINTS_BASE | SIZE_HINTS_GRAVITY);
+
+    if (h->flags & SIZE_HINTS_MIN)
+    { h->min_w = (int32_t)v[5]; h->min_h = (int32_t)v[6]; }
+    if (h->flags & SIZE_HINTS_MAX)
+    { h->max_w = (int32_t)v[7]; h->max_h = (int32_t)v[8]; }
+    if (h->flags & SIZE_HINTS_INC)
+    { h->inc_w = (int32_t)v[9]; h->inc_h = (int32_t)v[10]; }
+    if (h->flags & SIZE_HINTS_ASPECT)
+    {
+        h->min_aspect_num = (int32_t)v[11]; h->min_aspect_den = (int32_t)v[12];
+        h->max_aspect_num = (int32_t)v[13]; h->max_aspect_den = (int32_t)v[14];
+    }
+    if (h->flags & SIZE_HINTS_BASE)
+    { h->base_w = (int32_t)v[15]; h->base_h = (int32_t)v[16]; }
+    if (h->flags & SIZE_HINTS_GRAVITY)
+        h->gravity = (int32_t)v[17];
+}
+
+static void
+__parse_protocols(client_t client, xcb_get_property_reply_t *prop)
+{
+    int i, n;
+    const uint32_t *v = __card32(prop, &n);
+    uint32_t p = 0;
+
+    for (i = 0; i < n; ++ i)
+    {
+        if (v[i] == ATOM(WM_DELETE_WINDOW))          p |= CLIENT_PROTOCOL_DELETE_WINDOW;
+        else if (v[i] == ATOM(WM_TAKE_FOCUS))        p |= CLIENT_PROTOCOL_TAKE_FOCUS;
+        else if (v[i] == ATOM(_NET_WM_PING))         p |= CLIENT_PROTOCOL_PING;
+        else if (v[i] == ATOM(_NET_WM_SYNC_REQUEST)) p |= CLIENT_PROTOCOL_SYNC_REQUEST;
+    }
+    client->props.protocols = p;
+}
+
+static void
+__parse_net_wm_state(client_t client, xcb_get_property_reply_t *prop)
+{
+    int i, s, n;
+    const uint32_t *v = __card32(prop, &n);
+    uint32_t state = 0;
+
+    for (i = 0; i < n; ++ i)
+        for (s = 0; s < CLIENT_STATE_COUNT; ++ s)
+            if (v[i] == atoms[ATOM_ID(_NET_WM_STATE_MODAL) + s])
+            {
+                state |= 1u << s;
+                break;
+            }
+    client->props.state = state;
+}
+
+static void
+__parse_sync_counter(client_t client, xcb_get_property_reply_t *prop)
+{
+    int n;
+    const uint32_t *v = __card32(prop, &n);
+
+    /* a second one is the extended counter, we use the basic one */
+    client->props.sync_counter = n ? v[0] : XCB_NONE;
+}
+
+void
+prop_init(void)
+{
+    descs[CLIENT_PROP_WM_NAME] = (prop_desc_s)
+        { XCB_ATOM_WM_NAME, XCB_GET_PROPERTY_TYPE_ANY, CLIENT_TITLE_MAX / 4, __parse_wm_name };
+    descs[CLIENT_PROP_NET_WM_NAME] = (prop_desc_s)
+        { ATOM(_NET_WM_NAME), ATOM(UTF8_STRING), CLIENT_TITLE_MAX / 4, __parse_net_wm_name };
+    descs[CLIENT_PROP_WM_HINTS] = (prop_desc_s)
+        { XCB_ATOM_WM_HINTS, XCB_ATOM_WM_HINTS, 9, __parse_wm_hints };
+    descs[CLIENT_PROP_NORMAL_HINTS] = (prop_desc_s)
+        { XCB_ATOM_WM_NORMAL_HINTS, XCB_ATOM_WM_SIZE_HINTS, 18, __parse_normal_hints };
+    descs[CLIENT_PROP_PROTOCOLS] = (prop_desc_s)
+        { ATOM(WM_PROTOCOLS), XCB_ATOM_ATOM, 32, __parse_protocols };
+    descs[CLIENT_PROP_NET_WM_STATE] = (prop_desc_s)
+        { ATOM(_NET_WM_STATE), XCB_ATOM_ATOM, 32, __parse_net_wm_state };
+    descs[CLIENT_PROP_SYNC_COUNTER] = (prop_desc_s)
+        { ATOM(_NET_WM_SYNC_REQUEST_COUNTER), XCB_ATOM_CARDINAL, 2, __parse_sync_counter };
+}
+
+static void
+__prop_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    int p = PROP_DATA_PROP(data);
+    xcb_get_property_reply_t *prop = (xcb_get_property_reply_t *)reply;
+    wnd_dict_node_t node;
+    client_t client;
+
+    /* an error means the window is gone, its DestroyNotify is coming */
+    if (prop == NULL) return;
+
+    node = wnd_dict_find(PROP_DATA_WINDOW(data), WND_DICT_FIND_OP_NONE);
+    if (node == NULL || node->role != WND_ROLE_CLIENT) return;
+    client = (client_t)node->link;
+
+    /* detached and attached again, or overtaken by a change */
+    if (!(client->props.fetching & CLIENT_PROP_BIT(p)) ||
+        (uint16_t)client->props.seq[p] != prop->sequence)
+        return;
+
+    client->props.fetching &= ~CLIENT_PROP_BIT(p);
+    descs[p].parse(client, prop);
+    client->props.valid |= CLIENT_PROP_BIT(p);
+
+    if (client->class && client->class->client_aevent_property)
+        client->class->client_aevent_property(client->class, client, p);
+}
+
+static void
+__fetch(client_t client, int p)
+{
+    unsigned int seq = x_get_property(client->xcb_window, descs[p].atom,
+                                      descs[p].type, descs[p].length);
+
+    client->props.seq[p] = seq;
+    client->props.fetching |= CLIENT_PROP_BIT(p);
+    ++ stats.prop_fetches;
+    reply_wait(seq, __prop_cb, PROP_DATA(client->xcb_window, p));
+}
+
+void
+client_prop_attach(client_t client)
+{
+    memset(&client->props, 0, sizeof(client->props));
+}
+
+void
+client_prop_detach(client_t client)
+{
+    /* replies still in flight find the window gone */
+    if (client->props.dirty)
+        list_del(&client->props.dirty_node);
+    client->props.dirty = 0;
+    client->props.fetching = 0;
+}
+
+void
+client_prop_fetch(client_t client, unsigned int mask)
+{
+    int p;
+
+    client->props.wanted |= mask;
+    mask &= ~(client->props.valid | client->props.fetching | client->props.dirty);
+
+    for (p = 0; mask; ++ p, mask >>= 1)
+        if (mask & 1) __fetch(client, p);
+}
+
+const void *
+client_prop_get(client_t client, int prop)
+{
+    client_props_t props = &client->props;
+
+    if (!(props->valid & CLIENT_PROP_BIT(prop)))
+    {
+        client_prop_fetch(client, CLIENT_PROP_BIT(prop));
+        return NULL;
+    }
+
+    /* still wanted from now on */
+    props->wanted |= CLIENT_PROP_BIT(prop);
+
+    switch (prop)
+    {
+    case CLIENT_PROP_WM_NAME:      return props->wm_name;
+    case CLIENT_PROP_NET_WM_NAME:  return props->net_wm_name;
+    case CLIENT_PROP_WM_HINTS:     return &props->hints;
+    case CLIENT_PROP_NORMAL_HINTS: return &props->size_hints;
+    case CLIENT_PROP_PROTOCOLS:    return &props->protocols;
+    case CLIENT_PROP_NET_WM_STATE: return &props->state;
+    case CLIENT_PROP_SYNC_COUNTER: return &props->sync_counter;
+    }
+    return NULL;
+}
+
+/* _NET_WM_NAME if the client has one, else WM_NAME; "" until known */
+const char *
+client_title(client_t client)
+{
+    const char *net = (const char *)client_prop_get(client, CLIENT_PROP_NET_WM_NAME);
+    const char *name = (const char *)client_prop_get(client, CLIENT_PROP_WM_NAME);
+
+    if (net && net[0]) return net;
+    return name ? name : "";
+}
+
+void
+client_prop_changed(client_t client, xcb_atom_t atom, int deleted)
+{
+    client_props_t props = &client->props;
+    int p;
+
+    for (p = 0; p < CLIENT_PROP_COUNT; ++ p)
+        if (descs[p].atom == atom) break;
+    if (p == CLIENT_PROP_COUNT) return;
+
+    /* whatever is in flight predates this */
+    props->fetching &= ~CLIENT_PROP_BIT(p);
+
+    if (!(props->wanted & CLIENT_PROP_BIT(p)))
+    {
+        props->valid &= ~CLIENT_PROP_BIT(p);
+        return;
+    }
+
+    if (deleted)
+    {
+        /* known without asking */
+        if (props->dirty & CLIENT_PROP_BIT(p))
+        {
+            props->dirty &= ~CLIENT_PROP_BIT(p);
+            if (!props->dirty) list_del(&props->dirty_node);
+        }
+        descs[p].parse(client, NULL);
+        props->valid |= CLIENT_PROP_BIT(p);
+        if (client->class && client->class->client_aevent_property)
+            client->class->client_aevent_property(client->class, client, p);
+        return;
+    }
+
+    if (!props->dirty)
+        list_add_before(&dirty_clients, &props->dirty_node);
+    props->dirty |= CLIENT_PROP_BIT(p);
+}
+
+void
+prop_flush(void)
+{
+    while (list_next(&dirty_clients) != &dirty_clients)
+    {
+        client_props_t props = CONTAINER_OF(list_next(&dirty_clients), client_props_s, dirty_node);
+        client_t client = CONTAINER_OF(props, client_s, props);
+        unsigned int mask = props->dirty;
+        int p;
+
+        list_del(&props->dirty_node);
+        props->dirty = 0;
+
+        for (p = 0; mask; ++ p, mask >>= 1)
+            if (mask & 1)
+            {
+                ++ stats.prop_refetches;
+                __fetch(client, p);
+            }
+    }
+}
@@ -0,0 +1,121 @@
+#include <stdlib.h>
+
+#include "base.h"
+
+/* Pending replies, in request order. Since the server answers in
+ * sequence order, only the head of the queue ever needs polling. */
+
+typedef struct reply_entry_s
+{
+    unsigned int      sequence;
+    reply_callback_f  callback;
+    void             *data;
+} reply_entry_s;
+
+static reply_entry_s *ring      = NULL;
+static unsigned int   ring_size = 0;
+static unsigned int   ring_head = 0;
+static unsigned int   ring_tail = 0;
+
+static int
+__ring_grow(void)
+{
+    unsigned int size = ring_size ? ring_size * 2 : 64;
+    reply_entry_s *r = (reply_entry_s *)malloc(size * sizeof(reply_entry_s));
+    unsigned int i, n = ring_tail - ring_head;
+
+    if (r == NULL) return -1;
+
+    for (i = 0; i < n; ++ i)
+        r[i] = ring[(ring_head + i) & (ring_size - 1)];
+
+    free(ring);
+    ring = r;
+    ring_size = size;
+    ring_head = 0;
+    ring_tail = n;
+
+    return 0;
+}
+
+void
+reply_wait(unsigned int sequence, reply_callback_f callback, void *data)
+{
+    if (ring_tail - ring_head == ring_size && __ring_grow())
+    {
+        /* out of memory, fall back to the blocking path */
+        xcb_generic_error_t *error = NULL;
+        void *reply = x_reply_wait(sequence, &error);
+        ++ stats.round_trips;
+        callback(data, reply, error);
+        free(reply);
+        free(error);
+        return;
+    }
+
+    reply_entry_s *e = &ring[ring_tail & (ring_size - 1)];
+    e->sequence = sequence;
+    e->callback = callback;
+    e->data     = data;
+    ++ ring_tail;
+}
+
+static void
+__complete(void *reply, xcb_generic_error_t *error)
+{
+    /* pop before calling, the callback may queue new requests */
+    reply_entry_s e = ring[ring_head & (ring_size - 1)];
+    ++ ring_head;
+
+    e.callback(e.data, reply, error);
+    free(reply);
+    free(error);
+}
+
+int
+reply_process(void)
+{
+    int done = 0;
+
+    while (ring_head != ring_tail)
+    {
+        void *reply = NULL;
+        xcb_generic_error_t *error = NULL;
+
+        if (!x_reply_poll(ring[ring_head & (ring_size - 1)].sequence, &reply, &error))
+            break;
+
+        ++ stats.replies;
+        __complete(reply, error);
+        ++ done;
+    }
+
+    return done;
+}
+
+void
+reply_drain(void)
+{
+    while (ring_head != ring_tail)
+    {
+        unsigned int sequence = ring[ring_head & (ring_size - 1)].sequence;
+        xcb_generic_error_t *error = NULL;
+        void *reply = NULL;
+
+        /* the rest of a pipelined batch is mostly in already, and only
+         * the waits are round trips */
+        if (!x_reply_poll(sequence, &reply, &error))
+        {
+            reply = x_reply_wait(sequence, &error);
+            ++ stats.round_trips;
+        }
+
+        __complete(reply, error);
+    }
+}
+
+int
+reply_pending(void)
+{
+    return ring_tail - ring_head;
+}
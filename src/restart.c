@@ -0,0 +1,315 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "base.h"
+
+/* Hot restart.
+ *
+ * wm_restart ends the loop, and wm_cleanup calls restart_save before
+ * it lets go of the clients. The clients whose class can resume them
+ * go into a memfd: one header, a restart_screen_s per screen, then a
+ * restart_client_s per client in client_list order. Their containers
+ * are left where they are, with their grabs and event selections
+ * dropped, and the connection closes with RetainPermanent so the
+ * server keeps them. All other clients are detached and stay mapped.
+ * main then execs the binary again with the same arguments and the
+ * descriptor in $CWM_RESTART_FD. What is executed is settled by
+ * wm_restart, through restart_prepare, before anything is let go:
+ * argv[0] looked up as execvp would, so an upgraded binary is the one
+ * started, or else /proc/self/exe.
+ *
+ * The (window, container) pairs also go on each root, as WINDOW pairs
+ * in _CWM_RESTART_FRAMES, a format that never changes. Whatever
+ * becomes of the state, the next start takes the windows no class
+ * resumed out of their containers from there and destroys the
+ * containers, so a failed exec or an upgrade leaves nothing behind.
+ *
+ * The new process calls restart_load from wm_setup. A wrong magic,
+ * version, record size, file size, checksum or set of roots throws
+ * the state away, and every window is adopted as on a cold start.
+ * base.c then confirms that all the windows are still there in one
+ * round trip and hands each client back to its class. The scan for
+ * everything else follows, and it skips the windows already taken.
+ *
+ * No restart happens while recording. The new process would start
+ * from state that is not in the trace. */
+
+#define RESTART_MAGIC   0x524d5743      /* "CWMR" */
+#define RESTART_VERSION 1
+#define RESTART_ENV     "CWM_RESTART_FD"
+
+typedef struct restart_header_s
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;       /* sizeof(restart_client_s), for the layout */
+    uint32_t screen_count;
+    uint32_t client_count;
+    uint32_t desktop_count;
+    uint64_t size;
+    uint64_t checksum;          /* of all that follows the header */
+} restart_header_s;
+
+int restart_requested = 0;
+
+static char *const *restart_argv = NULL;
+static char         restart_target[PATH_MAX];
+
+static int    restart_fd = -1;
+static void  *map        = MAP_FAILED;
+static size_t map_size   = 0;
+
+static uint64_t
+__checksum(const unsigned char *p, size_t n)
+{
+    uint64_t h = 0xcbf29ce484222325ull;
+
+    while (n --)
+    {
+        h ^= *p ++;
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static int
+__open(void)
+{
+    FILE *f;
+    int fd;
+
+    /* not close-on-exec, the next process reads it */
+    fd = memfd_create("cwm-restart", 0);
+    if (fd >= 0 || errno != ENOSYS) return fd;
+
+    /* an unlinked file where there is no memfd */
+    if ((f = tmpfile()) == NULL) return -1;
+    fd = dup(fileno(f));
+    fclose(f);
+    return fd;
+}
+
+void
+restart_init(char *const *argv)
+{
+    restart_argv = argv;
+}
+
+/* The file execvp would run for name, into restart_target */
+static int
+__resolve(const char *name)
+{
+    const char *path, *end;
+    int n;
+
+    if (strchr(name, '/'))
+    {
+        n = snprintf(restart_target, sizeof(restart_target), "%s", name);
+        return n < sizeof(restart_target) && access(restart_target, X_OK) == 0 ? 0 : -1;
+    }
+
+    if ((path = getenv("PATH")) == NULL) path = "/bin:/usr/bin";
+    for (; *path; path = *end ? end + 1 : end)
+    {
+        end = strchrnul(path, ':');
+        n = snprintf(restart_target, sizeof(restart_target), "%.*s/%s",
+                     end == path ? 1 : (int)(end - path), end == path ? "." : path, name);
+        if (n < sizeof(restart_target) && access(restart_target, X_OK) == 0)
+            return 0;
+    }
+    return -1;
+}
+
+/* Settle what restart_exec will run; -1 if there is nothing to run */
+int
+restart_prepare(void)
+{
+    if (restart_argv && restart_argv[0] && __resolve(restart_argv[0]) == 0)
+        return 0;
+    /* gone if the binary was replaced under a name we cannot find */
+    if (__resolve("/proc/self/exe") == 0)
+        return 0;
+    restart_target[0] = 0;
+    return -1;
+}
+
+/* Returns the number of clients saved, or -1 */
+int
+restart_save(void)
+{
+    restart_header_s *h;
+    restart_screen_s *rs;
+    restart_client_s *rc;
+    list_entry_t cur;
+    unsigned int count = 0, pairs;
+    xcb_window_t *frames = NULL;
+    size_t size;
+    int fd = -1, i;
+
+    for (i = 0; i < screen_count; ++ i)
+        for (cur = list_next(&screens[i].client_list); cur != &screens[i].client_list; cur = list_next(cur))
+            count += restart_resumable(CONTAINER_OF(cur, client_s, client_node));
+
+    size = sizeof(restart_header_s) + screen_count * sizeof(restart_screen_s) +
+        count * sizeof(restart_client_s);
+
+    if (count && (frames = (xcb_window_t *)malloc(count * 2 * sizeof(xcb_window_t))) == NULL)
+        goto fail;
+    if ((fd = __open()) < 0) goto fail;
+    if (ftruncate(fd, size)) goto fail;
+    h = (restart_header_s *)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (h == MAP_FAILED) goto fail;
+
+    rs = (restart_screen_s *)(h + 1);
+    rc = (restart_client_s *)(rs + screen_count);
+    for (i = 0; i < screen_count; ++ i)
+    {
+        rs[i].root            = screens[i].xcb_screen->root;
+        rs[i].desktop_current = screens[i].desktop_current;
+        rs[i].focus           = screens[i].focus ? screens[i].focus->xcb_window : XCB_NONE;
+        pairs = 0;
+
+        for (cur = list_next(&screens[i].client_list); cur != &screens[i].client_list; cur = list_next(cur))
+        {
+            client_t client = CONTAINER_OF(cur, client_s, client_node);
+            const char *name;
+
+            if (!restart_resumable(client)) continue;
+
+            memset(rc, 0, sizeof(*rc));
+            rc->window         = client->xcb_window;
+            rc->container      = client->xcb_container;
+            rc->transient_for  = client->transient_for;
+            rc->desktop        = client->desktop;
+            rc->screen         = i;
+            rc->window_type    = client->window_type;
+            rc->mapped         = client->mapped;
+            rc->desktop_hidden = client->desktop_hidden;
+            rc->geom[CLIENT_GEOM_WINDOW]    = client->geom[CLIENT_GEOM_WINDOW];
+            rc->geom[CLIENT_GEOM_CONTAINER] = client->geom[CLIENT_GEOM_CONTAINER];
+            memcpy(rc->wm_instance, client->wm_instance, CLIENT_WM_CLASS_MAX);
+            memcpy(rc->wm_class, client->wm_class, CLIENT_WM_CLASS_MAX);
+            name = client->class->class_name_get(client->class);
+            strncpy(rc->class_name, name, RESTART_CLASS_NAME_MAX - 1);
+            ++ rc;
+            frames[pairs * 2]     = client->xcb_window;
+            frames[pairs * 2 + 1] = client->xcb_container;
+            ++ pairs;
+
+            /* the grabs and selections are made again by the next
+             * process, which could not make them while ours stand */
+            uint32_t values[1] = { 0 };
+            xcb_change_window_attributes(x_conn, client->xcb_container, XCB_CW_EVENT_MASK, values);
+            xcb_ungrab_button(x_conn, XCB_BUTTON_INDEX_ANY, client->xcb_container, XCB_MOD_MASK_ANY);
+            client_sync_detach(client);
+        }
+
+        if (pairs)
+            xcb_change_property(x_conn, XCB_PROP_MODE_REPLACE, screens[i].xcb_screen->root,
+                                ATOM(_CWM_RESTART_FRAMES), XCB_ATOM_WINDOW, 32, pairs * 2, frames);
+    }
+    free(frames);
+
+    h->magic         = RESTART_MAGIC;
+    h->version       = RESTART_VERSION;
+    h->record_size   = sizeof(restart_client_s);
+    h->screen_count  = screen_count;
+    h->client_count  = count;
+    h->desktop_count = desktop_count;
+    h->size          = size;
+    h->checksum      = __checksum((const unsigned char *)(h + 1), size - sizeof(*h));
+    munmap(h, size);
+
+    /* the containers outlive the connection */
+    if (count) xcb_set_close_down_mode(x_conn, XCB_CLOSE_DOWN_RETAIN_PERMANENT);
+
+    restart_fd = fd;
+    return count;
+
+fail:
+    perror("restart");
+    free(frames);
+    if (fd >= 0) close(fd);
+    return -1;
+}
+
+/* Only returns if the exec failed; the next start cleans up */
+int
+restart_exec(void)
+{
+    char fd[16];
+
+    if (restart_fd >= 0)
+    {
+        snprintf(fd, sizeof(fd), "%d", restart_fd);
+        setenv(RESTART_ENV, fd, 1);
+    }
+    else unsetenv(RESTART_ENV);
+
+    execv(restart_target, restart_argv);
+    perror(restart_target);
+    return -1;
+}
+
+/* The state the last process left, if any and sane; returns the
+ * number of clients or -1 */
+int
+restart_load(const restart_screen_s **rs, const restart_client_s **rc)
+{
+    const restart_header_s *h;
+    const char *env = getenv(RESTART_ENV);
+    struct stat st;
+    int i;
+
+    if (env == NULL) return -1;
+    restart_fd = atoi(env);
+    unsetenv(RESTART_ENV);
+    fcntl(restart_fd, F_SETFD, FD_CLOEXEC);
+
+    if (fstat(restart_fd, &st) || st.st_size < sizeof(restart_header_s))
+        goto reject;
+    map_size = st.st_size;
+    map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, restart_fd, 0);
+    if (map == MAP_FAILED) goto reject;
+
+    h = (const restart_header_s *)map;
+    if (h->magic != RESTART_MAGIC || h->version != RESTART_VERSION ||
+        h->record_size != sizeof(restart_client_s) || h->screen_count != screen_count ||
+        h->size != map_size ||
+        h->size != sizeof(restart_header_s) + h->screen_count * sizeof(restart_screen_s) +
+                   (uint64_t)h->client_count * sizeof(restart_client_s) ||
+        h->checksum != __checksum((const unsigned char *)(h + 1), map_size - sizeof(*h)))
+        goto reject;
+
+    *rs = (const restart_screen_s *)(h + 1);
+    *rc = (const restart_client_s *)(*rs + screen_count);
+    for (i = 0; i < screen_count; ++ i)
+        if ((*rs)[i].root != screens[i].xcb_screen->root)
+            goto reject;
+
+    return h->client_count;
+
+reject:
+    fprintf(stderr, "restart: state rejected, adopting windows anew\n");
+    restart_done();
+    return -1;
+}
+
+void
+restart_done(void)
+{
+    if (map != MAP_FAILED) munmap(map, map_size);
+    if (restart_fd >= 0) close(restart_fd);
+    map = MAP_FAILED;
+    map_size = 0;
+    restart_fd = -1;
+}
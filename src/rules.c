@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "base.h"
+
+/* Client rules.
+ *
+ * Rules are compiled into a hash index keyed on (WM_CLASS class,
+ * window type), either of which may be "any". Matching a client looks
+ * at the four keys it can fall under, so the cost does not depend on
+ * how many rules or classes there are, only on how many rules share
+ * a key. Chains are kept best first, so the first rule of a chain
+ * that passes the remaining predicates is the chain's answer.
+ *
+ * The index is rebuilt on the first match after the rules changed. */
+
+static list_entry_s   rules = { &rules, &rules };
+static unsigned int   rule_count = 0;
+static unsigned long  rule_order = 0;
+
+static client_rule_t *rule_index  = NULL;
+static unsigned int   index_mask  = 0;
+static int            index_dirty = 1;
+
+static inline unsigned int
+__hash(const char *wm_class, int window_type)
+{
+    /* FNV-1a over the class, then the type mixed in */
+    uint32_t h = 2166136261u;
+
+    if (wm_class)
+        for (; *wm_class; ++ wm_class)
+            h = (h ^ (unsigned char)*wm_class) * 16777619u;
+    else h ^= 0x5bd1e995;
+
+    return (h ^ (uint32_t)(window_type + 1)) * 2654435769u;
+}
+
+static inline int
+__better(client_rule_t a, client_rule_t b)
+{
+    return a->priority > b->priority ||
+        (a->priority == b->priority && a->order < b->order);
+}
+
+static void
+__index_build(void)
+{
+    unsigned int size = 16;
+    list_entry_t cur;
+
+    while (size < rule_count * 2) size <<= 1;
+
+    free(rule_index);
+    rule_index = (client_rule_t *)calloc(size, sizeof(client_rule_t));
+    index_mask = rule_index ? size - 1 : 0;
+    index_dirty = 0;
+    if (rule_index == NULL) return;
+
+    for (cur = list_next(&rules); cur != &rules; cur = list_next(cur))
+    {
+        client_rule_t rule = CONTAINER_OF(cur, client_rule_s, rule_node);
+        client_rule_t *p = &rule_index[rule->hash & index_mask];
+
+        while (*p && !__better(rule, *p))
+            p = &(*p)->index_next;
+        rule->index_next = *p;
+        *p = rule;
+    }
+}
+
+static inline int
+__key_equal(client_rule_t rule, const char *wm_class, int window_type)
+{
+    if (rule->window_type != window_type) return 0;
+    if (rule->wm_class == NULL || wm_class == NULL)
+        return rule->wm_class == wm_class;
+    return strcmp(rule->wm_class, wm_class) == 0;
+}
+
+/* best rule under one key, NULL if none */
+static client_rule_t
+__lookup(client_t client, const char *wm_class, int window_type)
+{
+    unsigned int h = __hash(wm_class, window_type);
+    client_rule_t rule;
+
+    for (rule = rule_index[h & index_mask]; rule; rule = rule->index_next)
+    {
+        if (rule->hash != h || !__key_equal(rule, wm_class, window_type))
+            continue;
+
+        if (rule->wm_instance && strcmp(rule->wm_instance, client->wm_instance))
+            continue;
+
+        if ((rule->transient == RULE_YES && client->transient_for == XCB_NONE) ||
+            (rule->transient == RULE_NO  && client->transient_for != XCB_NONE))
+            continue;
+
+        return rule;
+    }
+    return NULL;
+}
+
+int
+client_rule_add(client_rule_t rule)
+{
+    if (rule->class == NULL) return -1;
+    if (rule->class->priv_size && client_priv_reserve(rule->class->priv_size))
+        return -1;
+
+    rule->order = rule_order ++;
+    rule->hash  = __hash(rule->wm_class, rule->window_type);
+    rule->index_next = NULL;
+    list_add_before(&rules, &rule->rule_node);
+    ++ rule_count;
+    index_dirty = 1;
+    return 0;
+}
+
+void
+client_rule_remove(client_rule_t rule)
+{
+    list_del(&rule->rule_node);
+    -- rule_count;
+    index_dirty = 1;
+}
+
+client_class_t
+client_rule_match(client_t client)
+{
+    client_rule_t best = NULL, r;
+    const char *keys[2] = { client->wm_class, NULL };
+    int types[2] = { client->window_type, WINDOW_TYPE_ANY };
+    int k, t;
+
+    if (rule_count == 0) return NULL;
+    if (index_dirty) __index_build();
+    if (rule_index == NULL) return NULL;
+
+    for (k = 0; k < 2; ++ k)
+        for (t = 0; t < 2; ++ t)
+        {
+            r = __lookup(client, keys[k], types[t]);
+            if (r && (best == NULL || __better(r, best)))
+                best = r;
+        }
+
+    return best ? best->class : NULL;
+}
+
+void
+client_rule_cleanup(void)
+{
+    free(rule_index);
+    rule_index = NULL;
+    index_dirty = 1;
+}
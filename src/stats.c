@@ -0,0 +1,401 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "base.h"
+
+/* Runtime statistics. The counters themselves are bumped inline (see
+ * stats_event in base.h); this file only renders them, on a UNIX
+ * socket and on SIGUSR1 (text) / SIGUSR2 (JSON) to stderr.
+ *
+ * The socket answers one request per connection: the client sends
+ * "json" or "text" and reads until EOF. */
+
+#define STATS_REQUEST_MAX 16
+
+stats_s stats;
+
+typedef struct stats_conn_s
+{
+    loop_watch_s watch;
+    char         request[STATS_REQUEST_MAX];
+    int          request_len;
+} stats_conn_s;
+
+static loop_watch_s listen_watch;
+static char         listen_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+static char  *out      = NULL;
+static size_t out_len  = 0;
+static size_t out_size = 0;
+
+static const char *event_names[STATS_EVENT_TYPES] =
+{
+    [0]                          = "Error",
+    [XCB_KEY_PRESS]              = "KeyPress",
+    [XCB_KEY_RELEASE]            = "KeyRelease",
+    [XCB_BUTTON_PRESS]           = "ButtonPress",
+    [XCB_BUTTON_RELEASE]         = "ButtonRelease",
+    [XCB_MOTION_NOTIFY]          = "MotionNotify",
+    [XCB_ENTER_NOTIFY]           = "EnterNotify",
+    [XCB_LEAVE_NOTIFY]           = "LeaveNotify",
+    [XCB_FOCUS_IN]               = "FocusIn",
+    [XCB_FOCUS_OUT]              = "FocusOut",
+    [XCB_KEYMAP_NOTIFY]          = "KeymapNotify",
+    [XCB_EXPOSE]                 = "Expose",
+    [XCB_GRAPHICS_EXPOSURE]      = "GraphicsExpose",
+    [XCB_NO_EXPOSURE]            = "NoExpose",
+    [XCB_VISIBILITY_NOTIFY]      = "VisibilityNotify",
+    [XCB_CREATE_NOTIFY]          = "CreateNotify",
+    [XCB_DESTROY_NOTIFY]         = "DestroyNotify",
+    [XCB_UNMAP_NOTIFY]           = "UnmapNotify",
+    [XCB_MAP_NOTIFY]             = "MapNotify",
+    [XCB_MAP_REQUEST]            = "MapRequest",
+    [XCB_REPARENT_NOTIFY]        = "ReparentNotify",
+    [XCB_CONFIGURE_NOTIFY]       = "ConfigureNotify",
+    [XCB_CONFIGURE_REQUEST]      = "ConfigureRequest",
+    [XCB_GRAVITY_NOTIFY]         = "GravityNotify",
+    [XCB_RESIZE_REQUEST]         = "ResizeRequest",
+    [XCB_CIRCULATE_NOTIFY]       = "CirculateNotify",
+    [XCB_CIRCULATE_REQUEST]      = "CirculateRequest",
+    [XCB_PROPERTY_NOTIFY]        = "PropertyNotify",
+    [XCB_SELECTION_CLEAR]        = "SelectionClear",
+    [XCB_SELECTION_REQUEST]      = "SelectionRequest",
+    [XCB_SELECTION_NOTIFY]       = "SelectionNotify",
+    [XCB_COLORMAP_NOTIFY]        = "ColormapNotify",
+    [XCB_CLIENT_MESSAGE]         = "ClientMessage",
+    [XCB_MAPPING_NOTIFY]         = "MappingNotify",
+};
+
+static void
+__out(const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    while (1)
+    {
+        va_start(ap, fmt);
+        n = vsnprintf(out + out_len, out_size - out_len, fmt, ap);
+        va_end(ap);
+
+        if (n < 0) return;
+        if (out_len + n < out_size) break;
+
+        size_t size = out_size ? out_size * 2 : 4096;
+        while (size <= out_len + n) size *= 2;
+
+        char *o = (char *)realloc(out, size);
+        if (o == NULL) return;
+        out = o;
+        out_size = size;
+    }
+
+    out_len += n;
+}
+
+/* upper bound of the bucket holding the q-quantile, in ns, but
+ * never above the largest time seen */
+static uint64_t
+__quantile(stats_event_s *e, double q)
+{
+    unsigned long rank = (unsigned long)(q * e->count);
+    unsigned long seen = 0;
+    int b;
+
+    for (b = 0; b < STATS_HIST; ++ b)
+    {
+        seen += e->hist[b];
+        if (seen > rank) break;
+    }
+
+    if (b >= STATS_HIST) b = STATS_HIST - 1;
+    return (1ull << b) < e->ns_max ? (1ull << b) : e->ns_max;
+}
+
+static const char *
+__event_name(int type, char *buf, size_t size)
+{
+    if (event_names[type])
+        return event_names[type];
+
+    snprintf(buf, size, "Event%d", type);
+    return buf;
+}
+
+static unsigned int
+__client_count(void)
+{
+    unsigned int count = 0;
+    list_entry_t cur;
+    int i;
+
+    for (i = 0; i < screen_count; ++ i)
+        for (cur = list_next(&screens[i].client_list);
+             cur != &screens[i].client_list;
+             cur = list_next(cur))
+            ++ count;
+
+    return count;
+}
+
+static void
+__render_text(void)
+{
+    char name[16];
+    int type, b;
+    pool_t pool;
+
+    __out("uptime %.3f s\n", (time_now_ns() - stats.start) * 1e-9);
+    __out("clients %u, wnd_dict %u, replies pending %d\n",
+          __client_count(), wnd_dict_count(), reply_pending());
+    __out("round trips %lu, async replies %lu, flushes %lu\n",
+          stats.round_trips, stats.replies, event_batch_stats.flushes);
+    __out("client list appends %lu, rewrites %lu\n",
+          stats.ewmh_appends, stats.ewmh_rewrites);
+    __out("property fetches %lu, refetches %lu\n",
+          stats.prop_fetches, stats.prop_refetches);
+    __out("sync requests %lu, timeouts %lu\n",
+          stats.sync_requests, stats.sync_timeouts);
+    __out("ipc batches %lu, ops %lu, events %lu\n",
+          stats.ipc_batches, stats.ipc_ops, stats.ipc_events);
+    if (stats.comp_frames)
+        __out("frames %lu, avg %.1f us, max %.1f us, avg %.0f px, last %lu px, bypasses %lu\n",
+              stats.comp_frames, stats.comp_frame_ns * 1e-3 / stats.comp_frames,
+              stats.comp_frame_ns_max * 1e-3, (double)stats.comp_pixels / stats.comp_frames,
+              (unsigned long)stats.comp_pixels_last, stats.comp_bypasses);
+    __out("events %lu in %lu batches (max %lu), coalesced %lu motion %lu configure %lu map/unmap\n",
+          event_batch_stats.events, event_batch_stats.batches, event_batch_stats.batch_max,
+          event_batch_stats.coalesced_motion, event_batch_stats.coalesced_configure,
+          event_batch_stats.coalesced_map_pairs);
+
+    __out("%-18s %10s %10s %10s %10s %10s %10s\n",
+          "event", "count", "avg us", "p50 us", "p99 us", "p999 us", "max us");
+    for (type = 0; type < STATS_EVENT_TYPES; ++ type)
+    {
+        stats_event_s *e = &stats.event[type];
+        if (e->count == 0) continue;
+
+        __out("%-18s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+              __event_name(type, name, sizeof(name)), e->count,
+              e->ns_total * 1e-3 / e->count,
+              __quantile(e, 0.5) * 1e-3, __quantile(e, 0.99) * 1e-3,
+              __quantile(e, 0.999) * 1e-3, e->ns_max * 1e-3);
+    }
+
+    __out("batch sizes (2^b):");
+    for (b = 0; b < EVENT_BATCH_HIST; ++ b)
+        __out(" %lu", event_batch_stats.batch_hist[b]);
+    __out("\n");
+
+    __out("%-18s %10s %10s %10s %10s %10s\n",
+          "pool", "size", "live", "high", "chunks", "allocs");
+    for (pool = pools; pool; pool = pool->next)
+        __out("%-18s %10zu %10lu %10lu %10lu %10lu\n",
+              pool->name, pool->size, pool->live, pool->high,
+              pool->nchunks, pool->allocs);
+}
+
+static void
+__render_json(void)
+{
+    char name[16];
+    int type, b, first = 1;
+    pool_t pool;
+
+    __out("{\"uptime_ns\":%llu,\"clients\":%u,\"wnd_dict\":%u,\"replies_pending\":%d,"
+          "\"round_trips\":%lu,\"replies\":%lu,\"flushes\":%lu,"
+          "\"client_list_appends\":%lu,\"client_list_rewrites\":%lu,"
+          "\"prop_fetches\":%lu,\"prop_refetches\":%lu,"
+          "\"sync_requests\":%lu,\"sync_timeouts\":%lu,"
+          "\"ipc_batches\":%lu,\"ipc_ops\":%lu,\"ipc_events\":%lu,"
+          "\"comp\":{\"frames\":%lu,\"frame_ns\":%llu,\"frame_ns_max\":%llu,"
+          "\"pixels\":%llu,\"pixels_last\":%llu,\"bypasses\":%lu},",
+          (unsigned long long)(time_now_ns() - stats.start),
+          __client_count(), wnd_dict_count(), reply_pending(),
+          stats.round_trips, stats.replies, event_batch_stats.flushes,
+          stats.ewmh_appends, stats.ewmh_rewrites,
+          stats.prop_fetches, stats.prop_refetches,
+          stats.sync_requests, stats.sync_timeouts,
+          stats.ipc_batches, stats.ipc_ops, stats.ipc_events,
+          stats.comp_frames, (unsigned long long)stats.comp_frame_ns,
+          (unsigned long long)stats.comp_frame_ns_max, (unsigned long long)stats.comp_pixels,
+          (unsigned long long)stats.comp_pixels_last, stats.comp_bypasses);
+    __out("\"batches\":{\"count\":%lu,\"events\":%lu,\"max\":%lu,\"hist\":[",
+          event_batch_stats.batches, event_batch_stats.events, event_batch_stats.batch_max);
+    for (b = 0; b < EVENT_BATCH_HIST; ++ b)
+        __out("%s%lu", b ? "," : "", event_batch_stats.batch_hist[b]);
+    __out("],\"coalesced_motion\":%lu,\"coalesced_configure\":%lu,\"coalesced_map_pairs\":%lu},",
+          event_batch_stats.coalesced_motion, event_batch_stats.coalesced_configure,
+          event_batch_stats.coalesced_map_pairs);
+
+    __out("\"events\":{");
+    for (type = 0; type < STATS_EVENT_TYPES; ++ type)
+    {
+        stats_event_s *e = &stats.event[type];
+        if (e->count == 0) continue;
+
+        __out("%s\"%s\":{\"count\":%lu,\"ns_total\":%llu,\"ns_max\":%llu,"
+              "\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"hist\":[",
+              first ? "" : ",", __event_name(type, name, sizeof(name)), e->count,
+              (unsigned long long)e->ns_total, (unsigned long long)e->ns_max,
+              (unsigned long long)__quantile(e, 0.5),
+              (unsigned long long)__quantile(e, 0.99),
+              (unsigned long long)__quantile(e, 0.999));
+        for (b = 0; b < STATS_HIST; ++ b)
+            __out("%s%lu", b ? "," : "", e->hist[b]);
+        __out("]}");
+        first = 0;
+    }
+
+    __out("},\"pools\":{");
+    for (pool = pools; pool; pool = pool->next)
+        __out("%s\"%s\":{\"size\":%zu,\"live\":%lu,\"high\":%lu,\"chunks\":%lu,\"allocs\":%lu}",
+              pool == pools ? "" : ",", pool->name, pool->size, pool->live,
+              pool->high, pool->nchunks, pool->allocs);
+    __out("}}\n");
+}
+
+static void
+__render(int json)
+{
+    out_len = 0;
+    if (json) __render_json();
+    else __render_text();
+}
+
+void
+stats_print(FILE *f, int json)
+{
+    __render(json);
+    if (out_len) fwrite(out, 1, out_len, f);
+}
+
+static void
+__dump(int signo)
+{
+    stats_print(stderr, signo == SIGUSR2);
+}
+
+static void
+__conn_close(stats_conn_s *c)
+{
+    loop_watch_del(&c->watch);
+    close(c->watch.fd);
+    free(c);
+}
+
+static void
+__conn_ready(loop_watch_t watch, uint32_t events)
+{
+    stats_conn_s *c = CONTAINER_OF(watch, stats_conn_s, watch);
+    ssize_t n = 0;
+
+    if (events & EPOLLIN)
+    {
+        n = read(watch->fd, c->request + c->request_len,
+                 STATS_REQUEST_MAX - 1 - c->request_len);
+        if (n < 0 && errno == EAGAIN) return;
+        if (n > 0) c->request_len += n;
+        c->request[c->request_len] = 0;
+
+        /* wait for a full word unless the client is done talking */
+        if (n > 0 && c->request_len < 4 && !strpbrk(c->request, " \n"))
+            return;
+    }
+
+    __render(strncmp(c->request, "json", 4) == 0);
+
+    /* the socket buffer takes any sane report, a client that does not
+     * read just gets it cut short */
+    size_t done = 0;
+    while (done < out_len)
+    {
+        n = write(watch->fd, out + done, out_len - done);
+        if (n <= 0) break;
+        done += n;
+    }
+
+    __conn_close(c);
+}
+
+static void
+__listen_ready(loop_watch_t watch, uint32_t events)
+{
+    int fd;
+
+    while ((fd = accept4(watch->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        stats_conn_s *c = (stats_conn_s *)malloc(sizeof(stats_conn_s));
+        if (c == NULL)
+        {
+            close(fd);
+            continue;
+        }
+
+        c->watch.fd       = fd;
+        c->watch.callback = __conn_ready;
+        c->watch.data     = NULL;
+        c->request_len    = 0;
+        c->request[0]     = 0;
+
+        if (loop_watch_add(&c->watch, EPOLLIN | EPOLLRDHUP))
+        {
+            close(fd);
+            free(c);
+        }
+    }
+}
+
+int
+stats_init(void)
+{
+    int fd;
+
+    stats.start = time_now_ns();
+
+    if (loop_signal(SIGUSR1, __dump) || loop_signal(SIGUSR2, __dump))
+        return -1;
+
+    fd = loop_listen("CWM_STATS_SOCKET", "cwm-stats", listen_path, sizeof(listen_path), 4);
+    if (fd < 0)
+        return 0;               /* signals still work */
+
+    listen_watch.fd       = fd;
+    listen_watch.callback = __listen_ready;
+    listen_watch.data     = NULL;
+    if (loop_watch_add(&listen_watch, EPOLLIN))
+    {
+        close(fd);
+        unlink(listen_path);
+        listen_path[0] = 0;
+    }
+
+    return 0;
+}
+
+void
+stats_cleanup(void)
+{
+    if (listen_path[0])
+    {
+        loop_watch_del(&listen_watch);
+        close(listen_watch.fd);
+        unlink(listen_path);
+        listen_path[0] = 0;
+    }
+
+    free(out);
+    out = NULL;
+    out_len = out_size = 0;
+}
@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "base.h"
+
+#ifdef USE_XSYNC
+#include <xcb/sync.h>
+#endif
+
+/* _NET_WM_SYNC_REQUEST.
+ *
+ * client_sync_request sends the client the next value of its counter
+ * and points an alarm of ours at that value; the client sets the
+ * counter once it has redrawn after the configure that follows. The
+ * AlarmNotify, or SYNC_TIMEOUT for a client that never answers, ends
+ * the busy state and tells the class, which then sends whatever size
+ * it held back meanwhile. So a client is never more than one configure
+ * behind, however slow it draws.
+ *
+ * Alarms are XIDs like windows, so they are kept in wnd_dict, and an
+ * AlarmNotify finds its client in one lookup. One alarm per client is
+ * made on its first request and changed from then on.
+ *
+ * Needs USE_XSYNC, and like RandR stays off offline and while
+ * recording. */
+
+#ifdef USE_XSYNC
+static int sync_event_base = -1;
+#endif
+
+static void
+__sync_done(client_t client)
+{
+    client->sync_busy = 0;
+    if (client->class && client->class->client_aevent_sync)
+        client->class->client_aevent_sync(client->class, client);
+}
+
+static void
+__sync_timeout(void *data)
+{
+    client_t client = (client_t)data;
+
+    ++ stats.sync_timeouts;
+    __sync_done(client);
+}
+
+#ifdef USE_XSYNC
+
+static void
+__version_cb(void *data, void *reply, xcb_generic_error_t *error)
+{
+    xcb_sync_initialize_reply_t *r = (xcb_sync_initialize_reply_t *)reply;
+
+    /* alarms are 3.0 */
+    if (r == NULL || r->major_version < 3)
+        sync_event_base = -1;
+}
+
+#endif
+
+int
+sync_init(void)
+{
+#ifdef USE_XSYNC
+    const xcb_query_extension_reply_t *ext;
+
+    if (x_backend->offline || trace_mode == TRACE_MODE_RECORD)
+        return 0;
+
+    ext = xcb_get_extension_data(x_conn, &xcb_sync_id);
+    ++ stats.round_trips;
+    if (ext == NULL || !ext->present)
+        return 0;
+
+    sync_event_base = ext->first_event;
+    reply_wait(xcb_sync_initialize(x_conn, 3, 1).sequence, __version_cb, NULL);
+#endif
+    return 0;
+}
+
+int
+sync_event(xcb_generic_event_t *e)
+{
+#ifdef USE_XSYNC
+    xcb_sync_alarm_notify_event_t *a = (xcb_sync_alarm_notify_event_t *)e;
+    wnd_dict_node_t node;
+    client_t client;
+    uint64_t value;
+
+    if (sync_event_base < 0 ||
+        (e->response_type & ~0x80) != sync_event_base + XCB_SYNC_ALARM_NOTIFY)
+        return 0;
+
+    node = wnd_dict_find(a->alarm, WND_DICT_FIND_OP_NONE);
+    if (node == NULL || node->role != WND_ROLE_SYNC_ALARM) return 1;
+    client = (client_t)node->link;
+
+    /* an older value reached late is no answer to the last request */
+    value = (uint64_t)(uint32_t)a->counter_value.hi << 32 | a->counter_value.lo;
+    if (!client->sync_busy || value < client->sync_value) return 1;
+
+    timeout_cancel(&client->sync_timer);
+    __sync_done(client);
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void
+client_sync_attach(client_t client)
+{
+    client->sync_alarm = XCB_NONE;
+    client->sync_value = 0;
+    client->sync_busy  = 0;
+    timeout_init(&client->sync_timer, __sync_timeout, client);
+}
+
+void
+client_sync_detach(client_t client)
+{
+    timeout_cancel(&client->sync_timer);
+    client->sync_busy = 0;
+    if (client->sync_alarm == XCB_NONE) return;
+
+#ifdef USE_XSYNC
+    wnd_dict_find(client->sync_alarm, WND_DICT_FIND_OP_ERASE);
+    xcb_sync_destroy_alarm(x_conn, client->sync_alarm);
+#endif
+    client->sync_alarm = XCB_NONE;
+}
+
+/* Returns 1 if a request went out; the caller configures right after */
+int
+client_sync_request(client_t client)
+{
+#ifdef USE_XSYNC
+    const uint32_t *protocols, *counter;
+    xcb_client_message_event_t m;
+    uint64_t v;
+
+    if (sync_event_base < 0) return 0;
+
+    protocols = (const uint32_t *)client_prop_get(client, CLIENT_PROP_PROTOCOLS);
+    counter   = (const uint32_t *)client_prop_get(client, CLIENT_PROP_SYNC_COUNTER);
+    if (protocols == NULL || !(*protocols & CLIENT_PROTOCOL_SYNC_REQUEST) ||
+        counter == NULL || *counter == XCB_NONE)
+        return 0;
+
+    v = ++ client->sync_value;
+
+    memset(&m, 0, sizeof(m));
+    m.response_type  = XCB_CLIENT_MESSAGE;
+    m.format         = 32;
+    m.window         = client->xcb_window;
+    m.type           = ATOM(WM_PROTOCOLS);
+    m.data.data32[0] = ATOM(_NET_WM_SYNC_REQUEST);
+    m.data.data32[1] = XCB_CURRENT_TIME;
+    m.data.data32[2] = (uint32_t)v;
+    m.data.data32[3] = (uint32_t)(v >> 32);
+    xcb_send_event(x_conn, 0, client->xcb_window, XCB_EVENT_MASK_NO_EVENT, (const char *)&m);
+
+    /* fires once the counter reaches v, then goes inactive until the
+     * next change */
+    if (client->sync_alarm == XCB_NONE)
+    {
+        xcb_sync_create_alarm_value_list_t a;
+        wnd_dict_node_t node;
+
+        memset(&a, 0, sizeof(a));
+        a.counter   = *counter;
+        a.valueType = XCB_SYNC_VALUETYPE_ABSOLUTE;
+        a.value.hi  = (int32_t)(v >> 32);
+        a.value.lo  = (uint32_t)v;
+        a.testType  = XCB_SYNC_TESTTYPE_POSITIVE_COMPARISON;
+        a.events    = 1;
+
+        client->sync_alarm = x_generate_id();
+        xcb_sync_create_alarm_aux(x_conn, client->sync_alarm,
+                                  XCB_SYNC_CA_COUNTER | XCB_SYNC_CA_VALUE_TYPE | XCB_SYNC_CA_VALUE |
+                                  XCB_SYNC_CA_TEST_TYPE | XCB_SYNC_CA_DELTA | XCB_SYNC_CA_EVENTS, &a);
+
+        node = wnd_dict_find(client->sync_alarm, WND_DICT_FIND_OP_TOUCH);
+        node->role = WND_ROLE_SYNC_ALARM;
+        node->link = client;
+    }
+    else
+    {
+        xcb_sync_change_alarm_value_list_t a;
+
+        memset(&a, 0, sizeof(a));
+        /* the client may have set up a new counter meanwhile */
+        a.counter  = *counter;
+        a.value.hi = (int32_t)(v >> 32);
+        a.value.lo = (uint32_t)v;
+        xcb_sync_change_alarm_aux(x_conn, client->sync_alarm,
+                                  XCB_SYNC_CA_COUNTER | XCB_SYNC_CA_VALUE, &a);
+    }
+
+    client->sync_busy = 1;
+    timeout_add(&client->sync_timer, SYNC_TIMEOUT);
+    ++ stats.sync_requests;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void
+sync_cleanup(void)
+{
+#ifdef USE_XSYNC
+    sync_event_base = -1;
+#endif
+}
@@ -0,0 +1,231 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "base.h"
+
+/* Hierarchical timer wheel, TIMEOUT_LEVELS levels of TIMEOUT_SLOTS
+ * slots with a TIMEOUT_TICK_NS tick. Add and cancel are a list
+ * insert and a list delete; entries of an upper level are cascaded
+ * down when the level below wraps around. */
+
+#define TIMEOUT_BITS   6
+#define TIMEOUT_SLOTS  (1 << TIMEOUT_BITS)
+#define TIMEOUT_MASK   (TIMEOUT_SLOTS - 1)
+#define TIMEOUT_LEVELS 4
+#define TIMEOUT_RANGE  (1ull << (TIMEOUT_BITS * TIMEOUT_LEVELS))
+
+static list_entry_s wheel[TIMEOUT_LEVELS][TIMEOUT_SLOTS];
+static uint64_t     wheel_tick  = 0;   /* all ticks before this have run */
+static unsigned int wheel_count = 0;
+static int          wheel_ready = 0;
+
+uint64_t
+time_real_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* a replay runs on the clock of the recording */
+uint64_t
+time_now_ns(void)
+{
+    if (trace_mode == TRACE_MODE_REPLAY)
+        return trace_clock();
+    return time_real_ns();
+}
+
+static void
+__wheel_init(void)
+{
+    int l, i;
+    for (l = 0; l < TIMEOUT_LEVELS; ++ l)
+        for (i = 0; i < TIMEOUT_SLOTS; ++ i)
+            list_init(&wheel[l][i]);
+
+    wheel_tick  = time_now_ns() / TIMEOUT_TICK_NS;
+    wheel_ready = 1;
+}
+
+static void
+__wheel_place(timeout_t t)
+{
+    uint64_t delta = t->expire - wheel_tick;
+    uint64_t expire = t->expire;
+    int level = 0;
+
+    if (t->expire < wheel_tick)
+        expire = wheel_tick, delta = 0;
+    else if (delta >= TIMEOUT_RANGE)
+        expire = wheel_tick + TIMEOUT_RANGE - 1, delta = TIMEOUT_RANGE - 1;
+
+    while (delta >= TIMEOUT_SLOTS && level < TIMEOUT_LEVELS - 1)
+    {
+        delta >>= TIMEOUT_BITS;
+        ++ level;
+    }
+
+    list_add_before(&wheel[level][(expire >> (TIMEOUT_BITS * level)) & TIMEOUT_MASK], &t->node);
+}
+
+void
+timeout_init(timeout_t t, timeout_callback_f callback, void *data)
+{
+    list_init(&t->node);
+    t->expire   = 0;
+    t->active   = 0;
+    t->callback = callback;
+    t->data     = data;
+}
+
+void
+timeout_add(timeout_t t, uint64_t delay_ns)
+{
+    uint64_t now;
+
+    if (!wheel_ready) __wheel_init();
+    now = time_now_ns();
+
+    if (t->active)
+        list_del(&t->node);
+    else
+    {
+        /* an empty wheel is not turned while idle; catch up here, or
+         * timeout_run would step through every tick since */
+        if (wheel_count == 0)
+            wheel_tick = now / TIMEOUT_TICK_NS;
+        ++ wheel_count;
+    }
+
+    t->active = 1;
+    t->expire = (now + delay_ns + TIMEOUT_TICK_NS - 1) / TIMEOUT_TICK_NS;
+    __wheel_place(t);
+}
+
+void
+timeout_cancel(timeout_t t)
+{
+    if (!t->active) return;
+
+    list_del_init(&t->node);
+    t->active = 0;
+    -- wheel_count;
+}
+
+/* move all entries of a slot onto a private list head */
+static void
+__slot_take(list_entry_t slot, list_entry_t to)
+{
+    list_init(to);
+    if (list_empty(slot)) return;
+
+    list_add(slot, to);
+    list_del_init(slot);
+}
+
+static void
+__wheel_cascade(int level)
+{
+    list_entry_s moving;
+
+    /* entries may land in the same slot again */
+    __slot_take(&wheel[level][(wheel_tick >> (TIMEOUT_BITS * level)) & TIMEOUT_MASK], &moving);
+
+    while (!list_empty(&moving))
+    {
+        list_entry_t cur = list_next(&moving);
+        list_del(cur);
+        __wheel_place(CONTAINER_OF(cur, timeout_s, node));
+    }
+}
+
+void
+timeout_run(uint64_t now_ns)
+{
+    uint64_t now = now_ns / TIMEOUT_TICK_NS;
+
+    if (!wheel_ready) return;
+
+    while (wheel_tick <= now)
+    {
+        if (wheel_count == 0)
+        {
+            /* nothing to fire, skip ahead */
+            wheel_tick = now + 1;
+            break;
+        }
+
+        int level;
+        for (level = 1; level < TIMEOUT_LEVELS; ++ level)
+        {
+            if ((wheel_tick >> (TIMEOUT_BITS * (level - 1))) & TIMEOUT_MASK)
+                break;
+            __wheel_cascade(level);
+        }
+
+        /* anything the callbacks add goes to a later tick */
+        list_entry_s expired;
+        __slot_take(&wheel[0][wheel_tick & TIMEOUT_MASK], &expired);
+        ++ wheel_tick;
+
+        while (!list_empty(&expired))
+        {
+            timeout_t t = CONTAINER_OF(list_next(&expired), timeout_s, node);
+
+            /* callbacks may cancel the rest, so take one at a time */
+            list_del_init(&t->node);
+            t->active = 0;
+            -- wheel_count;
+            t->callback(t->data);
+        }
+    }
+}
+
+/* earliest expiry in a slot, or best if none is earlier */
+static uint64_t
+__slot_min(list_entry_t slot, uint64_t best)
+{
+    list_entry_t cur;
+
+    for (cur = list_next(slot); cur != slot; cur = list_next(cur))
+    {
+        timeout_t t = CONTAINER_OF(cur, timeout_s, node);
+        if (best == 0 || t->expire < best)
+            best = t->expire;
+    }
+    return best;
+}
+
+uint64_t
+timeout_next(void)
+{
+    uint64_t best = 0;
+    int level, i;
+
+    if (wheel_count == 0) return 0;
+
+    for (level = 0; level < TIMEOUT_LEVELS; ++ level)
+    {
+        unsigned int base = (wheel_tick >> (TIMEOUT_BITS * level)) & TIMEOUT_MASK;
+
+        /* above level 0 the current slot is one full turn ahead as
+         * often as not, so it cannot end the scan */
+        if (level > 0)
+            best = __slot_min(&wheel[level][base], best);
+
+        for (i = level > 0; i < TIMEOUT_SLOTS; ++ i)
+        {
+            list_entry_t slot = &wheel[level][(base + i) & TIMEOUT_MASK];
+            if (list_empty(slot)) continue;
+
+            best = __slot_min(slot, best);
+            break;
+        }
+    }
+
+    if (best < wheel_tick) best = wheel_tick;
+    return best * TIMEOUT_TICK_NS;
+}
@@ -0,0 +1,413 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "base.h"
+
+/* Event record/replay.
+ *
+ * A trace is a header followed by records of a kind byte, a 32 bit
+ * payload length and the payload. Recording writes down everything
+ * the window manager took from the server, in the order it took it:
+ * the connection setup, events (with the time they were read and
+ * where each batch ended), replies and errors, generated ids, and the
+ * times the timer wheel ran. Replaying is a connection backend (see
+ * x.c) that hands the same things back in the same order over an
+ * error connection, on which every request is a no-op, so the
+ * handlers and client classes run offline.
+ *
+ * Replies are matched by order only; a replay of code that issues
+ * different requests than the recording did drifts apart, which is
+ * counted as desyncs. */
+
+#define TRACE_MAGIC   "CWMTRACE"
+#define TRACE_VERSION 1
+
+#define TRACE_SETUP     1
+#define TRACE_EVENT     2
+#define TRACE_BATCH_END 3
+#define TRACE_REPLY     4
+#define TRACE_ERROR     5
+#define TRACE_ID        6
+#define TRACE_TIMER     7
+
+int trace_mode = TRACE_MODE_OFF;
+
+trace_replay_stats_s trace_replay_stats;
+
+static FILE *trace_file = NULL;
+
+/* replay: the whole trace in memory and the next unread record */
+static unsigned char *data      = NULL;
+static size_t         data_size = 0;
+static size_t         data_pos  = 0;
+
+static xcb_setup_t *replay_setup = NULL;
+static uint64_t     replay_clock = 0;
+
+static void
+__write(int kind, const void *payload, uint32_t len)
+{
+    unsigned char k = kind;
+
+    fwrite(&k, 1, 1, trace_file);
+    fwrite(&len, sizeof(len), 1, trace_file);
+    if (len) fwrite(payload, 1, len, trace_file);
+}
+
+/* kind of the next record, 0 at the end of the trace */
+static int
+__peek(void)
+{
+    if (data_pos + 5 > data_size) return 0;
+    return data[data_pos];
+}
+
+static unsigned char *
+__take(uint32_t *len)
+{
+    unsigned char *p;
+    uint32_t l;
+
+    memcpy(&l, data + data_pos + 1, sizeof(l));
+    if (data_pos + 5 + l > data_size)
+    {
+        /* truncated, treat as the end */
+        data_pos = data_size;
+        *len = 0;
+        return NULL;
+    }
+
+    p = data + data_pos + 5;
+    data_pos += 5 + l;
+    *len = l;
+    return p;
+}
+
+int
+trace_record_open(const char *path)
+{
+    uint32_t version = TRACE_VERSION;
+
+    if ((trace_file = fopen(path, "wb")) == NULL)
+        return -1;
+
+    setvbuf(trace_file, NULL, _IOFBF, 1 << 16);
+    fwrite(TRACE_MAGIC, 1, 8, trace_file);
+    fwrite(&version, sizeof(version), 1, trace_file);
+
+    trace_mode = TRACE_MODE_RECORD;
+    return 0;
+}
+
+int
+trace_replay_open(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    size_t size = 0, n;
+    uint32_t version;
+
+    if (f == NULL)
+        return -1;
+
+    while (1)
+    {
+        unsigned char *d = (unsigned char *)realloc(data, size + (1 << 20));
+        if (d == NULL)
+        {
+            fclose(f);
+            return -1;
+        }
+        data = d;
+
+        n = fread(data + size, 1, 1 << 20, f);
+        size += n;
+        if (n < (1 << 20)) break;
+    }
+    fclose(f);
+
+    if (size >= 12) memcpy(&version, data + 8, sizeof(version));
+    if (size < 12 || memcmp(data, TRACE_MAGIC, 8) || version != TRACE_VERSION)
+    {
+        fprintf(stderr, "%s is not a trace of this version\n", path);
+        return -1;
+    }
+
+    data_size = size;
+    data_pos  = 12;
+    trace_mode = TRACE_MODE_REPLAY;
+    x_backend  = &x_backend_replay;
+    return 0;
+}
+
+void
+trace_close(void)
+{
+    if (trace_file)
+    {
+        fclose(trace_file);
+        trace_file = NULL;
+    }
+
+    free(data);
+    data = NULL;
+    free(replay_setup);
+    replay_setup = NULL;
+}
+
+/* Recording, called by the xcb backend in x.c */
+
+void
+trace_record_setup(const xcb_setup_t *setup)
+{
+    __write(TRACE_SETUP, setup, 8 + setup->length * 4);
+}
+
+void
+trace_record_id(uint32_t id)
+{
+    __write(TRACE_ID, &id, sizeof(id));
+}
+
+void
+trace_record_event(xcb_generic_event_t *e)
+{
+    unsigned char buf[8 + 32];
+    uint64_t now = time_now_ns();
+    uint32_t len = 32;
+
+    if ((e->response_type & ~0x80) == XCB_GE_GENERIC)
+        len += ((xcb_ge_generic_event_t *)e)->length * 4;
+
+    if (len == 32)
+    {
+        memcpy(buf, &now, 8);
+        memcpy(buf + 8, e, 32);
+        __write(TRACE_EVENT, buf, sizeof(buf));
+        return;
+    }
+
+    /* the tail of a generic event sits behind full_sequence */
+    unsigned char *p = (unsigned char *)malloc(8 + len);
+    if (p == NULL) return;
+    memcpy(p, &now, 8);
+    memcpy(p + 8, e, 32);
+    memcpy(p + 8 + 32, (char *)e + sizeof(xcb_generic_event_t), len - 32);
+    __write(TRACE_EVENT, p, 8 + len);
+    free(p);
+}
+
+void
+trace_record_batch_end(void)
+{
+    __write(TRACE_BATCH_END, NULL, 0);
+}
+
+void
+trace_record_reply(void *reply, xcb_generic_error_t *error)
+{
+    if (error)
+        __write(TRACE_ERROR, error, 32);
+    else if (reply)
+        __write(TRACE_REPLY, reply, 32 + ((xcb_generic_reply_t *)reply)->length * 4);
+    else
+        __write(TRACE_ERROR, NULL, 0);
+}
+
+/* Replay backend */
+
+static xcb_connection_t *
+__replay_connect(int *screen)
+{
+    /* any request on this is a no-op */
+    xcb_connection_t *c = xcb_connect_to_fd(-1, NULL);
+
+    if (__peek() == TRACE_SETUP)
+    {
+        uint32_t len;
+        unsigned char *p = __take(&len);
+        if ((replay_setup = (xcb_setup_t *)malloc(len)) != NULL)
+            memcpy(replay_setup, p, len);
+    }
+    if (screen) *screen = 0;
+
+    return c;
+}
+
+static int
+__replay_connection_error(void)
+{
+    return replay_setup == NULL;
+}
+
+static const xcb_setup_t *
+__replay_get_setup(void)
+{
+    return replay_setup;
+}
+
+static uint32_t
+__replay_generate_id(void)
+{
+    uint32_t id;
+
+    if (__peek() == TRACE_ID)
+    {
+        uint32_t len;
+        unsigned char *p = __take(&len);
+        if (len == sizeof(id))
+        {
+            memcpy(&id, p, sizeof(id));
+            return id;
+        }
+    }
+
+    ++ trace_replay_stats.desyncs;
+    return XCB_NONE;
+}
+
+static xcb_generic_event_t *
+__replay_event_next(int read)
+{
+    xcb_generic_event_t *e;
+    uint32_t len;
+    unsigned char *p;
+
+    switch (__peek())
+    {
+    case TRACE_EVENT:
+        p = __take(&len);
+        if (len < 8 + 32) return NULL;
+
+        /* handlers may read full_sequence, give them a whole event */
+        e = (xcb_generic_event_t *)malloc(len - 8 + sizeof(xcb_generic_event_t) - 32);
+        if (e == NULL) return NULL;
+
+        memcpy(&replay_clock, p, 8);
+        memcpy(e, p + 8, 32);
+        e->full_sequence = e->sequence;
+        if (len > 8 + 32)
+            memcpy((char *)e + sizeof(xcb_generic_event_t), p + 8 + 32, len - 8 - 32);
+
+        ++ trace_replay_stats.events;
+        return e;
+
+    case TRACE_BATCH_END:
+        __take(&len);
+        return NULL;
+
+    default:
+        return NULL;
+    }
+}
+
+static void
+__replay_batch_end(void)
+{ }
+
+/* next reply or error of the trace, or 0 if the next record is not one */
+static int
+__replay_reply(void **reply, xcb_generic_error_t **error)
+{
+    int kind = __peek();
+    uint32_t len;
+    unsigned char *p;
+
+    if (kind != TRACE_REPLY && kind != TRACE_ERROR)
+        return 0;
+
+    p = __take(&len);
+    *reply = NULL;
+    *error = NULL;
+
+    if (len == 0)
+        return 1;
+
+    /* errors are read up to full_sequence */
+    void *copy = calloc(1, len < sizeof(xcb_generic_error_t) ? sizeof(xcb_generic_error_t) : len);
+    if (copy == NULL) return 1;
+    memcpy(copy, p, len);
+
+    if (kind == TRACE_REPLY) *reply = copy;
+    else *error = (xcb_generic_error_t *)copy;
+
+    ++ trace_replay_stats.replies;
+    return 1;
+}
+
+static int
+__replay_reply_poll(unsigned int sequence, void **reply, xcb_generic_error_t **error)
+{
+    return __replay_reply(reply, error);
+}
+
+static void *
+__replay_reply_wait(unsigned int sequence, xcb_generic_error_t **error)
+{
+    void *reply = NULL;
+
+    if (!__replay_reply(&reply, error))
+    {
+        ++ trace_replay_stats.desyncs;
+        *error = NULL;
+    }
+    return reply;
+}
+
+/* requests go to the error connection as they are */
+x_backend_s x_backend_replay =
+{
+    .offline          = 1,
+    .connect          = __replay_connect,
+    .connection_error = __replay_connection_error,
+    .get_setup        = __replay_get_setup,
+    .generate_id      = __replay_generate_id,
+    .event_next       = __replay_event_next,
+    .batch_end        = __replay_batch_end,
+    .reply_poll       = __replay_reply_poll,
+    .reply_wait       = __replay_reply_wait,
+};
+
+void
+trace_timer(uint64_t now)
+{
+    if (trace_mode == TRACE_MODE_RECORD)
+        __write(TRACE_TIMER, &now, sizeof(now));
+}
+
+uint64_t
+trace_clock(void)
+{
+    return replay_clock;
+}
+
+int
+trace_replay_step(void)
+{
+    uint32_t len;
+    unsigned char *p;
+
+    switch (__peek())
+    {
+    case 0:
+        return 0;
+
+    case TRACE_TIMER:
+        p = __take(&len);
+        if (len == sizeof(replay_clock))
+        {
+            memcpy(&replay_clock, p, sizeof(replay_clock));
+            ++ trace_replay_stats.timers;
+            timeout_run(replay_clock);
+        }
+        return 1;
+
+    default:
+        /* nobody asked for it, the code has changed since */
+        __take(&len);
+        ++ trace_replay_stats.desyncs;
+        return 1;
+    }
+}
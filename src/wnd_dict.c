@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "base.h"
+
+/* Window dictionary: open addressing with robin hood probing.
+ *
+ * Slots only hold the window id, the probe distance and a pointer to
+ * the node. Nodes themselves live in a pool and never move, so the
+ * pointer returned by wnd_dict_find stays valid until the window is
+ * erased, no matter how the table is reorganized meanwhile. */
+
+#define WND_DICT_INIT_BITS  10
+#define WND_DICT_LOAD_NUM   7   /* grow when 7/8 full */
+#define WND_DICT_LOAD_DEN   8
+#define WND_DICT_POOL_CHUNK 512 /* nodes per pool chunk */
+
+typedef struct wnd_dict_slot_s
+{
+    xcb_window_t    wnd;
+    unsigned int    dist;       /* probe distance + 1, 0 for empty slot */
+    wnd_dict_node_t node;
+} wnd_dict_slot_s;
+
+static wnd_dict_slot_s  *slots     = NULL;
+static unsigned int      slot_bits = 0;
+static unsigned int      slot_mask = 0;
+static unsigned int      count     = 0;
+
+static pool_s           node_pool;
+static int              node_pool_ready = 0;
+
+static inline unsigned int
+__hash(xcb_window_t wnd)
+{
+    /* fibonacci hashing, window ids are mostly sequential */
+    return ((uint32_t)wnd * 2654435769u) >> (32 - slot_bits);
+}
+
+static wnd_dict_node_t
+__node_alloc(void)
+{
+    if (!node_pool_ready)
+    {
+        pool_init(&node_pool, "wnd_dict", sizeof(wnd_dict_node_s), WND_DICT_POOL_CHUNK);
+        node_pool_ready = 1;
+    }
+    return (wnd_dict_node_t)pool_alloc(&node_pool);
+}
+
+static void
+__node_free(wnd_dict_node_t node)
+{
+    pool_free(&node_pool, node);
+}
+
+/* Place an entry known to be absent. Robin hood: whoever is further
+ * from its home slot keeps the slot. */
+static void
+__slot_insert(xcb_window_t wnd, wnd_dict_node_t node)
+{
+    unsigned int i = __hash(wnd);
+    wnd_dict_slot_s cur = { wnd, 1, node };
+
+    while (1)
+    {
+        wnd_dict_slot_s *s = &slots[i];
+        if (s->dist == 0)
+        {
+            *s = cur;
+            return;
+        }
+
+        if (s->dist < cur.dist)
+        {
+            wnd_dict_slot_s t = *s;
+            *s = cur;
+            cur = t;
+        }
+
+        i = (i + 1) & slot_mask;
+        ++ cur.dist;
+    }
+}
+
+static int
+__resize(unsigned int bits)
+{
+    wnd_dict_slot_s *old = slots;
+    unsigned int old_size = old ? slot_mask + 1 : 0;
+    unsigned int i;
+
+    slots = (wnd_dict_slot_s *)calloc((size_t)1 << bits, sizeof(wnd_dict_slot_s));
+    if (slots == NULL)
+    {
+        slots = old;
+        return -1;
+    }
+
+    slot_bits = bits;
+    slot_mask = (1u << bits) - 1;
+
+    for (i = 0; i < old_size; ++ i)
+    {
+        if (old[i].dist)
+            __slot_insert(old[i].wnd, old[i].node);
+    }
+
+    free(old);
+    return 0;
+}
+
+static int
+__slot_lookup(xcb_window_t wnd)
+{
+    if (slots == NULL) return -1;
+
+    unsigned int i = __hash(wnd);
+    unsigned int d = 1;
+
+    while (1)
+    {
+        wnd_dict_slot_s *s = &slots[i];
+        /* an entry closer to home than we are means we are absent */
+        if (s->dist < d) return -1;
+        if (s->wnd == wnd) return i;
+
+        i = (i + 1) & slot_mask;
+        ++ d;
+    }
+}
+
+static void
+__slot_erase(unsigned int i)
+{
+    /* backward shift, no tombstones */
+    unsigned int next = (i + 1) & slot_mask;
+    while (slots[next].dist > 1)
+    {
+        slots[i] = slots[next];
+        -- slots[i].dist;
+        i = next;
+        next = (next + 1) & slot_mask;
+    }
+    slots[i].dist = 0;
+}
+
+wnd_dict_node_t
+wnd_dict_find(xcb_window_t wnd, int op)
+{
+    int i = __slot_lookup(wnd);
+    wnd_dict_node_t node = i < 0 ? NULL : slots[i].node;
+
+    switch (op)
+    {
+    case WND_DICT_FIND_OP_TOUCH:
+        if (node != NULL)
+            return node;
+
+        if (slots == NULL || (count + 1) * WND_DICT_LOAD_DEN > (slot_mask + 1) * WND_DICT_LOAD_NUM)
+        {
+            if (__resize(slots ? slot_bits + 1 : WND_DICT_INIT_BITS))
+                return NULL;
+        }
+
+        if ((node = __node_alloc()) == NULL)
+            return NULL;
+
+        node->wnd = wnd;
+        node->role = WND_ROLE_INIT;
+        node->link = NULL;
+
+        __slot_insert(wnd, node);
+        ++ count;
+
+        return node;
+
+    case WND_DICT_FIND_OP_ERASE:
+        if (node == NULL)
+            return NULL;
+
+        __slot_erase(i);
+        __node_free(node);
+        -- count;
+
+        return node;
+
+    default:
+        return node;
+    }
+}
+
+unsigned int
+wnd_dict_count(void)
+{
+    return count;
+}
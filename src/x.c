@@ -0,0 +1,95 @@
+#include <stdlib.h>
+
+#include <xcb/xcbext.h>
+
+#include "base.h"
+
+/* Connection backends. The live one talks to the server through xcb
+ * and writes down what it receives when a trace is being recorded;
+ * trace.c and mock.c provide the offline ones. */
+
+static xcb_connection_t *
+__xcb_connect(int *screen)
+{
+    xcb_connection_t *c = xcb_connect(NULL, screen);
+
+    if (trace_mode == TRACE_MODE_RECORD && !xcb_connection_has_error(c))
+        trace_record_setup(xcb_get_setup(c));
+    return c;
+}
+
+static int
+__xcb_connection_error(void)
+{
+    return xcb_connection_has_error(x_conn);
+}
+
+static const xcb_setup_t *
+__xcb_get_setup(void)
+{
+    return xcb_get_setup(x_conn);
+}
+
+static uint32_t
+__xcb_generate_id(void)
+{
+    uint32_t id = xcb_generate_id(x_conn);
+
+    if (trace_mode == TRACE_MODE_RECORD)
+        trace_record_id(id);
+    return id;
+}
+
+static xcb_generic_event_t *
+__xcb_event_next(int read)
+{
+    xcb_generic_event_t *e = read ? xcb_poll_for_event(x_conn) : xcb_poll_for_queued_event(x_conn);
+
+    if (e && trace_mode == TRACE_MODE_RECORD)
+        trace_record_event(e);
+    return e;
+}
+
+static void
+__xcb_batch_end(void)
+{
+    if (trace_mode == TRACE_MODE_RECORD)
+        trace_record_batch_end();
+}
+
+static int
+__xcb_reply_poll(unsigned int sequence, void **reply, xcb_generic_error_t **error)
+{
+    if (!xcb_poll_for_reply(x_conn, sequence, reply, error))
+        return 0;
+
+    if (trace_mode == TRACE_MODE_RECORD)
+        trace_record_reply(*reply, *error);
+    return 1;
+}
+
+static void *
+__xcb_reply_wait(unsigned int sequence, xcb_generic_error_t **error)
+{
+    void *reply = xcb_wait_for_reply(x_conn, sequence, error);
+
+    if (trace_mode == TRACE_MODE_RECORD)
+        trace_record_reply(reply, *error);
+    return reply;
+}
+
+/* the requests are left to the inline wrappers in base.h */
+x_backend_s x_backend_xcb =
+{
+    .offline          = 0,
+    .connect          = __xcb_connect,
+    .connection_error = __xcb_connection_error,
+    .get_setup        = __xcb_get_setup,
+    .generate_id      = __xcb_generate_id,
+    .event_next       = __xcb_event_next,
+    .batch_end        = __xcb_batch_end,
+    .reply_poll       = __xcb_reply_poll,
+    .reply_wait       = __xcb_reply_wait,
+};
+
+x_backend_t x_backend = &x_backend_xcb;